@@ -0,0 +1,834 @@
+/*
+	https://github.com/cole8888/Gene2Pic
+
+	Incremental deflate (RFC 1951) compressor.
+
+	Data goes into a sliding window where LZ77 matches are found with hash chains (like zlib and lodepng). The resulting literals
+	and matches are collected until a block is full, then the block is written out using whichever of stored, fixed Huffman or
+	dynamic Huffman coding is smallest (unless the settings ask for a particular block type).
+
+	Sequences are mostly close to random, where matches rarely pay for themselves. Blocks which come out smaller without them switch
+	the stream to only looking for runs of a byte (like zlib's Z_RLE strategy) until a long match shows up again.
+*/
+
+#include "DeflateStream.h"
+
+#define DEFLATE_WINDOW_MASK (DEFLATE_WINDOW_SIZE - 1)
+#define DEFLATE_HASH_SIZE (1 << DEFLATE_HASH_BITS)
+#define DEFLATE_MATCH_FLAG 0x80000000u
+#define DEFLATE_NUM_LITLEN_CODES 288
+#define DEFLATE_NUM_DISTANCE_CODES 32
+#define DEFLATE_NUM_CODELENGTH_CODES 19
+#define DEFLATE_MAX_CODE_BITS 15
+#define DEFLATE_MAX_CODELENGTH_BITS 7
+#define DEFLATE_END_OF_BLOCK 256
+#define DEFLATE_PROBE_INTERVAL 16	// While only literals are being written, look for a long match this often.
+#define DEFLATE_PROBE_MATCH 32	// A match at least this long means the data is worth matching again.
+#define DEFLATE_RUNS_ONLY_MIN_BITS 4	// Blocks that compress to fewer bits per byte than this are not tried without their matches.
+
+// Base values and number of extra bits for the length codes 257-285 and distance codes 0-29. (RFC 1951 section 3.2.5)
+static const unsigned lengthBase[29] = {3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258};
+static const unsigned lengthExtra[29] = {0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0};
+static const unsigned distanceBase[30] = {1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577};
+static const unsigned distanceExtra[30] = {0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13};
+
+// Order the code length code lengths are written in.
+static const unsigned codeLengthOrder[DEFLATE_NUM_CODELENGTH_CODES] = {16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15};
+
+// Code lengths and bit reversed codes for one Huffman tree.
+typedef struct{
+	u_int8_t lengths[DEFLATE_NUM_LITLEN_CODES];
+	u_int16_t codes[DEFLATE_NUM_LITLEN_CODES];
+} HuffmanTree;
+
+// Make sure there is room for extra more bytes of output. Returns false (and marks the stream as failed) if there is not enough memory.
+static bool reserveOutput(DeflateStream *stream, size_t extra){
+	if(stream->outSize + extra <= stream->outCapacity){
+		return true;
+	}
+	if(stream->failed){
+		return false;	// Already said so.
+	}
+	size_t capacity = stream->outCapacity ? stream->outCapacity : 65536;
+	while(capacity < stream->outSize + extra){
+		capacity *= 2;
+	}
+	u_char *out = (u_char *)realloc(stream->out, capacity);
+	if(NULL == out){
+		fprintf(stderr, "Unable to allocate deflate output buffer... May have run out of RAM.\n");
+		stream->failed = true;
+		return false;
+	}
+	stream->out = out;
+	stream->outCapacity = capacity;
+	return true;
+}
+
+// Append count bits of value to the output, least significant bit first.
+static void putBits(DeflateStream *stream, u_int32_t value, int count){
+	stream->bitBuffer |= (u_int64_t)value << stream->bitCount;
+	stream->bitCount += count;
+	if(stream->bitCount >= 32){
+		if(reserveOutput(stream, 4)){
+			for(int i = 0; i < 4; i++){
+				stream->out[stream->outSize++] = (u_char)(stream->bitBuffer >> (8 * i));
+			}
+		}
+		stream->bitBuffer >>= 32;
+		stream->bitCount -= 32;
+	}
+}
+
+// Write out any whole or partial bytes still in the bit buffer, padding with zeroes up to the next byte boundary.
+static void alignToByte(DeflateStream *stream){
+	while(stream->bitCount > 0 && reserveOutput(stream, 8)){
+		stream->out[stream->outSize++] = (u_char)stream->bitBuffer;
+		stream->bitBuffer >>= 8;
+		stream->bitCount -= 8;
+	}
+	stream->bitBuffer = 0;
+	stream->bitCount = 0;
+}
+
+// Reverse the lowest count bits of code. Huffman codes are stored most significant bit first but everything else is least significant first.
+static u_int16_t reverseBits(unsigned code, int count){
+	unsigned reversed = 0;
+	for(int i = 0; i < count; i++){
+		reversed = (reversed << 1) | ((code >> i) & 1);
+	}
+	return (u_int16_t)reversed;
+}
+
+/*
+	Build Huffman code lengths for the given frequencies where no code is longer than maxBits.
+	Uses the two queue method on the leaves sorted by frequency. If the tree ends up too deep, the frequencies are flattened
+	(halved, keeping every used symbol at least 1) and the tree is rebuilt until it fits.
+	Always produces a complete code, if only one symbol is used a second one is given a length as well.
+*/
+static void buildCodeLengths(const u_int32_t *frequencies, int numSymbols, int maxBits, u_int8_t *lengths){
+	int symbols[DEFLATE_NUM_LITLEN_CODES];	// Used symbols sorted by frequency.
+	u_int32_t weights[2 * DEFLATE_NUM_LITLEN_CODES];	// Leaves followed by internal nodes.
+	int parents[2 * DEFLATE_NUM_LITLEN_CODES];
+	int used = 0;
+
+	memset(lengths, 0, numSymbols);
+	for(int i = 0; i < numSymbols; i++){
+		if(frequencies[i] > 0){
+			symbols[used++] = i;
+		}
+	}
+	if(used == 0){
+		return;
+	}
+	if(used == 1){
+		lengths[symbols[0]] = 1;
+		lengths[symbols[0] == 0 ? 1 : 0] = 1;
+		return;
+	}
+
+	// Insertion sort the used symbols by frequency (never more than 288 of them).
+	for(int i = 1; i < used; i++){
+		int symbol = symbols[i];
+		int j = i - 1;
+		while(j >= 0 && frequencies[symbols[j]] > frequencies[symbol]){
+			symbols[j + 1] = symbols[j];
+			j--;
+		}
+		symbols[j + 1] = symbol;
+	}
+	for(int i = 0; i < used; i++){
+		weights[i] = frequencies[symbols[i]];
+	}
+
+	while(true){
+		// Two queue Huffman: leaves are already sorted and internal nodes are created in increasing weight order.
+		int nextLeaf = 0;
+		int nextNode = used;
+		int numNodes = used;
+		while(numNodes < 2 * used - 1){
+			int children[2];
+			for(int c = 0; c < 2; c++){
+				if(nextLeaf < used && (nextNode >= numNodes || weights[nextLeaf] <= weights[nextNode])){
+					children[c] = nextLeaf++;
+				}
+				else{
+					children[c] = nextNode++;
+				}
+			}
+			weights[numNodes] = weights[children[0]] + weights[children[1]];
+			parents[children[0]] = numNodes;
+			parents[children[1]] = numNodes;
+			numNodes++;
+		}
+
+		// Depth of each node is one more than its parent's. Nodes were created in order so parents always come later.
+		int depths[2 * DEFLATE_NUM_LITLEN_CODES];
+		int maxDepth = 0;
+		depths[numNodes - 1] = 0;
+		for(int i = numNodes - 2; i >= 0; i--){
+			depths[i] = depths[parents[i]] + 1;
+			if(i < used && depths[i] > maxDepth){
+				maxDepth = depths[i];
+			}
+		}
+
+		if(maxDepth <= maxBits){
+			for(int i = 0; i < used; i++){
+				lengths[symbols[i]] = (u_int8_t)depths[i];
+			}
+			return;
+		}
+
+		// Too deep, flatten the frequencies and try again. Halving keeps the leaves in sorted order.
+		for(int i = 0; i < used; i++){
+			weights[i] = (weights[i] + 1) / 2;
+		}
+	}
+}
+
+// Turn code lengths into canonical bit reversed codes. (RFC 1951 section 3.2.2)
+static void buildCodes(HuffmanTree *tree, int numSymbols){
+	int lengthCounts[DEFLATE_MAX_CODE_BITS + 1] = {0};
+	unsigned nextCode[DEFLATE_MAX_CODE_BITS + 1] = {0};
+	for(int i = 0; i < numSymbols; i++){
+		lengthCounts[tree->lengths[i]]++;
+	}
+	lengthCounts[0] = 0;
+	unsigned code = 0;
+	for(int bits = 1; bits <= DEFLATE_MAX_CODE_BITS; bits++){
+		code = (code + lengthCounts[bits - 1]) << 1;
+		nextCode[bits] = code;
+	}
+	for(int i = 0; i < numSymbols; i++){
+		if(tree->lengths[i] != 0){
+			tree->codes[i] = reverseBits(nextCode[tree->lengths[i]]++, tree->lengths[i]);
+		}
+	}
+}
+
+// Fixed Huffman trees from RFC 1951 section 3.2.6.
+static void buildFixedTrees(HuffmanTree *litLen, HuffmanTree *distance){
+	for(int i = 0; i < DEFLATE_NUM_LITLEN_CODES; i++){
+		litLen->lengths[i] = i < 144 ? 8 : i < 256 ? 9 : i < 280 ? 7 : 8;
+	}
+	for(int i = 0; i < DEFLATE_NUM_DISTANCE_CODES; i++){
+		distance->lengths[i] = 5;
+	}
+	buildCodes(litLen, DEFLATE_NUM_LITLEN_CODES);
+	buildCodes(distance, DEFLATE_NUM_DISTANCE_CODES);
+}
+
+// Look up the deflate distance code for a match distance.
+static int getDistanceCode(const DeflateStream *stream, unsigned distance){
+	return distance <= 256 ? stream->distanceCode[distance - 1] : stream->distanceCode[256 + ((distance - 1) >> 7)];
+}
+
+// Count how often each literal/length and distance code is used in the current block.
+static void countSymbols(const DeflateStream *stream, u_int32_t *litLenFreqs, u_int32_t *distanceFreqs){
+	memset(litLenFreqs, 0, DEFLATE_NUM_LITLEN_CODES * sizeof(u_int32_t));
+	memset(distanceFreqs, 0, DEFLATE_NUM_DISTANCE_CODES * sizeof(u_int32_t));
+	for(long i = 0; i < stream->symbolCount; i++){
+		u_int32_t symbol = stream->symbols[i];
+		if(symbol & DEFLATE_MATCH_FLAG){
+			litLenFreqs[257 + stream->lengthCode[(symbol >> 16) & 0x1FF]]++;
+			distanceFreqs[getDistanceCode(stream, symbol & 0xFFFF)]++;
+		}
+		else{
+			litLenFreqs[symbol]++;
+		}
+	}
+	litLenFreqs[DEFLATE_END_OF_BLOCK] = 1;
+}
+
+// Number of bits the block's symbols take up with the given trees, including extra bits and the end of block code.
+static u_int64_t symbolBits(const u_int32_t *litLenFreqs, const u_int32_t *distanceFreqs, const HuffmanTree *litLen, const HuffmanTree *distance){
+	u_int64_t bits = 0;
+	for(int i = 0; i < 286; i++){
+		bits += (u_int64_t)litLenFreqs[i] * (litLen->lengths[i] + (i > 256 ? lengthExtra[i - 257] : 0));
+	}
+	for(int i = 0; i < 30; i++){
+		bits += (u_int64_t)distanceFreqs[i] * (distance->lengths[i] + distanceExtra[i]);
+	}
+	return bits;
+}
+
+// Run length encode the code lengths of both trees using code length symbols 0-18. Each entry holds the symbol in the low byte and its extra bits value above it.
+static int encodeCodeLengths(const u_int8_t *lengths, int count, u_int16_t *encoded){
+	int numEncoded = 0;
+	int i = 0;
+	while(i < count){
+		u_int8_t value = lengths[i];
+		int run = 1;
+		while(i + run < count && lengths[i + run] == value){
+			run++;
+		}
+		i += run;
+		if(value == 0){
+			// Runs of zeroes, 11-138 with symbol 18 and 3-10 with symbol 17.
+			while(run >= 11){
+				int repeat = run < 138 ? run : 138;
+				encoded[numEncoded++] = 18 | (u_int16_t)((repeat - 11) << 8);
+				run -= repeat;
+			}
+			if(run >= 3){
+				encoded[numEncoded++] = 17 | (u_int16_t)((run - 3) << 8);
+				run = 0;
+			}
+		}
+		else{
+			// Write the length once then repeat it 3-6 times at a time with symbol 16.
+			encoded[numEncoded++] = value;
+			run--;
+			while(run >= 3){
+				int repeat = run < 6 ? run : 6;
+				encoded[numEncoded++] = 16 | (u_int16_t)((repeat - 3) << 8);
+				run -= repeat;
+			}
+		}
+		while(run-- > 0){
+			encoded[numEncoded++] = value;
+		}
+	}
+	return numEncoded;
+}
+
+// Write the block's literals and matches followed by the end of block code.
+static void writeSymbols(DeflateStream *stream, const HuffmanTree *litLen, const HuffmanTree *distance){
+	for(long i = 0; i < stream->symbolCount; i++){
+		u_int32_t symbol = stream->symbols[i];
+		if(symbol & DEFLATE_MATCH_FLAG){
+			unsigned length = (symbol >> 16) & 0x1FF;
+			unsigned dist = symbol & 0xFFFF;
+			int lengthCode = stream->lengthCode[length];
+			int distCode = getDistanceCode(stream, dist);
+			putBits(stream, litLen->codes[257 + lengthCode], litLen->lengths[257 + lengthCode]);
+			putBits(stream, length - lengthBase[lengthCode], lengthExtra[lengthCode]);
+			putBits(stream, distance->codes[distCode], distance->lengths[distCode]);
+			putBits(stream, dist - distanceBase[distCode], distanceExtra[distCode]);
+		}
+		else{
+			putBits(stream, litLen->codes[symbol], litLen->lengths[symbol]);
+		}
+	}
+	putBits(stream, litLen->codes[DEFLATE_END_OF_BLOCK], litLen->lengths[DEFLATE_END_OF_BLOCK]);
+}
+
+// Write the bytes from blockStart to position as stored blocks.
+static void writeStoredBlocks(DeflateStream *stream, bool final){
+	long start = stream->blockStart;
+	do{
+		long len = stream->position - start < DEFLATE_MAX_STORED_LEN ? stream->position - start : DEFLATE_MAX_STORED_LEN;
+		bool last = start + len == stream->position;
+		putBits(stream, (final && last) ? 1 : 0, 1);
+		putBits(stream, 0, 2);
+		alignToByte(stream);
+		if(!reserveOutput(stream, 4 + len)){
+			return;
+		}
+		stream->out[stream->outSize++] = (u_char)len;
+		stream->out[stream->outSize++] = (u_char)(len >> 8);
+		stream->out[stream->outSize++] = (u_char)~len;
+		stream->out[stream->outSize++] = (u_char)(~len >> 8);
+		memcpy(stream->out + stream->outSize, stream->window + start, len);
+		stream->outSize += len;
+		start += len;
+	} while(start < stream->position);
+}
+
+// Dynamic Huffman trees for a block, along with the run length encoded code lengths that describe them in the block header.
+typedef struct{
+	HuffmanTree litLen;
+	HuffmanTree distance;
+	HuffmanTree codeLength;
+	int numLitLen;
+	int numDistance;
+	int numCodeLength;
+	u_int16_t encodedLengths[DEFLATE_NUM_LITLEN_CODES + DEFLATE_NUM_DISTANCE_CODES];
+	int numEncoded;
+} DynamicTrees;
+
+// Build dynamic Huffman trees for the given frequencies. Returns the size of the block in bits with them, header included.
+static u_int64_t buildDynamicTrees(const u_int32_t *litLenFreqs, const u_int32_t *distanceFreqs, DynamicTrees *trees){
+	memset(trees, 0, sizeof(DynamicTrees));
+	buildCodeLengths(litLenFreqs, DEFLATE_NUM_LITLEN_CODES, DEFLATE_MAX_CODE_BITS, trees->litLen.lengths);
+	buildCodeLengths(distanceFreqs, DEFLATE_NUM_DISTANCE_CODES, DEFLATE_MAX_CODE_BITS, trees->distance.lengths);
+	bool anyMatches = false;
+	for(int i = 0; i < DEFLATE_NUM_DISTANCE_CODES; i++){
+		anyMatches = anyMatches || distanceFreqs[i] > 0;
+	}
+	if(!anyMatches){
+		// No matches, but there still has to be a distance tree. Give it two codes so it is complete.
+		trees->distance.lengths[0] = 1;
+		trees->distance.lengths[1] = 1;
+	}
+	buildCodes(&trees->litLen, DEFLATE_NUM_LITLEN_CODES);
+	buildCodes(&trees->distance, DEFLATE_NUM_DISTANCE_CODES);
+
+	trees->numLitLen = 286;
+	while(trees->numLitLen > 257 && trees->litLen.lengths[trees->numLitLen - 1] == 0){
+		trees->numLitLen--;
+	}
+	trees->numDistance = 30;
+	while(trees->numDistance > 1 && trees->distance.lengths[trees->numDistance - 1] == 0){
+		trees->numDistance--;
+	}
+	u_int8_t allLengths[DEFLATE_NUM_LITLEN_CODES + DEFLATE_NUM_DISTANCE_CODES];
+	memcpy(allLengths, trees->litLen.lengths, trees->numLitLen);
+	memcpy(allLengths + trees->numLitLen, trees->distance.lengths, trees->numDistance);
+	trees->numEncoded = encodeCodeLengths(allLengths, trees->numLitLen + trees->numDistance, trees->encodedLengths);
+
+	u_int32_t codeLengthFreqs[DEFLATE_NUM_CODELENGTH_CODES] = {0};
+	for(int i = 0; i < trees->numEncoded; i++){
+		codeLengthFreqs[trees->encodedLengths[i] & 0xFF]++;
+	}
+	buildCodeLengths(codeLengthFreqs, DEFLATE_NUM_CODELENGTH_CODES, DEFLATE_MAX_CODELENGTH_BITS, trees->codeLength.lengths);
+	buildCodes(&trees->codeLength, DEFLATE_NUM_CODELENGTH_CODES);
+	trees->numCodeLength = DEFLATE_NUM_CODELENGTH_CODES;
+	while(trees->numCodeLength > 4 && trees->codeLength.lengths[codeLengthOrder[trees->numCodeLength - 1]] == 0){
+		trees->numCodeLength--;
+	}
+
+	u_int64_t bits = 3 + 14 + 3 * trees->numCodeLength + symbolBits(litLenFreqs, distanceFreqs, &trees->litLen, &trees->distance);
+	for(int i = 0; i < trees->numEncoded; i++){
+		int symbol = trees->encodedLengths[i] & 0xFF;
+		bits += trees->codeLength.lengths[symbol] + (symbol == 16 ? 2 : symbol == 17 ? 3 : symbol == 18 ? 7 : 0);
+	}
+	return bits;
+}
+
+// Length of the run of bytes from position (up to end) that are the same as the byte before it, a match with a distance of 1.
+// Returns 0 if it is too short to use.
+static int findRun(const DeflateStream *stream, long position, long end){
+	if(position == 0){
+		return 0;
+	}
+	int maxLength = end - position < DEFLATE_MAX_MATCH ? (int)(end - position) : DEFLATE_MAX_MATCH;
+	const u_char *current = stream->window + position;
+	int length = 0;
+	while(length < maxLength && current[length] == current[-1]){
+		length++;
+	}
+	return length >= (int)stream->settings.minmatch && length >= DEFLATE_MIN_MATCH ? length : 0;
+}
+
+// Count the symbols of the current block if it was made of nothing but literals and runs of a byte, the way it is when runsOnly is set.
+// The symbols themselves are stored too if symbols is not NULL. Returns how many there are.
+static long countRunSymbols(const DeflateStream *stream, u_int32_t *litLenFreqs, u_int32_t *distanceFreqs, u_int32_t *symbols){
+	memset(litLenFreqs, 0, DEFLATE_NUM_LITLEN_CODES * sizeof(u_int32_t));
+	memset(distanceFreqs, 0, DEFLATE_NUM_DISTANCE_CODES * sizeof(u_int32_t));
+	long count = 0;
+	long position = stream->blockStart;
+	while(position < stream->position){
+		int length = findRun(stream, position, stream->position);
+		u_int32_t symbol = length > 0 ? DEFLATE_MATCH_FLAG | ((u_int32_t)length << 16) | 1 : stream->window[position];
+		if(length > 0){
+			litLenFreqs[257 + stream->lengthCode[length]]++;
+			distanceFreqs[0]++;
+			position += length;
+		}
+		else{
+			litLenFreqs[symbol]++;
+			position++;
+		}
+		if(NULL != symbols){
+			symbols[count] = symbol;
+		}
+		count++;
+	}
+	litLenFreqs[DEFLATE_END_OF_BLOCK] = 1;
+	return count;
+}
+
+/*
+	Bases are close to random, and matches in them are short and far back. They can cost more bits than the literals they replace, and
+	searching for them is most of the time spent compressing. So a dynamic block with matches is also priced with nothing but literals and
+	runs of a byte (blank pixels, the all zero rows of upscaled images), and written that way if that is smaller. Blocks which are better
+	off without matches set runsOnly, so the next block does not spend time looking for them (see tokenize()).
+*/
+static void dropUnprofitableMatches(DeflateStream *stream, u_int32_t *litLenFreqs, u_int32_t *distanceFreqs, DynamicTrees *trees, u_int64_t *dynamicBits){
+	// If every match is already a run there is nothing to compare against. Matching found nothing better, so carry on without searching.
+	bool onlyRuns = true;
+	for(long i = 0; i < stream->symbolCount && onlyRuns; i++){
+		onlyRuns = !(stream->symbols[i] & DEFLATE_MATCH_FLAG) || (stream->symbols[i] & 0xFFFF) == 1;
+	}
+	if(onlyRuns){
+		stream->runsOnly = true;
+		return;
+	}
+	// Matches that shrink the block this much are long ones, runs would not do better. (Saves pricing every block of repetitive data.)
+	if(*dynamicBits < (u_int64_t)(stream->position - stream->blockStart) * DEFLATE_RUNS_ONLY_MIN_BITS){
+		stream->runsOnly = false;
+		return;
+	}
+
+	u_int32_t runLitLenFreqs[DEFLATE_NUM_LITLEN_CODES];
+	u_int32_t runDistanceFreqs[DEFLATE_NUM_DISTANCE_CODES];
+	countRunSymbols(stream, runLitLenFreqs, runDistanceFreqs, NULL);
+	DynamicTrees runTrees;
+	u_int64_t runBits = buildDynamicTrees(runLitLenFreqs, runDistanceFreqs, &runTrees);
+	stream->runsOnly = runBits < *dynamicBits;
+	if(stream->runsOnly){
+		// Never more symbols than bytes, and a block never holds more than a window of bytes, so they always fit.
+		stream->symbolCount = countRunSymbols(stream, litLenFreqs, distanceFreqs, stream->symbols);
+		*trees = runTrees;
+		*dynamicBits = runBits;
+	}
+}
+
+// Write out the block built so far, picking whichever block type is smallest unless the settings ask for a particular one.
+static void emitBlock(DeflateStream *stream, bool final){
+	u_int32_t litLenFreqs[DEFLATE_NUM_LITLEN_CODES];
+	u_int32_t distanceFreqs[DEFLATE_NUM_DISTANCE_CODES];
+	countSymbols(stream, litLenFreqs, distanceFreqs);
+
+	// Dynamic Huffman cost, including the trees in the header.
+	DynamicTrees trees;
+	u_int64_t dynamicBits = buildDynamicTrees(litLenFreqs, distanceFreqs, &trees);
+	if(stream->settings.btype >= 2){
+		dropUnprofitableMatches(stream, litLenFreqs, distanceFreqs, &trees, &dynamicBits);
+	}
+
+	// Fixed Huffman cost.
+	HuffmanTree fixedLitLen, fixedDistance;
+	buildFixedTrees(&fixedLitLen, &fixedDistance);
+	u_int64_t fixedBits = 3 + symbolBits(litLenFreqs, distanceFreqs, &fixedLitLen, &fixedDistance);
+
+	// Stored cost, one header per 65535 bytes plus padding to a byte boundary.
+	long rawLen = stream->position - stream->blockStart;
+	u_int64_t storedBits = (u_int64_t)rawLen * 8 + (rawLen / DEFLATE_MAX_STORED_LEN + 1) * (3 + 7 + 32);
+
+	unsigned btype = stream->settings.btype;
+	if(btype > 2){
+		btype = 2;
+	}
+	if(btype == 2 && fixedBits < dynamicBits){
+		btype = 1;
+	}
+	if(btype != 0 && storedBits < (btype == 1 ? fixedBits : dynamicBits)){
+		btype = 0;
+	}
+
+	if(btype == 0){
+		writeStoredBlocks(stream, final);
+	}
+	else if(btype == 1){
+		putBits(stream, final ? 1 : 0, 1);
+		putBits(stream, 1, 2);
+		writeSymbols(stream, &fixedLitLen, &fixedDistance);
+	}
+	else{
+		putBits(stream, final ? 1 : 0, 1);
+		putBits(stream, 2, 2);
+		putBits(stream, trees.numLitLen - 257, 5);
+		putBits(stream, trees.numDistance - 1, 5);
+		putBits(stream, trees.numCodeLength - 4, 4);
+		for(int i = 0; i < trees.numCodeLength; i++){
+			putBits(stream, trees.codeLength.lengths[codeLengthOrder[i]], 3);
+		}
+		for(int i = 0; i < trees.numEncoded; i++){
+			int symbol = trees.encodedLengths[i] & 0xFF;
+			putBits(stream, trees.codeLength.codes[symbol], trees.codeLength.lengths[symbol]);
+			if(symbol >= 16){
+				putBits(stream, trees.encodedLengths[i] >> 8, symbol == 16 ? 2 : symbol == 17 ? 3 : 7);
+			}
+		}
+		writeSymbols(stream, &trees.litLen, &trees.distance);
+	}
+
+	stream->symbolCount = 0;
+	stream->blockStart = stream->position;
+}
+
+// Hash of the 3 bytes at position.
+static u_int32_t hash3(const u_char *bytes){
+	u_int32_t value = ((u_int32_t)bytes[0] << 16) | ((u_int32_t)bytes[1] << 8) | bytes[2];
+	return (value * 2654435761u) >> (32 - DEFLATE_HASH_BITS);
+}
+
+// Remember position so later matches can find it. Needs 3 bytes of data from position onwards.
+static void insertHash(DeflateStream *stream, long position){
+	if(position + DEFLATE_MIN_MATCH > stream->windowLen){
+		return;
+	}
+	u_int32_t hash = hash3(stream->window + position);
+	stream->prev[position & DEFLATE_WINDOW_MASK] = stream->head[hash];
+	stream->head[hash] = (int)position;
+}
+
+// Find the longest match for the bytes at position within the window. Returns the length (0 if nothing usable) and sets distance.
+static int findMatch(const DeflateStream *stream, long position, unsigned *distance){
+	long available = stream->windowLen - position;
+	int maxLength = available < DEFLATE_MAX_MATCH ? (int)available : DEFLATE_MAX_MATCH;
+	if(maxLength < (int)stream->settings.minmatch || maxLength < DEFLATE_MIN_MATCH){
+		return 0;
+	}
+
+	const u_char *current = stream->window + position;
+	int bestLength = 0;
+	int chain = stream->maxChainLength;
+	long candidate = stream->head[hash3(current)];
+	while(candidate >= 0 && chain-- > 0){
+		long dist = position - candidate;
+		if(dist <= 0 || dist > (long)stream->settings.windowsize){
+			break;
+		}
+		const u_char *match = stream->window + candidate;
+		// Quick check on the byte that would make this match longer than the best so far before comparing the whole thing.
+		if(match[bestLength] == current[bestLength] && match[0] == current[0]){
+			int length = 0;
+			while(length < maxLength && match[length] == current[length]){
+				length++;
+			}
+			if(length > bestLength){
+				bestLength = length;
+				*distance = (unsigned)dist;
+				if(length >= (int)stream->settings.nicematch || length == maxLength){
+					break;
+				}
+			}
+		}
+		candidate = stream->prev[candidate & DEFLATE_WINDOW_MASK];
+	}
+	return bestLength >= (int)stream->settings.minmatch && bestLength >= DEFLATE_MIN_MATCH ? bestLength : 0;
+}
+
+// Add a literal or match to the current block.
+static void addSymbol(DeflateStream *stream, u_int32_t symbol){
+	stream->symbols[stream->symbolCount++] = symbol;
+}
+
+// Turn the bytes in the window into literals and matches. Unless flushing, enough bytes are held back that every match can reach its full length.
+static void tokenize(DeflateStream *stream, bool flushing){
+	long limit = flushing ? stream->windowLen : stream->windowLen - DEFLATE_MAX_MATCH;
+	while(stream->position < limit){
+		// Keep blocks to a sensible size, and short enough that the bytes for a stored block are still in the window.
+		if(stream->symbolCount >= DEFLATE_MAX_BLOCK_SYMBOLS - 1 || stream->position - stream->blockStart >= DEFLATE_WINDOW_SIZE){
+			emitBlock(stream, false);
+		}
+
+		long position = stream->position;
+		unsigned distance = 0;
+		int length = 0;
+		if(stream->settings.use_lz77 && !stream->runsOnly){
+			length = findMatch(stream, position, &distance);
+		}
+		else if(stream->settings.use_lz77){
+			// Matching has not been paying off lately, so only runs of a byte are taken. Every DEFLATE_PROBE_INTERVAL'th position is still
+			// searched, for a match long enough to show the data has started repeating (a satellite, or the rows of an upscaled image).
+			length = findRun(stream, position, stream->windowLen);
+			distance = 1;
+			if(length == 0 && position % DEFLATE_PROBE_INTERVAL == 0){
+				length = findMatch(stream, position, &distance);
+				stream->runsOnly = length < DEFLATE_PROBE_MATCH;
+				length = stream->runsOnly ? 0 : length;
+			}
+		}
+		insertHash(stream, position);
+
+		// Lazy matching, if the next position has a longer match then emit this byte as a literal and take that match instead.
+		if(length > 0 && stream->settings.lazymatching && !stream->runsOnly && length < (int)stream->settings.nicematch && position + 1 < limit){
+			unsigned nextDistance = 0;
+			int nextLength = findMatch(stream, position + 1, &nextDistance);
+			if(nextLength > length){
+				addSymbol(stream, stream->window[position]);
+				stream->position++;
+				continue;
+			}
+		}
+
+		if(length > 0){
+			addSymbol(stream, DEFLATE_MATCH_FLAG | ((u_int32_t)length << 16) | distance);
+			for(long i = position + 1; i < position + length; i++){
+				insertHash(stream, i);
+			}
+			stream->position += length;
+		}
+		else{
+			addSymbol(stream, stream->window[position]);
+			stream->position++;
+		}
+	}
+}
+
+// Move the window down by DEFLATE_WINDOW_SIZE bytes to make room for more data, keeping a full window of history before position.
+static void slideWindow(DeflateStream *stream){
+	// Bytes of the current block are about to leave the window, so finish the block while they are still there.
+	if(stream->blockStart < DEFLATE_WINDOW_SIZE){
+		emitBlock(stream, false);
+	}
+	memmove(stream->window, stream->window + DEFLATE_WINDOW_SIZE, stream->windowLen - DEFLATE_WINDOW_SIZE);
+	stream->windowLen -= DEFLATE_WINDOW_SIZE;
+	stream->position -= DEFLATE_WINDOW_SIZE;
+	stream->blockStart -= DEFLATE_WINDOW_SIZE;
+	for(int i = 0; i < DEFLATE_HASH_SIZE; i++){
+		stream->head[i] = stream->head[i] >= DEFLATE_WINDOW_SIZE ? stream->head[i] - DEFLATE_WINDOW_SIZE : -1;
+	}
+	for(int i = 0; i < DEFLATE_WINDOW_SIZE; i++){
+		stream->prev[i] = stream->prev[i] >= DEFLATE_WINDOW_SIZE ? stream->prev[i] - DEFLATE_WINDOW_SIZE : -1;
+	}
+}
+
+// Set up a stream using the provided lodepng compression settings. Returns false (after saying so) if memory cannot be allocated,
+// the stream must still be freed with deflateStreamFree().
+bool deflateStreamInit(DeflateStream *stream, const LodePNGCompressSettings *settings){
+	memset(stream, 0, sizeof(DeflateStream));
+	stream->settings = *settings;
+	if(stream->settings.windowsize == 0 || stream->settings.windowsize > DEFLATE_WINDOW_SIZE){
+		stream->settings.windowsize = DEFLATE_WINDOW_SIZE;
+	}
+	if(stream->settings.nicematch == 0 || stream->settings.nicematch > DEFLATE_MAX_MATCH){
+		stream->settings.nicematch = DEFLATE_MAX_MATCH;
+	}
+	// Same trade off lodepng makes, small windows get short chains.
+	stream->maxChainLength = stream->settings.windowsize >= 8192 ? stream->settings.windowsize : stream->settings.windowsize / 8;
+	stream->adler = 1;
+
+	stream->window = (u_char *)malloc(DEFLATE_BUFFER_SIZE);
+	stream->head = (int *)malloc(DEFLATE_HASH_SIZE * sizeof(int));
+	stream->prev = (int *)malloc(DEFLATE_WINDOW_SIZE * sizeof(int));
+	stream->symbols = (u_int32_t *)malloc(DEFLATE_MAX_BLOCK_SYMBOLS * sizeof(u_int32_t));
+	if(NULL == stream->window || NULL == stream->head || NULL == stream->prev || NULL == stream->symbols){
+		fprintf(stderr, "Unable to allocate deflate stream... May have run out of RAM.\n");
+		stream->failed = true;
+		return false;
+	}
+	for(int i = 0; i < DEFLATE_HASH_SIZE; i++){
+		stream->head[i] = -1;
+	}
+	for(int i = 0; i < DEFLATE_WINDOW_SIZE; i++){
+		stream->prev[i] = -1;
+	}
+
+	// Lookup tables from match length and distance to their codes.
+	for(int code = 0; code < 29; code++){
+		for(unsigned length = lengthBase[code]; length < lengthBase[code] + (1u << lengthExtra[code]) && length <= DEFLATE_MAX_MATCH; length++){
+			stream->lengthCode[length] = (u_int8_t)code;
+		}
+	}
+	stream->lengthCode[DEFLATE_MAX_MATCH] = 28;	// 258 has its own code even though code 27 could also reach it.
+	for(int code = 0; code < 30; code++){
+		for(unsigned dist = distanceBase[code]; dist < distanceBase[code] + (1u << distanceExtra[code]); dist++){
+			stream->distanceCode[dist <= 256 ? dist - 1 : 256 + ((dist - 1) >> 7)] = (u_int8_t)code;
+		}
+	}
+	return true;
+}
+
+// Free everything the stream allocated, including any output that has not been collected.
+void deflateStreamFree(DeflateStream *stream){
+	free(stream->out);
+	free(stream->window);
+	free(stream->head);
+	free(stream->prev);
+	free(stream->symbols);
+	memset(stream, 0, sizeof(DeflateStream));
+}
+
+// Prime the window with data that came before the stream so matches can refer back into it (only the last DEFLATE_WINDOW_SIZE bytes are used).
+// Must be called before anything is written. The dictionary itself is not compressed and is not part of the Adler-32.
+void deflateStreamSetDictionary(DeflateStream *stream, const u_char *dictionary, size_t len){
+	if(stream->failed){
+		return;
+	}
+	if(len > DEFLATE_WINDOW_SIZE){
+		dictionary += len - DEFLATE_WINDOW_SIZE;
+		len = DEFLATE_WINDOW_SIZE;
+	}
+	memcpy(stream->window, dictionary, len);
+	stream->windowLen = (long)len;
+	for(long i = 0; i < (long)len; i++){
+		insertHash(stream, i);
+	}
+	stream->position = (long)len;
+	stream->blockStart = (long)len;
+}
+
+// Compress len more bytes. Output is only produced as blocks fill up, call deflateStreamFlush() to force it out.
+void deflateStreamWrite(DeflateStream *stream, const u_char *data, size_t len){
+	if(stream->failed){
+		return;
+	}
+	stream->adler = adler32Update(stream->adler, data, len);
+	stream->totalIn += len;
+	while(len > 0){
+		if(stream->windowLen == DEFLATE_BUFFER_SIZE){
+			slideWindow(stream);
+		}
+		size_t space = DEFLATE_BUFFER_SIZE - stream->windowLen;
+		size_t chunk = len < space ? len : space;
+		memcpy(stream->window + stream->windowLen, data, chunk);
+		stream->windowLen += chunk;
+		data += chunk;
+		len -= chunk;
+		tokenize(stream, false);
+	}
+}
+
+// Finish the current block. If final is true the stream is ended, otherwise an empty stored block is added so the output
+// ends on a byte boundary (a zlib "sync flush") and more data can follow.
+void deflateStreamFlush(DeflateStream *stream, bool final){
+	if(stream->failed){
+		return;
+	}
+	tokenize(stream, true);
+	if(stream->symbolCount > 0 || final){
+		emitBlock(stream, final);
+	}
+	if(final){
+		alignToByte(stream);
+	}
+	else{
+		// Empty stored block.
+		putBits(stream, 0, 3);
+		alignToByte(stream);
+		if(!reserveOutput(stream, 4)){
+			return;
+		}
+		stream->out[stream->outSize++] = 0x00;
+		stream->out[stream->outSize++] = 0x00;
+		stream->out[stream->outSize++] = 0xFF;
+		stream->out[stream->outSize++] = 0xFF;
+	}
+}
+
+// Update an Adler-32 checksum with more data. Start with 1.
+u_int32_t adler32Update(u_int32_t adler, const u_char *data, size_t len){
+	u_int32_t a = adler & 0xFFFF;
+	u_int32_t b = adler >> 16;
+	while(len > 0){
+		// 5552 is the most bytes that can be summed before b could overflow 32 bits.
+		size_t chunk = len < 5552 ? len : 5552;
+		len -= chunk;
+		while(chunk-- > 0){
+			a += *data++;
+			b += a;
+		}
+		a %= 65521;
+		b %= 65521;
+	}
+	return (b << 16) | a;
+}
+
+// Combine the Adler-32 of two pieces of data into the Adler-32 of both together, where len2 is the length of the second piece.
+// (Same method as zlib's adler32_combine().)
+u_int32_t adler32Combine(u_int32_t adler1, u_int32_t adler2, u_int64_t len2){
+	const u_int32_t base = 65521;
+	u_int32_t rem = (u_int32_t)(len2 % base);
+	u_int32_t sum1 = adler1 & 0xFFFF;
+	u_int32_t sum2 = (u_int32_t)(((u_int64_t)rem * sum1) % base);
+	sum1 += (adler2 & 0xFFFF) + base - 1;
+	sum2 += (adler1 >> 16) + (adler2 >> 16) + base - rem;
+	if(sum1 >= base){
+		sum1 -= base;
+	}
+	if(sum1 >= base){
+		sum1 -= base;
+	}
+	if(sum2 >= (base << 1)){
+		sum2 -= (base << 1);
+	}
+	if(sum2 >= base){
+		sum2 -= base;
+	}
+	return sum1 | (sum2 << 16);
+}
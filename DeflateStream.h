@@ -0,0 +1,85 @@
+/*
+	https://github.com/cole8888/Gene2Pic
+
+	Incremental deflate (RFC 1951) compressor. Unlike lodepng_deflate() it does not need the whole input up front, data can be
+	written a few rows at a time and the compressed bytes collected as they are produced. Uses the same LodePNGCompressSettings
+	as lodepng so both encoders can be tuned the same way.
+*/
+
+#ifndef DEFLATESTREAM_H
+#define DEFLATESTREAM_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <sys/types.h>
+#include "LODEPNG/lodepng.h"
+
+#define DEFLATE_WINDOW_SIZE 32768	// Largest distance a match can reach back.
+#define DEFLATE_BUFFER_SIZE (2 * DEFLATE_WINDOW_SIZE)	// History plus room for new data.
+#define DEFLATE_MIN_MATCH 3
+#define DEFLATE_MAX_MATCH 258
+#define DEFLATE_HASH_BITS 15
+#define DEFLATE_MAX_BLOCK_SYMBOLS 65536	// Start a new block once this many literals and matches are waiting.
+#define DEFLATE_MAX_STORED_LEN 65535	// Largest stored block deflate allows.
+
+typedef struct{
+	LodePNGCompressSettings settings;	// Block type, window size, match lengths and lazy matching. (Same meaning as in lodepng.)
+	int maxChainLength;	// How many earlier positions with the same hash are tried before giving up on finding a longer match.
+
+	// Compressed output. Grows as blocks are finished, the caller may empty it at any time by setting outSize back to 0.
+	u_char *out;
+	size_t outSize;
+	size_t outCapacity;
+	u_int64_t bitBuffer;	// Bits waiting to be written to out, least significant first.
+	int bitCount;
+
+	// Sliding window. Holds up to DEFLATE_WINDOW_SIZE bytes of history before position, then the bytes which have not been compressed yet.
+	u_char *window;
+	long windowLen;	// Bytes in use in the window.
+	long position;	// First byte which has not been turned into a literal or match yet.
+	long blockStart;	// First byte of the block currently being built.
+	int *head;	// Most recent position for each hash.
+	int *prev;	// Previous position with the same hash, indexed by position modulo the window size.
+
+	bool runsOnly;	// The last block was smaller without its matches, so only runs of a byte and the occasional long match are looked for.
+
+	// Literals and matches of the block currently being built. Matches have the top bit set, the length in bits 16-24 and the distance in the low 16 bits.
+	u_int32_t *symbols;
+	long symbolCount;
+
+	u_int32_t adler;	// Adler-32 of everything written so far, needed for the zlib trailer.
+	bool failed;	// Memory for the stream or its output could not be allocated. Anything written after that is dropped, the output is incomplete.
+	u_int64_t totalIn;	// Number of uncompressed bytes written so far.
+
+	// Lookup tables from match length and distance to deflate code.
+	u_int8_t lengthCode[DEFLATE_MAX_MATCH + 1];
+	u_int8_t distanceCode[512];
+} DeflateStream;
+
+// Set up a stream using the provided lodepng compression settings. Returns false (after saying so) if memory cannot be allocated,
+// the stream must still be freed with deflateStreamFree().
+bool deflateStreamInit(DeflateStream *stream, const LodePNGCompressSettings *settings);
+
+// Free everything the stream allocated, including any output that has not been collected.
+void deflateStreamFree(DeflateStream *stream);
+
+// Prime the window with data that came before the stream so matches can refer back into it (only the last DEFLATE_WINDOW_SIZE bytes are used).
+// Must be called before anything is written. The dictionary itself is not compressed and is not part of the Adler-32.
+void deflateStreamSetDictionary(DeflateStream *stream, const u_char *dictionary, size_t len);
+
+// Compress len more bytes. Output is only produced as blocks fill up, call deflateStreamFlush() to force it out.
+void deflateStreamWrite(DeflateStream *stream, const u_char *data, size_t len);
+
+// Finish the current block. If final is true the stream is ended, otherwise an empty stored block is added so the output
+// ends on a byte boundary (a zlib "sync flush") and more data can follow.
+void deflateStreamFlush(DeflateStream *stream, bool final);
+
+// Update an Adler-32 checksum with more data. Start with 1.
+u_int32_t adler32Update(u_int32_t adler, const u_char *data, size_t len);
+
+// Combine the Adler-32 of two pieces of data into the Adler-32 of both together, where len2 is the length of the second piece.
+u_int32_t adler32Combine(u_int32_t adler1, u_int32_t adler2, u_int64_t len2);
+
+#endif
@@ -0,0 +1,126 @@
+/*
+	https://github.com/cole8888/Gene2Pic
+
+	Splits FASTA input into the stretches of sequence between header lines.
+*/
+
+#include "Fasta.h"
+
+// Add a new empty record which starts after all the bases seen so far. Returns false (after saying so and setting failed) if memory cannot be allocated.
+static bool addRecord(FastaParser *parser){
+	if(parser->numRecords == parser->capacity){
+		long long int capacity = parser->capacity == 0 ? 16 : parser->capacity * 2;
+		FastaRecord *records = (FastaRecord *)realloc(parser->records, capacity * sizeof(FastaRecord));
+		if(NULL == records){
+			fprintf(stderr, "Unable to allocate FASTA record list... May have run out of RAM.\n");
+			parser->failed = true;
+			return false;
+		}
+		parser->records = records;
+		parser->capacity = capacity;
+	}
+	FastaRecord *record = &parser->records[parser->numRecords++];
+	record->name[0] = '\0';
+	record->start = parser->totalBases;
+	record->len = 0;
+	return true;
+}
+
+// Go through the header line starting at data[*pos], picking up the record name, until the end of the line or the block.
+static void readHeader(FastaParser *parser, const char *data, long long int len, long long int *pos){
+	FastaRecord *record = &parser->records[parser->numRecords - 1];
+	size_t nameLen = strlen(record->name);
+	while(parser->inName && *pos < len){
+		char c = data[*pos];
+		if(c == ' ' || c == '\t' || c == '\r' || c == '\n'){
+			parser->inName = false;
+			break;
+		}
+		if(nameLen < FASTA_MAX_NAME_LEN - 1){
+			record->name[nameLen++] = c;
+			record->name[nameLen] = '\0';
+		}
+		(*pos)++;
+	}
+
+	// The description after the name is not needed, skip to the end of the line.
+	const char *newline = (const char *)memchr(data + *pos, '\n', len - *pos);
+	if(NULL == newline){
+		*pos = len;	// Header carries on into the next block.
+		return;
+	}
+	*pos = newline - data + 1;
+	parser->inHeader = false;
+	parser->atLineStart = true;
+}
+
+// Set up a parser for the start of an input.
+void fastaParserInit(FastaParser *parser){
+	memset(parser, 0, sizeof(FastaParser));
+	parser->atLineStart = true;
+}
+
+// Free the record list.
+void fastaParserFree(FastaParser *parser){
+	free(parser->records);
+	parser->records = NULL;
+	parser->numRecords = 0;
+	parser->capacity = 0;
+}
+
+// Find the next stretch of sequence in data, starting at *pos and skipping any header lines. On success segment and segmentLen are set,
+// *pos is moved past the stretch and true is returned. Returns false once the rest of the block has been used up, or (after saying so
+// and setting failed) if memory for another record cannot be allocated.
+// The stretch may still hold newlines and other characters which are not bases, it is up to the caller to validate it.
+bool fastaNextSegment(FastaParser *parser, const char *data, long long int len, long long int *pos, const char **segment, long long int *segmentLen){
+	while(*pos < len && !parser->failed){
+		if(parser->inHeader){
+			readHeader(parser, data, len, pos);
+			continue;
+		}
+
+		// A header starts with '>' at the start of a line.
+		if(data[*pos] == '>' && parser->atLineStart){
+			if(!addRecord(parser)){
+				return false;
+			}
+			parser->inHeader = true;
+			parser->inName = true;
+			(*pos)++;
+			continue;
+		}
+
+		// Sequence runs until the next '>' at the start of a line. Any other '>' is just a character that is not a base.
+		// Headers are rare, so looking for '>' skips through the sequence much faster than going line by line.
+		long long int start = *pos;
+		long long int end = len;
+		const char *found = data + start + 1;
+		while(found < data + len && NULL != (found = (const char *)memchr(found, '>', data + len - found))){
+			if(found[-1] == '\n'){
+				end = found - data;
+				break;
+			}
+			found++;
+		}
+		*segment = data + start;
+		*segmentLen = end - start;
+		*pos = end;
+		parser->atLineStart = data[end - 1] == '\n';
+		return true;
+	}
+	return false;
+}
+
+// Add count valid bases to the current record. Bases found before the first header go into an unnamed record.
+void fastaAddBases(FastaParser *parser, long long int count){
+	if(parser->numRecords == 0){
+		if(count == 0){
+			return;	// Do not make an empty record out of the blank lines or junk that can come before the first header.
+		}
+		if(!addRecord(parser)){
+			return;
+		}
+	}
+	parser->records[parser->numRecords - 1].len += count;
+	parser->totalBases += count;
+}
@@ -0,0 +1,55 @@
+/*
+	https://github.com/cole8888/Gene2Pic
+
+	Splits FASTA input into the stretches of sequence between header lines, so the letters of a header (">chr1 Homo sapiens...")
+	are never mistaken for bases. Files without any headers are treated as one unnamed record, so plain sequence files work as before.
+
+	The parser is fed the input one block at a time in a single pass and keeps track of where it is between blocks, so headers
+	may be split across blocks. It only finds the sequence, the caller validates it and reports back how many bases each stretch held.
+*/
+
+#ifndef FASTA_H
+#define FASTA_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <sys/types.h>
+
+#define FASTA_MAX_NAME_LEN 256	// Record names longer than this (including the terminator) are cut short.
+
+typedef struct{
+	char name[FASTA_MAX_NAME_LEN];	// First word of the header line, empty if the sequence came before any header.
+	long long int start;	// Index of the record's first base among all the valid bases in the input.
+	long long int len;	// Number of valid bases in the record.
+} FastaRecord;
+
+typedef struct{
+	bool inHeader;	// Part way through a header line.
+	bool inName;	// Still reading the record name at the start of the header line. (The rest of the line is a description.)
+	bool atLineStart;	// The next character of the input starts a new line.
+	bool failed;	// The record list could not be grown, nothing more is parsed.
+	long long int totalBases;
+
+	FastaRecord *records;
+	long long int numRecords;
+	long long int capacity;
+} FastaParser;
+
+// Set up a parser for the start of an input.
+void fastaParserInit(FastaParser *parser);
+
+// Free the record list.
+void fastaParserFree(FastaParser *parser);
+
+// Find the next stretch of sequence in data, starting at *pos and skipping any header lines. On success segment and segmentLen are set,
+// *pos is moved past the stretch and true is returned. Returns false once the rest of the block has been used up, or (after saying so
+// and setting failed) if memory for another record cannot be allocated.
+// The stretch may still hold newlines and other characters which are not bases, it is up to the caller to validate it.
+bool fastaNextSegment(FastaParser *parser, const char *data, long long int len, long long int *pos, const char **segment, long long int *segmentLen);
+
+// Add count valid bases to the current record. Bases found before the first header go into an unnamed record.
+void fastaAddBases(FastaParser *parser, long long int count);
+
+#endif
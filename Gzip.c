@@ -0,0 +1,269 @@
+/*
+	https://github.com/cole8888/Gene2Pic
+
+	Decompresses gzip input using the inflate built into lodepng, with BGZF members decompressed on every thread.
+*/
+
+#include "Gzip.h"
+
+// Read a little endian integer, which is how gzip stores them.
+static u_int32_t readUint32LE(const u_char *buffer){
+	return (u_int32_t)buffer[0] | ((u_int32_t)buffer[1] << 8) | ((u_int32_t)buffer[2] << 16) | ((u_int32_t)buffer[3] << 24);
+}
+
+/*
+	Work out where the deflate data of the member starting at data[offset] begins. If the header carries the BGZF "BC" extra
+	field, memberSize is set to the total size of the member (header, data and trailer), otherwise it is set to 0.
+	Returns false if the header is not valid.
+*/
+static bool parseMemberHeader(const u_char *data, size_t len, size_t offset, size_t *dataOffset, size_t *memberSize){
+	const u_char *header = data + offset;
+	if(len - offset < GZIP_HEADER_SIZE || header[0] != 0x1F || header[1] != 0x8B || header[2] != 8){
+		return false;	// Wrong magic number or not deflate.
+	}
+	u_char flags = header[3];
+	size_t pos = offset + GZIP_HEADER_SIZE;
+	*memberSize = 0;
+
+	if(flags & GZIP_FLAG_EXTRA){
+		if(len - pos < 2){
+			return false;
+		}
+		size_t extraLen = data[pos] | (data[pos + 1] << 8);
+		pos += 2;
+		if(len - pos < extraLen){
+			return false;
+		}
+
+		// The extra field is a list of subfields, BGZF adds one called "BC" holding the member size minus 1.
+		for(size_t sub = pos; sub + 4 <= pos + extraLen;){
+			size_t subLen = data[sub + 2] | (data[sub + 3] << 8);
+			if(data[sub] == 'B' && data[sub + 1] == 'C' && subLen == 2 && sub + 6 <= pos + extraLen){
+				*memberSize = (size_t)(data[sub + 4] | (data[sub + 5] << 8)) + 1;
+			}
+			sub += 4 + subLen;
+		}
+		pos += extraLen;
+	}
+
+	// Skip the zero terminated file name and comment, and the header CRC.
+	if(flags & GZIP_FLAG_NAME){
+		const u_char *end = (const u_char *)memchr(data + pos, 0, len - pos);
+		if(NULL == end){
+			return false;
+		}
+		pos = end - data + 1;
+	}
+	if(flags & GZIP_FLAG_COMMENT){
+		const u_char *end = (const u_char *)memchr(data + pos, 0, len - pos);
+		if(NULL == end){
+			return false;
+		}
+		pos = end - data + 1;
+	}
+	if(flags & GZIP_FLAG_HCRC){
+		pos += 2;
+	}
+	if(pos + GZIP_TRAILER_SIZE > len || (*memberSize != 0 && pos + GZIP_TRAILER_SIZE > offset + *memberSize)){
+		return false;
+	}
+	*dataOffset = pos;
+	return true;
+}
+
+// Inflate one member into out, which must have room for member->size bytes. Returns 0 on success, otherwise a lodepng error code
+// or -1 if the data did not match the size and CRC-32 in the trailer.
+static int inflateMember(const u_char *data, const GzipMember *member, u_char *out){
+	LodePNGDecompressSettings settings;
+	lodepng_decompress_settings_init(&settings);
+	u_char *inflated = NULL;
+	size_t inflatedSize = 0;
+
+	// The trailer is passed in along with the deflate data. Inflate stops at the last block anyway, and lodepng does not accept
+	// a stored block that ends right at the end of its input.
+	unsigned error = lodepng_inflate(&inflated, &inflatedSize, data + member->dataOffset, member->dataLen, &settings);
+	if(!error && (inflatedSize != member->size || lodepng_crc32(inflated, inflatedSize) != member->crc)){
+		error = -1;
+	}
+	if(!error && inflatedSize > 0){
+		memcpy(out, inflated, inflatedSize);	// Empty members (such as the BGZF end of file block) leave inflated NULL.
+	}
+	free(inflated);
+	return error;
+}
+
+// True if the data starts with the gzip magic number.
+bool isGzip(const u_char *data, size_t len){
+	return len >= 2 && data[0] == 0x1F && data[1] == 0x8B;
+}
+
+// True if there is nothing left but zero bytes, which tape and block tools pad the end of a file with. gzip(1) ignores them too.
+static bool isZeroPadding(const u_char *data, size_t len){
+	for(size_t i = 0; i < len; i++){
+		if(data[i] != 0){
+			return false;
+		}
+	}
+	return true;
+}
+
+/*
+	True if the input ends at offset, the end of a member. Anything after the last member is ignored the way gzip(1) does, zero
+	padding silently and anything else that is not the start of another member with a warning.
+*/
+static bool isEndOfMembers(const u_char *data, size_t len, size_t offset){
+	if(isZeroPadding(data + offset, len - offset)){
+		return true;
+	}
+	if(!isGzip(data + offset, len - offset)){
+		fprintf(stderr, "Ignoring %zu bytes after the end of the gzip data at byte %zu, they are not another gzip member.\n", len - offset, offset);
+		return true;
+	}
+	return false;
+}
+
+/*
+	Inflate the members from data[offset] to the end of the input one after the other, appending them to the outSize bytes already in out
+	(which may be NULL). Each member has to be inflated to find where it ends, and its size is only known modulo 2^32, so lodepng grows the
+	output as it goes. Member is the number of the first one, for messages. Returns the joined output, or NULL (after saying what was wrong
+	and freeing out) if a member is not valid.
+*/
+static u_char *inflateMembersInOrder(const u_char *data, size_t len, size_t offset, size_t member, u_char *out, size_t *outSize){
+	LodePNGDecompressSettings settings;
+	lodepng_decompress_settings_init(&settings);
+	size_t dataOffset, memberSize;
+	for(size_t first = offset; offset < len; member++){
+		if(offset > first && isEndOfMembers(data, len, offset)){
+			break;
+		}
+		if(!parseMemberHeader(data, len, offset, &dataOffset, &memberSize)){
+			fprintf(stderr, "Input has a damaged gzip header at byte %zu, the start of gzip member %zu.\n", offset, member);
+			free(out);
+			return NULL;
+		}
+		size_t memberStart = *outSize;
+		size_t used = 0;
+		unsigned error = lodepng_inflate_used(&out, outSize, &used, data + dataOffset, len - dataOffset, &settings);
+		if(error){
+			fprintf(stderr, "Unable to decompress gzip member %zu of the input, lodepng returned an error.\nError %u: %s\n", member, error, lodepng_error_text(error));
+			free(out);
+			return NULL;
+		}
+		if(used > len - dataOffset - GZIP_TRAILER_SIZE){
+			fprintf(stderr, "Gzip member %zu of the input is cut short, its checksum is missing.\n", member);
+			free(out);
+			return NULL;
+		}
+		const u_char *trailer = data + dataOffset + used;
+		if((u_int32_t)(*outSize - memberStart) != readUint32LE(trailer + 4) || lodepng_crc32(out + memberStart, *outSize - memberStart) != readUint32LE(trailer)){
+			fprintf(stderr, "Gzip member %zu of the input does not match its checksum, the file is damaged.\n", member);
+			free(out);
+			return NULL;
+		}
+		offset = dataOffset + used + GZIP_TRAILER_SIZE;
+	}
+	return out;
+}
+
+// Decompress a whole gzip file. BGZF files are decompressed on every thread, other gzip files one member at a time on one thread.
+// Plain gzip members after BGZF ones (a gzip file appended to a bgzip one) are decompressed one at a time after the BGZF ones.
+// Zero padding after the last member is ignored, and so is anything else that is not another member (with a warning), like gzip(1) does.
+// Returns a malloc'd buffer with the decompressed data and sets outLen, or returns NULL (after saying what was wrong) if the data is not valid
+// or memory cannot be allocated.
+u_char *gunzip(const u_char *data, size_t len, size_t *outLen){
+	size_t dataOffset, memberSize;
+	if(!parseMemberHeader(data, len, 0, &dataOffset, &memberSize)){
+		fprintf(stderr, "Input has a damaged gzip header.\n");
+		return NULL;
+	}
+
+	// A plain gzip file is one or more members one after the other (gzip -c a >> x adds one). The members are joined together.
+	if(memberSize == 0){
+		*outLen = 0;
+		return inflateMembersInOrder(data, len, 0, 0, NULL, outLen);
+	}
+
+	// BGZF, find every member first. Their trailers give the size of each one, so we know where each one's data goes before decompressing anything.
+	// A member without the BGZF size (such as a plain gzip file appended to a bgzip one) ends the list, it and everything after it are
+	// inflated one at a time afterwards.
+	size_t numMembers = 0;
+	size_t capacity = 1024;
+	GzipMember *members = (GzipMember *)malloc(capacity * sizeof(GzipMember));
+	if(NULL == members){
+		fprintf(stderr, "Unable to allocate BGZF block list... May have run out of RAM.\n");
+		return NULL;
+	}
+	size_t totalSize = 0;
+	size_t plainOffset = len;	// Where the members without a BGZF size start.
+	for(size_t offset = 0; offset < len; offset += memberSize){
+		if(offset > 0 && isEndOfMembers(data, len, offset)){
+			break;
+		}
+		bool validHeader = parseMemberHeader(data, len, offset, &dataOffset, &memberSize);
+		if(validHeader && memberSize == 0){
+			plainOffset = offset;
+			break;
+		}
+		if(!validHeader || offset + memberSize > len){
+			fprintf(stderr, "Input has a damaged BGZF block at byte %zu.\n", offset);
+			free(members);
+			return NULL;
+		}
+		if(numMembers == capacity){
+			GzipMember *grown = (GzipMember *)realloc(members, capacity * 2 * sizeof(GzipMember));
+			if(NULL == grown){
+				fprintf(stderr, "Unable to allocate BGZF block list... May have run out of RAM.\n");
+				free(members);
+				return NULL;
+			}
+			members = grown;
+			capacity *= 2;
+		}
+		GzipMember *member = &members[numMembers++];
+		member->dataOffset = dataOffset;
+		member->dataLen = offset + memberSize - dataOffset;
+		member->crc = readUint32LE(data + offset + memberSize - 8);
+		member->size = readUint32LE(data + offset + memberSize - 4);
+		member->outOffset = totalSize;
+		totalSize += member->size;
+	}
+
+	u_char *out = (u_char *)malloc(totalSize > 0 ? totalSize : 1);
+	if(NULL == out){
+		fprintf(stderr, "Unable to allocate decompressed input... May have run out of RAM.\n");
+		free(members);
+		return NULL;
+	}
+
+	// Every member is independent, so they can all be decompressed at once. Only the first failure is reported.
+	long long int failedMember = -1;
+	int failedError = 0;
+	#pragma omp parallel for schedule(dynamic, 64)
+	for(long long int i = 0; i < (long long int)numMembers; i++){
+		int error = inflateMember(data, &members[i], out + members[i].outOffset);
+		if(error){
+			#pragma omp critical
+			if(failedMember < 0 || i < failedMember){
+				failedMember = i;
+				failedError = error;
+			}
+		}
+	}
+	free(members);
+
+	if(failedMember >= 0){
+		if(failedError < 0){
+			fprintf(stderr, "BGZF block %lld of the input does not match its checksum, the file is damaged.\n", failedMember);
+		}
+		else{
+			fprintf(stderr, "Unable to decompress BGZF block %lld of the input, lodepng returned an error.\nError %d: %s\n", failedMember, failedError, lodepng_error_text(failedError));
+		}
+		free(out);
+		return NULL;
+	}
+	*outLen = totalSize;
+	if(plainOffset < len){
+		return inflateMembersInOrder(data, len, plainOffset, numMembers, out, outLen);
+	}
+	return out;
+}
@@ -0,0 +1,48 @@
+/*
+	https://github.com/cole8888/Gene2Pic
+
+	Decompresses gzip (RFC 1952) input using the inflate built into lodepng. Files made by bgzip (BGZF, used for indexed reference
+	genomes) are a series of small gzip members which each record their own size, so they are found up front and decompressed on
+	every thread at once.
+*/
+
+#ifndef GZIP_H
+#define GZIP_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <sys/types.h>
+#include <omp.h>
+#include "LODEPNG/lodepng.h"
+
+#define GZIP_HEADER_SIZE 10	// Fixed part of a member header.
+#define GZIP_TRAILER_SIZE 8	// CRC-32 and size of the uncompressed data.
+
+// Header flags.
+#define GZIP_FLAG_HCRC 0x02
+#define GZIP_FLAG_EXTRA 0x04
+#define GZIP_FLAG_NAME 0x08
+#define GZIP_FLAG_COMMENT 0x10
+
+// One gzip member of the input.
+typedef struct{
+	size_t dataOffset;	// Where the deflate data starts.
+	size_t dataLen;	// Length of the deflate data and the trailer after it.
+	u_int32_t crc;	// CRC-32 of the uncompressed data, from the trailer.
+	u_int32_t size;	// Uncompressed size (modulo 2^32), from the trailer.
+	size_t outOffset;	// Where the member's data goes in the decompressed output.
+} GzipMember;
+
+// True if the data starts with the gzip magic number.
+bool isGzip(const u_char *data, size_t len);
+
+// Decompress a whole gzip file. BGZF files are decompressed on every thread, other gzip files one member at a time on one thread.
+// Plain gzip members after BGZF ones (a gzip file appended to a bgzip one) are decompressed one at a time after the BGZF ones.
+// Zero padding after the last member is ignored, and so is anything else that is not another member (with a warning), like gzip(1) does.
+// Returns a malloc'd buffer with the decompressed data and sets outLen, or returns NULL (after saying what was wrong) if the data is not valid
+// or memory cannot be allocated.
+u_char *gunzip(const u_char *data, size_t len, size_t *outLen);
+
+#endif
@@ -1385,7 +1385,8 @@ static unsigned inflateNoCompression(ucvector* out, LodePNGBitReader* reader,
   return error;
 }
 
-static unsigned lodepng_inflatev(ucvector* out,
+/*used, if not NULL, is set to the number of bytes of in taken up by the deflate data*/
+static unsigned lodepng_inflatev(ucvector* out, size_t* used,
                                  const unsigned char* in, size_t insize,
                                  const LodePNGDecompressSettings* settings) {
   unsigned BFINAL = 0;
@@ -1407,6 +1408,7 @@ static unsigned lodepng_inflatev(ucvector* out,
     if(error) break;
   }
 
+  if(used) *used = (reader.bp + 7u) >> 3u;
   return error;
 }
 
@@ -1414,7 +1416,17 @@ unsigned lodepng_inflate(unsigned char** out, size_t* outsize,
                          const unsigned char* in, size_t insize,
                          const LodePNGDecompressSettings* settings) {
   ucvector v = ucvector_init(*out, *outsize);
-  unsigned error = lodepng_inflatev(&v, in, insize, settings);
+  unsigned error = lodepng_inflatev(&v, NULL, in, insize, settings);
+  *out = v.data;
+  *outsize = v.size;
+  return error;
+}
+
+unsigned lodepng_inflate_used(unsigned char** out, size_t* outsize, size_t* used,
+                              const unsigned char* in, size_t insize,
+                              const LodePNGDecompressSettings* settings) {
+  ucvector v = ucvector_init(*out, *outsize);
+  unsigned error = lodepng_inflatev(&v, used, in, insize, settings);
   *out = v.data;
   *outsize = v.size;
   return error;
@@ -1433,7 +1445,7 @@ static unsigned inflatev(ucvector* out, const unsigned char* in, size_t insize,
     }
     return error;
   } else {
-    return lodepng_inflatev(out, in, insize, settings);
+    return lodepng_inflatev(out, NULL, in, insize, settings);
   }
 }
 
@@ -930,6 +930,15 @@ unsigned lodepng_inflate(unsigned char** out, size_t* outsize,
                          const unsigned char* in, size_t insize,
                          const LodePNGDecompressSettings* settings);
 
+/*
+Same as lodepng_inflate, and also sets *used to the number of bytes of in the
+deflate data took up, so whatever follows it (such as a gzip trailer and the
+next gzip member) can be found. (Added for gene2pic.)
+*/
+unsigned lodepng_inflate_used(unsigned char** out, size_t* outsize, size_t* used,
+                              const unsigned char* in, size_t insize,
+                              const LodePNGDecompressSettings* settings);
+
 /*
 Decompresses Zlib data. Reallocates the out buffer and appends the data. The
 data must be according to the zlib specification.
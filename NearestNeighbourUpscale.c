@@ -10,9 +10,9 @@
 
 // Performs nearest neighbour upscaling of the original image where each pixel in the original image is expanded into an expanded pixel of size scale^2 in the upscaled image.
 // Used for 32bit RGBA or 24bit RGB images that have been read in as RGBA images.
-void upscaleNN_RGBA(u_char *originalImg, u_char *upscaledImg, int dimX, int dimY, int scale){
-	long long int scaledDimX = (long long int)(dimX * scale);	// X Dimension of the upscaled image.
-	long long int scaledDimY = (long long int)(dimY * scale);	// Y Dimension of the upscaled image.
+void upscaleNN_RGBA(u_char *originalImg, u_char *upscaledImg, long long int dimX, long long int dimY, int scale){
+	long long int scaledDimX = dimX * (long long int)scale;	// X Dimension of the upscaled image.
+	long long int scaledDimY = dimY * (long long int)scale;	// Y Dimension of the upscaled image.
 
 	// STEP 1. Place each pixel from the original image into the top-left corner of it's respective expanded pixel in the scaled up image.
 	#pragma omp parallel for
@@ -67,9 +67,9 @@ void upscaleNN_RGBA(u_char *originalImg, u_char *upscaledImg, int dimX, int dimY
 
 // Performs nearest neighbour upscaling of the original image where each pixel in the original image is expanded into an expanded pixel of size scale^2 in the upscaled image.
 // Used for 24bit RBG images.
-void upscaleNN_RGB(u_char *originalImg, u_char *upscaledImg, int dimX, int dimY, int scale){
-	long long int scaledDimX = (long long int)(dimX * scale);	// X Dimension of the upscaled image.
-	long long int scaledDimY = (long long int)(dimY * scale);	// Y Dimension of the upscaled image.
+void upscaleNN_RGB(u_char *originalImg, u_char *upscaledImg, long long int dimX, long long int dimY, int scale){
+	long long int scaledDimX = dimX * (long long int)scale;	// X Dimension of the upscaled image.
+	long long int scaledDimY = dimY * (long long int)scale;	// Y Dimension of the upscaled image.
 
 	// STEP 1. Place each pixel from the original image into the top-left corner of it's respective expanded pixel in the scaled up image.
 	#pragma omp parallel for
@@ -116,4 +116,24 @@ void upscaleNN_RGB(u_char *originalImg, u_char *upscaledImg, int dimX, int dimY,
 			}
 		}
 	}
-}
\ No newline at end of file
+}
+
+// Upscale a single row of a palette image horizontally, each pixel is repeated scale times. Used for palette images with a bit depth of 1, 2, 4 or 8.
+// Lets an encoder produce the upscaled image a row at a time without ever holding all of it.
+void upscaleNN_IndexedRow(const u_char *originalRow, u_char *scaledRow, long long int dimX, int scale, int bitDepth){
+	long long int scaledDimX = dimX * (long long int)scale;	// Width of the upscaled row.
+	int pixelsPerByte = 8 / bitDepth;
+	u_char pixelMask = (u_char)((1 << bitDepth) - 1);
+
+	// Zeroed first so the pixels can be OR'd into place.
+	memset(scaledRow, 0, (scaledDimX * bitDepth + 7) / 8);
+	long long int cols = 0;
+	for(long long int originalCol = 0; originalCol < dimX; originalCol++){
+		int originalShift = 8 - bitDepth * (int)(originalCol % pixelsPerByte + 1);
+		u_char pixel = (originalRow[originalCol / pixelsPerByte] >> originalShift) & pixelMask;
+		for(int k = 0; k < scale; k++, cols++){
+			int scaledShift = 8 - bitDepth * (int)(cols % pixelsPerByte + 1);
+			scaledRow[cols / pixelsPerByte] |= pixel << scaledShift;
+		}
+	}
+}
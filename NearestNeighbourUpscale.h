@@ -7,6 +7,8 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
 
 // Don't change these, lets the program know how many colour channels there are for RGB and RGBA.
 #define CHANNELS_PER_PIXEL_RGB 3
@@ -14,10 +16,14 @@
 
 // Performs nearest neighbour upscaling of the original image where each pixel in the original image is expanded into an expanded pixel of size scale^2 in the upscaled image.
 // Used for 32bit RGBA or 24bit RGB images that have been read in as RGBA.
-void upscaleNN_RGBA(u_char *originalImg, u_char *scaledImg, int dimX, int dimY, int scale);
+void upscaleNN_RGBA(u_char *originalImg, u_char *scaledImg, long long int dimX, long long int dimY, int scale);
 
 // Performs nearest neighbour upscaling of the original image where each pixel in the original image is expanded into an expanded pixel of size scale^2 in the upscaled image.
 // Used for 24bit RBG images.
-void upscaleNN_RGB(u_char *originalImg, u_char *scaledImg, int dimX, int dimY, int scale);
+void upscaleNN_RGB(u_char *originalImg, u_char *scaledImg, long long int dimX, long long int dimY, int scale);
+
+// Upscale a single row of a palette image horizontally, each pixel is repeated scale times. Used for palette images with a bit depth of 1, 2, 4 or 8.
+// Lets an encoder produce the upscaled image a row at a time without ever holding all of it.
+void upscaleNN_IndexedRow(const u_char *originalRow, u_char *scaledRow, long long int dimX, int scale, int bitDepth);
 
 #endif
\ No newline at end of file
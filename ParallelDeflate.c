@@ -0,0 +1,137 @@
+/*
+	https://github.com/cole8888/Gene2Pic
+
+	Multi-threaded deflate in the style of pigz.
+*/
+
+#include "ParallelDeflate.h"
+
+// One compressed chunk.
+typedef struct{
+	u_char *data;
+	size_t size;
+	u_int32_t adler;	// Adler-32 of the uncompressed chunk on its own.
+} DeflateChunk;
+
+// Compress len bytes of data on all threads. The historyLen bytes right before data (which must be readable) are used as the dictionary
+// for the first chunk. If final is true the last block ends the deflate stream, otherwise more data can be appended after the output.
+// Adler is updated to include data. If index is not NULL, the chunks which start without a dictionary are added to it and its lengths are
+// moved on past the output. Returns a malloc'd buffer holding the compressed data, its size is written to outSize. Returns NULL (after
+// saying so) if memory cannot be allocated, then adler and the index are left as they were.
+u_char *parallelDeflate(const u_char *data, size_t len, size_t historyLen, bool final, const LodePNGCompressSettings *settings, size_t *outSize, u_int32_t *adler,
+	RestartIndex *index){
+	long long int numChunks = len == 0 ? 1 : (len + PARALLEL_DEFLATE_CHUNK_SIZE - 1) / PARALLEL_DEFLATE_CHUNK_SIZE;
+	DeflateChunk *chunks = (DeflateChunk *)malloc(numChunks * sizeof(DeflateChunk));
+	if(NULL == chunks){
+		fprintf(stderr, "Unable to allocate deflate chunks... May have run out of RAM.\n");
+		return NULL;
+	}
+
+	bool failed = false;
+	#pragma omp parallel for schedule(dynamic)
+	for(long long int i = 0; i < numChunks; i++){
+		size_t chunkStart = (size_t)i * PARALLEL_DEFLATE_CHUNK_SIZE;
+		size_t chunkLen = len - chunkStart < PARALLEL_DEFLATE_CHUNK_SIZE ? len - chunkStart : PARALLEL_DEFLATE_CHUNK_SIZE;
+
+		// Everything before the chunk (up to a window's worth) is the dictionary. The first chunk uses the caller's history. Restart points have none.
+		size_t dictionaryLen = i == 0 ? historyLen : chunkStart + historyLen;
+		if(dictionaryLen > DEFLATE_WINDOW_SIZE){
+			dictionaryLen = DEFLATE_WINDOW_SIZE;
+		}
+		if(NULL != index && i % PARALLEL_DEFLATE_RESTART_INTERVAL == 0){
+			dictionaryLen = 0;
+		}
+
+		DeflateStream stream;
+		deflateStreamInit(&stream, settings);
+		if(dictionaryLen > 0){
+			deflateStreamSetDictionary(&stream, data + chunkStart - dictionaryLen, dictionaryLen);
+		}
+		deflateStreamWrite(&stream, data + chunkStart, chunkLen);
+		deflateStreamFlush(&stream, final && i == numChunks - 1);
+		if(stream.failed){
+			#pragma omp atomic write
+			failed = true;
+		}
+
+		// Take ownership of the output before the stream is freed.
+		chunks[i].data = stream.out;
+		chunks[i].size = stream.outSize;
+		chunks[i].adler = stream.adler;
+		stream.out = NULL;
+		deflateStreamFree(&stream);
+	}
+
+	// Join the chunks together and combine their checksums, in order.
+	size_t total = 0;
+	for(long long int i = 0; i < numChunks; i++){
+		total += chunks[i].size;
+	}
+	u_char *out = failed ? NULL : (u_char *)malloc(total > 0 ? total : 1);
+	if(NULL == out && !failed){
+		fprintf(stderr, "Unable to allocate compressed data buffer... May have run out of RAM.\n");
+	}
+	size_t numPoints = NULL != index ? index->numPoints : 0;
+	u_int32_t combined = *adler;
+	size_t offset = 0;
+	for(long long int i = 0; i < numChunks && NULL != out; i++){
+		size_t chunkStart = (size_t)i * PARALLEL_DEFLATE_CHUNK_SIZE;
+		size_t chunkLen = len - chunkStart < PARALLEL_DEFLATE_CHUNK_SIZE ? len - chunkStart : PARALLEL_DEFLATE_CHUNK_SIZE;
+		if(NULL != index && i % PARALLEL_DEFLATE_RESTART_INTERVAL == 0 && chunkLen > 0
+			&& !restartIndexAdd(index, index->rawLen + chunkStart, index->compressedLen + offset)){
+			index->numPoints = numPoints;	// Take back the points added by this call.
+			free(out);
+			out = NULL;
+			break;
+		}
+		memcpy(out + offset, chunks[i].data, chunks[i].size);
+		offset += chunks[i].size;
+		combined = adler32Combine(combined, chunks[i].adler, len == 0 ? 0 : chunkLen);
+	}
+	for(long long int i = 0; i < numChunks; i++){
+		free(chunks[i].data);
+	}
+	free(chunks);
+	if(NULL == out){
+		return NULL;
+	}
+	*adler = combined;
+	if(NULL != index){
+		index->rawLen += len;
+		index->compressedLen += total;
+	}
+
+	*outSize = total;
+	return out;
+}
+
+// Drop in replacement for lodepng's zlib compressor (LodePNGCompressSettings.custom_zlib) which compresses with parallelDeflate().
+unsigned parallelZlibCompress(u_char **out, size_t *outSize, const u_char *in, size_t inSize, const LodePNGCompressSettings *settings){
+	// The settings lodepng passes in still point at this function, take it out so nothing tries to call it recursively.
+	LodePNGCompressSettings deflateSettings = *settings;
+	deflateSettings.custom_zlib = NULL;
+
+	u_int32_t adler = 1;
+	size_t deflatedSize = 0;
+	u_char *deflated = parallelDeflate(in, inSize, 0, true, &deflateSettings, &deflatedSize, &adler, (RestartIndex *)settings->custom_context);
+	if(NULL == deflated){
+		return 83;	// lodepng's "memory allocation failed" error.
+	}
+
+	// lodepng frees the result with free(), so use malloc for it too.
+	*out = (u_char *)malloc(deflatedSize + 6);
+	if(NULL == *out){
+		free(deflated);
+		return 83;	// lodepng's "memory allocation failed" error.
+	}
+	(*out)[0] = 0x78;	// Deflate with a 32K window.
+	(*out)[1] = 0x9C;	// No preset dictionary, default compression level (and the header is a multiple of 31).
+	memcpy(*out + 2, deflated, deflatedSize);
+	(*out)[deflatedSize + 2] = (u_char)(adler >> 24);
+	(*out)[deflatedSize + 3] = (u_char)(adler >> 16);
+	(*out)[deflatedSize + 4] = (u_char)(adler >> 8);
+	(*out)[deflatedSize + 5] = (u_char)adler;
+	*outSize = deflatedSize + 6;
+	free(deflated);
+	return 0;
+}
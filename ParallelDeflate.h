@@ -0,0 +1,44 @@
+/*
+	https://github.com/cole8888/Gene2Pic
+
+	Multi-threaded deflate in the style of pigz. The data is cut into fixed size chunks which are compressed at the same time on
+	every thread, each one primed with the 32K of data before it so matches can still reach back across chunk boundaries. Every chunk
+	ends on a byte boundary (a sync flush) so the compressed chunks can simply be joined together, and their Adler-32s are combined
+	into the one for the whole stream.
+
+	Chunk boundaries only depend on the chunk size and where each call starts, so as long as data is passed in whole numbers of restart
+	intervals (like PngWriter's batches) the output is identical no matter how many threads are used.
+
+	Given a restart index, every few chunks are compressed without the data before them instead, and recorded in the index as places
+	inflating can start from (see RestartIndex.h).
+*/
+
+#ifndef PARALLELDEFLATE_H
+#define PARALLELDEFLATE_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <sys/types.h>
+#include <omp.h>
+#include "LODEPNG/lodepng.h"
+#include "DeflateStream.h"
+#include "RestartIndex.h"
+
+#define PARALLEL_DEFLATE_CHUNK_SIZE (256 * 1024)	// Uncompressed bytes given to each thread at a time. (Same as pigz's default.)
+#define PARALLEL_DEFLATE_RESTART_INTERVAL 4	// With a restart index, every 4th chunk (1MB) starts without a dictionary. Costs well under 1% in size.
+
+// Compress len bytes of data on all threads. The historyLen bytes right before data (which must be readable) are used as the dictionary
+// for the first chunk. If final is true the last block ends the deflate stream, otherwise more data can be appended after the output.
+// Adler is updated to include data. If index is not NULL, the chunks which start without a dictionary are added to it and its lengths are
+// moved on past the output. Returns a malloc'd buffer holding the compressed data, its size is written to outSize. Returns NULL (after
+// saying so) if memory cannot be allocated, then adler and the index are left as they were.
+u_char *parallelDeflate(const u_char *data, size_t len, size_t historyLen, bool final, const LodePNGCompressSettings *settings, size_t *outSize, u_int32_t *adler,
+	RestartIndex *index);
+
+// Drop in replacement for lodepng's zlib compressor (LodePNGCompressSettings.custom_zlib) which compresses with parallelDeflate(). If the
+// settings' custom_context points at a RestartIndex (set up with restartIndexInit()), the restart points of the image are added to it.
+unsigned parallelZlibCompress(u_char **out, size_t *outSize, const u_char *in, size_t inSize, const LodePNGCompressSettings *settings);
+
+#endif
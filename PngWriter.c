@@ -0,0 +1,317 @@
+/*
+	https://github.com/cole8888/Gene2Pic
+
+	Writes a PNG one scanline at a time so the whole image never has to be held in memory.
+*/
+
+#include "PngWriter.h"
+
+// Store a 32 bit value big endian, which is how PNG stores all its integers.
+static void writeUint32BE(u_char *buffer, u_int32_t value){
+	buffer[0] = (u_char)(value >> 24);
+	buffer[1] = (u_char)(value >> 16);
+	buffer[2] = (u_char)(value >> 8);
+	buffer[3] = (u_char)value;
+}
+
+// Write a chunk made up of the given type and the concatenation of the data pieces.
+static void writeChunk(PngWriter *writer, const char *type, const u_char **pieces, const size_t *pieceLens, int numPieces){
+	size_t len = 0;
+	for(int i = 0; i < numPieces; i++){
+		len += pieceLens[i];
+	}
+
+	// Lay the chunk out in one buffer so the CRC can be computed over the type and data in one go.
+	u_char *chunk = (u_char *)malloc(len + 12);
+	if(NULL == chunk){
+		fprintf(stderr, "Unable to allocate PNG chunk buffer... May have run out of RAM.\n");
+		writer->failed = true;
+		return;
+	}
+	writeUint32BE(chunk, (u_int32_t)len);
+	memcpy(chunk + 4, type, 4);
+	size_t offset = 8;
+	for(int i = 0; i < numPieces; i++){
+		memcpy(chunk + offset, pieces[i], pieceLens[i]);
+		offset += pieceLens[i];
+	}
+	writeUint32BE(chunk + offset, lodepng_crc32(chunk + 4, len + 4));
+
+	if(fwrite(chunk, 1, len + 12, writer->file) != len + 12){
+		writer->failed = true;
+	}
+	writer->bytesWritten += len + 12;
+	free(chunk);
+}
+
+// Write the first len bytes of the compressed data waiting as an IDAT chunk. The first one starts with the zlib header, and the last one ends
+// with the Adler-32 trailer.
+static void writeIdat(PngWriter *writer, size_t len, bool last){
+	u_char zlibHeader[2] = {0x78, 0x9C};	// Deflate with a 32K window, no preset dictionary.
+	u_char adler[4];
+	writeUint32BE(adler, writer->adler);
+
+	const u_char *pieces[3];
+	size_t pieceLens[3];
+	int numPieces = 0;
+	if(writer->idatChunks == 0){
+		pieces[numPieces] = zlibHeader;
+		pieceLens[numPieces++] = 2;
+	}
+	pieces[numPieces] = writer->compressed;
+	pieceLens[numPieces++] = len;
+	if(last){
+		pieces[numPieces] = adler;
+		pieceLens[numPieces++] = 4;
+	}
+	writeChunk(writer, "IDAT", pieces, pieceLens, numPieces);
+	memmove(writer->compressed, writer->compressed + len, writer->compressedSize - len);
+	writer->compressedSize -= len;
+	writer->idatChunks++;
+}
+
+// Compress the next batchSize bytes of scanlines waiting in the raw buffer (all of them if final) and keep the end of them as the dictionary
+// for the next batch. Batches are always a whole number of restart intervals, so the chunks and restart points land in the same places
+// however many threads there are and the image comes out the same on every machine.
+static void compressBatch(PngWriter *writer, bool final){
+	size_t batchLen = final ? writer->rawLen - writer->historyLen : writer->batchSize;
+	size_t compressedLen = 0;
+	u_char *compressed = parallelDeflate(writer->raw + writer->historyLen, batchLen, writer->historyLen, final,
+		&writer->settings, &compressedLen, &writer->adler, &writer->index);
+	if(NULL == compressed){
+		writer->failed = true;
+		return;
+	}
+
+	if(writer->compressedSize + compressedLen > writer->compressedCapacity){
+		size_t capacity = (writer->compressedSize + compressedLen) * 2;
+		u_char *grown = (u_char *)realloc(writer->compressed, capacity);
+		if(NULL == grown){
+			fprintf(stderr, "Unable to allocate compressed PNG data buffer... May have run out of RAM.\n");
+			free(compressed);
+			writer->failed = true;
+			return;
+		}
+		writer->compressed = grown;
+		writer->compressedCapacity = capacity;
+	}
+	memcpy(writer->compressed + writer->compressedSize, compressed, compressedLen);
+	writer->compressedSize += compressedLen;
+	free(compressed);
+
+	// The new dictionary and the start of the next batch (what is left of the last row) are next to each other, so they move together.
+	size_t batchEnd = writer->historyLen + batchLen;
+	size_t leftover = writer->rawLen - batchEnd;
+	writer->historyLen = batchEnd < DEFLATE_WINDOW_SIZE ? batchEnd : DEFLATE_WINDOW_SIZE;
+	memmove(writer->raw, writer->raw + batchEnd - writer->historyLen, writer->historyLen + leftover);
+	writer->rawLen = writer->historyLen + leftover;
+}
+
+// Read a --png preset name. Returns false if it is not one we know.
+bool parsePngPreset(const char *arg, PngPreset *preset){
+	static const PngPreset presets[] = {PNG_PRESET_FASTEST, PNG_PRESET_BALANCED, PNG_PRESET_SMALLEST};
+	for(int i = 0; i < (int)(sizeof(presets) / sizeof(presets[0])); i++){
+		if(strcasecmp(arg, pngPresetName(presets[i])) == 0){
+			*preset = presets[i];
+			return true;
+		}
+	}
+	return false;
+}
+
+// Name of a preset, as used on the commandline.
+const char *pngPresetName(PngPreset preset){
+	switch(preset){
+		case PNG_PRESET_FASTEST:
+			return "fastest";
+		case PNG_PRESET_SMALLEST:
+			return "smallest";
+		default:
+			return "balanced";
+	}
+}
+
+// Fill in lodepng encoder settings (the deflate settings and how scanlines are filtered) for a preset. Everything else is left at lodepng's defaults.
+// PngWriter only uses the zlibsettings, rows written with it are filtered with None, and pngRepeatRowFilter() for repeated rows.
+// UnscaledPalette says the images are palette images at one pixel per base.
+void pngPresetEncoderSettings(PngPreset preset, bool unscaledPalette, LodePNGEncoderSettings *encoder){
+	lodepng_encoder_settings_init(encoder);
+	encoder->filter_strategy = LFS_PREDEFINED;
+	if(preset == PNG_PRESET_FASTEST){
+		// A tiny window with short hash chains and no lazy matching. Bases are close to random so long searches find very little anyway,
+		// but it still catches the runs of blank pixels and the all zero rows of upscaled images. Dynamic Huffman codes are kept since
+		// the 4 or 5 palette indices need far fewer than 8 bits each, and picking the block type costs the same whichever is used.
+		encoder->zlibsettings.windowsize = 64;
+		encoder->zlibsettings.nicematch = 8;
+		encoder->zlibsettings.lazymatching = 0;
+	}
+	else if(preset == PNG_PRESET_SMALLEST && unscaledPalette){
+		// Without the repeated rows of upscaling there is almost nothing for a long search to find, the bases are written as plain
+		// Huffman coded bytes either way. Balanced's match settings give the same size without the search.
+	}
+	else if(preset == PNG_PRESET_SMALLEST){
+		// The whole window, searched all the way for the longest match. Short matches are not taken, a few bases far back cost more
+		// bits than writing them out. Palette images keep filter None (the filters work on bytes holding several pixels, so they only
+		// make them harder to compress), the RGB tiles of --downsample average try every filter on every scanline.
+		encoder->zlibsettings.windowsize = DEFLATE_WINDOW_SIZE;
+		encoder->zlibsettings.minmatch = PNG_SMALLEST_MIN_MATCH;
+		encoder->zlibsettings.nicematch = DEFLATE_MAX_MATCH;
+		encoder->zlibsettings.lazymatching = 1;
+		encoder->filter_strategy = LFS_BRUTE_FORCE;
+	}
+	if(encoder->filter_strategy == LFS_PREDEFINED){
+		// The filters are chosen by pngFilterPlan(), for palette images too.
+		encoder->filter_palette_zero = 0;
+	}
+}
+
+/*
+	Filter type for a scanline that is the same as the one above it (the copies made by upscaling). Returns PNG_FILTER_NONE if the row above is
+	inside the deflate window, then the row can be written again unfiltered and is copied with a single long match. Otherwise PNG_FILTER_UP,
+	which turns it into all zeros.
+	Up is not used for every copy because the filter type byte breaks the run: the zeros start a new match after every copy, where an
+	unfiltered copy carries on the match from the copy before it.
+*/
+u_char pngRepeatRowFilter(const LodePNGCompressSettings *settings, size_t rowBytes){
+	return rowBytes + 1 <= settings->windowsize ? PNG_FILTER_NONE : PNG_FILTER_UP;	// +1 for the filter type byte.
+}
+
+/*
+	If the encoder settings use a predefined filter plan (LFS_PREDEFINED), make one for an image of height rows of rowBytes each and point
+	the settings at it. Returns the plan for the caller to free once the image is encoded, or NULL if the settings do not use one.
+	Rows of bases are close to random, so no filter predicts them better than None does and trying all five on every row (lodepng's
+	LFS_MINSUM) is wasted work. The only rows a filter helps are the copies made by upscaling, Up turns those into all zeros. This is the
+	same choice pngWriterWriteRow() callers make.
+*/
+u_char *pngFilterPlan(LodePNGEncoderSettings *encoder, const u_char *pixels, size_t rowBytes, size_t height){
+	if(encoder->filter_strategy != LFS_PREDEFINED){
+		return NULL;
+	}
+	u_char *filters = (u_char *)malloc(height > 0 ? height : 1);
+	if(NULL == filters){
+		encoder->filter_strategy = LFS_ZERO;	// No room for a plan, filter every row with None. The image is the same, the repeated rows just compress less.
+		return NULL;
+	}
+	u_char repeatFilter = pngRepeatRowFilter(&encoder->zlibsettings, rowBytes);
+	for(size_t y = 0; y < height; y++){
+		filters[y] = y > 0 && memcmp(pixels + y * rowBytes, pixels + (y - 1) * rowBytes, rowBytes) == 0 ? repeatFilter : PNG_FILTER_NONE;
+	}
+	encoder->predefined_filters = filters;
+	return filters;
+}
+
+// Write the PNG signature and header chunks. Palette may be NULL unless colourType is LCT_PALETTE.
+// Returns false if the file could not be written to or memory could not be allocated.
+bool pngWriterOpen(PngWriter *writer, FILE *file, unsigned width, unsigned height, LodePNGColorType colourType, unsigned bitDepth,
+	const u_char *palette, int paletteSize, const LodePNGCompressSettings *settings){
+	memset(writer, 0, sizeof(PngWriter));
+	writer->file = file;
+	writer->settings = *settings;
+	writer->width = width;
+	writer->height = height;
+	writer->adler = 1;
+	restartIndexInit(&writer->index);
+
+	// Work out how many bytes a scanline takes. Bit depths below 8 pack several pixels into each byte.
+	unsigned channels = colourType == LCT_RGB ? 3 : colourType == LCT_RGBA ? 4 : colourType == LCT_GREY_ALPHA ? 2 : 1;
+	writer->rowBytes = ((size_t)width * channels * bitDepth + 7) / 8;
+
+	// Room for the dictionary, a full batch and one more scanline (a batch is only compressed after the row that fills it).
+	// Batches are rounded up to a whole number of restart intervals. (See compressBatch().)
+	size_t batchChunks = (size_t)PNG_BATCH_CHUNKS_PER_THREAD * omp_get_max_threads();
+	batchChunks = (batchChunks + PARALLEL_DEFLATE_RESTART_INTERVAL - 1) / PARALLEL_DEFLATE_RESTART_INTERVAL * PARALLEL_DEFLATE_RESTART_INTERVAL;
+	writer->batchSize = (size_t)PARALLEL_DEFLATE_CHUNK_SIZE * batchChunks;
+	writer->rawCapacity = DEFLATE_WINDOW_SIZE + writer->batchSize + writer->rowBytes + 1;
+	writer->raw = (u_char *)malloc(writer->rawCapacity);
+	if(NULL == writer->raw){
+		fprintf(stderr, "Unable to allocate PNG scanline buffer... May have run out of RAM.\n");
+		writer->failed = true;
+		return false;
+	}
+
+	static const u_char signature[8] = {137, 80, 78, 71, 13, 10, 26, 10};
+	if(fwrite(signature, 1, 8, file) != 8){
+		writer->failed = true;
+	}
+	writer->bytesWritten = 8;
+
+	u_char header[13];
+	writeUint32BE(header, width);
+	writeUint32BE(header + 4, height);
+	header[8] = (u_char)bitDepth;
+	header[9] = (u_char)colourType;
+	header[10] = 0;	// Compression method, deflate.
+	header[11] = 0;	// Filter method, adaptive.
+	header[12] = 0;	// No interlacing.
+	const u_char *headerPieces[1] = {header};
+	size_t headerLens[1] = {13};
+	writeChunk(writer, "IHDR", headerPieces, headerLens, 1);
+
+	if(colourType == LCT_PALETTE){
+		const u_char *palettePieces[1] = {palette};
+		size_t paletteLens[1] = {(size_t)paletteSize * 3};
+		writeChunk(writer, "PLTE", palettePieces, paletteLens, 1);
+	}
+	return !writer->failed;
+}
+
+// Write a tEXt chunk with text stored under keyword (1 to 79 Latin-1 characters). Must be called before the first scanline.
+void pngWriterWriteText(PngWriter *writer, const char *keyword, const char *text){
+	const u_char *pieces[2] = {(const u_char *)keyword, (const u_char *)text};
+	size_t pieceLens[2] = {strlen(keyword) + 1, strlen(text)};	// The keyword ends with its NUL, the text does not.
+	writeChunk(writer, "tEXt", pieces, pieceLens, 2);
+}
+
+// Add the next scanline to the image. Row must be rowBytes long and already filtered with filterType.
+void pngWriterWriteRow(PngWriter *writer, u_char filterType, const u_char *row){
+	if(writer->failed){
+		return;	// Nothing more can be written, pngWriterClose() will say so.
+	}
+	writer->raw[writer->rawLen++] = filterType;
+	memcpy(writer->raw + writer->rawLen, row, writer->rowBytes);
+	writer->rawLen += writer->rowBytes;
+	writer->rowsWritten++;
+
+	if(writer->rawLen - writer->historyLen >= writer->batchSize){
+		compressBatch(writer, false);
+		// Whole IDAT chunks only, so where they are split does not depend on the batches. (Some is always kept back for the last one.)
+		while(writer->compressedSize > PNG_IDAT_CHUNK_SIZE && !writer->failed){
+			writeIdat(writer, PNG_IDAT_CHUNK_SIZE, false);
+		}
+	}
+}
+
+// Compress whatever is left, write the remaining IDAT data, the restart index and the IEND chunk. Does not close the file.
+// Returns false if any write or allocation failed or the wrong number of rows was written.
+bool pngWriterClose(PngWriter *writer){
+	if(!writer->failed){
+		compressBatch(writer, true);
+	}
+	while(writer->compressedSize > PNG_IDAT_CHUNK_SIZE && !writer->failed){
+		writeIdat(writer, PNG_IDAT_CHUNK_SIZE, false);
+	}
+	if(!writer->failed){
+		writeIdat(writer, writer->compressedSize, true);
+	}
+
+	// The restart index goes after the image data, so readers which only want the whole image never have to look at it.
+	size_t indexSize;
+	const u_char *indexPieces[1] = {writer->failed ? NULL : restartIndexEncode(&writer->index, &indexSize)};
+	if(NULL != indexPieces[0]){
+		writeChunk(writer, RESTART_INDEX_CHUNK_TYPE, indexPieces, &indexSize, 1);
+		writeChunk(writer, "IEND", NULL, NULL, 0);
+	}
+	else{
+		writer->failed = true;
+	}
+	free((void *)indexPieces[0]);
+	restartIndexFree(&writer->index);
+	free(writer->raw);
+	free(writer->compressed);
+	writer->raw = NULL;
+	writer->compressed = NULL;
+	if(fflush(writer->file) != 0){
+		writer->failed = true;
+	}
+	return !writer->failed && writer->rowsWritten == writer->height;
+}
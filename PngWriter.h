@@ -0,0 +1,101 @@
+/*
+	https://github.com/cole8888/Gene2Pic
+
+	Writes a PNG one scanline at a time so the whole image never has to be held in memory.
+	Scanlines are collected into batches which are compressed on every thread with parallelDeflate(), and the compressed data
+	is written out in IDAT chunks whenever enough of it has built up.
+*/
+
+#ifndef PNGWRITER_H
+#define PNGWRITER_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <stdbool.h>
+#include <sys/types.h>
+#include "LODEPNG/lodepng.h"
+#include "DeflateStream.h"
+#include "ParallelDeflate.h"
+
+#define PNG_IDAT_CHUNK_SIZE (1024 * 1024)	// Size of every IDAT chunk but the last one.
+#define PNG_BATCH_CHUNKS_PER_THREAD 2	// Scanlines are compressed once there are this many parallel deflate chunks for every thread.
+#define PNG_SMALLEST_MIN_MATCH 8	// Shortest match --png smallest uses. Measured on real and random sequences, shorter ones make the image bigger.
+
+// How much work goes into making the PNGs small (--png).
+typedef enum{
+	PNG_PRESET_FASTEST,		// Tiny match window. For when throughput matters more than size.
+	PNG_PRESET_BALANCED,	// lodepng's deflate defaults.
+	PNG_PRESET_SMALLEST		// The whole 32K window searched for long matches on upscaled images, and every filter tried on RGB tiles. For archiving.
+} PngPreset;
+
+// PNG filter types.
+#define PNG_FILTER_NONE 0
+#define PNG_FILTER_SUB 1
+#define PNG_FILTER_UP 2
+#define PNG_FILTER_AVERAGE 3
+#define PNG_FILTER_PAETH 4
+
+typedef struct{
+	FILE *file;
+	LodePNGCompressSettings settings;
+	unsigned width;
+	unsigned height;
+	size_t rowBytes;	// Bytes in one scanline, not counting the filter type byte.
+	unsigned rowsWritten;
+	u_int64_t bytesWritten;	// Size of the PNG file so far.
+	unsigned idatChunks;	// Number of IDAT chunks written so far. The first one carries the zlib header.
+	bool failed;	// Set if a write to the file failed.
+
+	// Filtered scanlines waiting to be compressed. The first historyLen bytes are the end of the previous batch, kept as the dictionary.
+	u_char *raw;
+	size_t rawLen;
+	size_t rawCapacity;
+	size_t historyLen;
+	size_t batchSize;	// Compress this many bytes at a time once they are waiting. Always a whole number of restart intervals.
+
+	// Compressed data waiting to go into an IDAT chunk.
+	u_char *compressed;
+	size_t compressedSize;
+	size_t compressedCapacity;
+	u_int32_t adler;	// Adler-32 of all the scanlines so far, for the zlib trailer.
+	RestartIndex index;	// Where inflating can start, written out after the image data.
+} PngWriter;
+
+// Read a --png preset name. Returns false if it is not one we know.
+bool parsePngPreset(const char *arg, PngPreset *preset);
+
+// Name of a preset, as used on the commandline.
+const char *pngPresetName(PngPreset preset);
+
+// Fill in lodepng encoder settings (the deflate settings and how scanlines are filtered) for a preset. Everything else is left at lodepng's defaults.
+// PngWriter only uses the zlibsettings, rows written with it are filtered with None, and pngRepeatRowFilter() for repeated rows.
+// UnscaledPalette says the images are palette images at one pixel per base, where `smallest` uses balanced's settings.
+void pngPresetEncoderSettings(PngPreset preset, bool unscaledPalette, LodePNGEncoderSettings *encoder);
+
+// Filter type for a scanline that is the same as the one above it (the copies made by upscaling). Returns PNG_FILTER_NONE if the row above is
+// inside the deflate window, then the row can be written again unfiltered and is copied with a single long match. Otherwise PNG_FILTER_UP,
+// which turns it into all zeros.
+u_char pngRepeatRowFilter(const LodePNGCompressSettings *settings, size_t rowBytes);
+
+// If the encoder settings use a predefined filter plan (LFS_PREDEFINED), make one for an image of height rows of rowBytes each and point
+// the settings at it. Returns the plan for the caller to free once the image is encoded, or NULL if the settings do not use one.
+u_char *pngFilterPlan(LodePNGEncoderSettings *encoder, const u_char *pixels, size_t rowBytes, size_t height);
+
+// Write the PNG signature and header chunks. Palette may be NULL unless colourType is LCT_PALETTE.
+// Returns false if the file could not be written to or memory could not be allocated.
+bool pngWriterOpen(PngWriter *writer, FILE *file, unsigned width, unsigned height, LodePNGColorType colourType, unsigned bitDepth,
+	const u_char *palette, int paletteSize, const LodePNGCompressSettings *settings);
+
+// Write a tEXt chunk with text stored under keyword (1 to 79 Latin-1 characters). Must be called before the first scanline.
+void pngWriterWriteText(PngWriter *writer, const char *keyword, const char *text);
+
+// Add the next scanline to the image. Row must be rowBytes long and already filtered with filterType.
+void pngWriterWriteRow(PngWriter *writer, u_char filterType, const u_char *row);
+
+// Compress whatever is left, write the remaining IDAT data, the restart index and the IEND chunk. Does not close the file.
+// Returns false if any write or allocation failed or the wrong number of rows was written.
+bool pngWriterClose(PngWriter *writer);
+
+#endif
@@ -0,0 +1,167 @@
+/*
+	https://github.com/cole8888/Gene2Pic
+
+	Content addressed cache of finished images.
+*/
+
+#include "RenderCache.h"
+
+// SHA-256 round constants.
+static const u_int32_t SHA256_K[64] = {
+	0x428A2F98, 0x71374491, 0xB5C0FBCF, 0xE9B5DBA5, 0x3956C25B, 0x59F111F1, 0x923F82A4, 0xAB1C5ED5,
+	0xD807AA98, 0x12835B01, 0x243185BE, 0x550C7DC3, 0x72BE5D74, 0x80DEB1FE, 0x9BDC06A7, 0xC19BF174,
+	0xE49B69C1, 0xEFBE4786, 0x0FC19DC6, 0x240CA1CC, 0x2DE92C6F, 0x4A7484AA, 0x5CB0A9DC, 0x76F988DA,
+	0x983E5152, 0xA831C66D, 0xB00327C8, 0xBF597FC7, 0xC6E00BF3, 0xD5A79147, 0x06CA6351, 0x14292967,
+	0x27B70A85, 0x2E1B2138, 0x4D2C6DFC, 0x53380D13, 0x650A7354, 0x766A0ABB, 0x81C2C92E, 0x92722C85,
+	0xA2BFE8A1, 0xA81A664B, 0xC24B8B70, 0xC76C51A3, 0xD192E819, 0xD6990624, 0xF40E3585, 0x106AA070,
+	0x19A4C116, 0x1E376C08, 0x2748774C, 0x34B0BCB5, 0x391C0CB3, 0x4ED8AA4A, 0x5B9CCA4F, 0x682E6FF3,
+	0x748F82EE, 0x78A5636F, 0x84C87814, 0x8CC70208, 0x90BEFFFA, 0xA4506CEB, 0xBEF9A3F7, 0xC67178F2
+};
+
+static u_int32_t rotateRight(u_int32_t value, int bits){
+	return (value >> bits) | (value << (32 - bits));
+}
+
+// Run the SHA-256 compression function over one 64 byte block.
+static void sha256Block(u_int32_t state[8], const u_char *block){
+	u_int32_t w[64];
+	for(int i = 0; i < 16; i++){
+		w[i] = ((u_int32_t)block[i * 4] << 24) | ((u_int32_t)block[i * 4 + 1] << 16) | ((u_int32_t)block[i * 4 + 2] << 8) | block[i * 4 + 3];
+	}
+	for(int i = 16; i < 64; i++){
+		u_int32_t s0 = rotateRight(w[i - 15], 7) ^ rotateRight(w[i - 15], 18) ^ (w[i - 15] >> 3);
+		u_int32_t s1 = rotateRight(w[i - 2], 17) ^ rotateRight(w[i - 2], 19) ^ (w[i - 2] >> 10);
+		w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+	}
+	u_int32_t a = state[0], b = state[1], c = state[2], d = state[3], e = state[4], f = state[5], g = state[6], h = state[7];
+	for(int i = 0; i < 64; i++){
+		u_int32_t t1 = h + (rotateRight(e, 6) ^ rotateRight(e, 11) ^ rotateRight(e, 25)) + ((e & f) ^ (~e & g)) + SHA256_K[i] + w[i];
+		u_int32_t t2 = (rotateRight(a, 2) ^ rotateRight(a, 13) ^ rotateRight(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+		h = g;
+		g = f;
+		f = e;
+		e = d + t1;
+		d = c;
+		c = b;
+		b = a;
+		a = t1 + t2;
+	}
+	state[0] += a;
+	state[1] += b;
+	state[2] += c;
+	state[3] += d;
+	state[4] += e;
+	state[5] += f;
+	state[6] += g;
+	state[7] += h;
+}
+
+// SHA-256 of two pieces of data joined together (either can be empty).
+static CacheKey sha256(const u_char *first, size_t firstLen, const u_char *second, size_t secondLen){
+	u_int32_t state[8] = {0x6A09E667, 0xBB67AE85, 0x3C6EF372, 0xA54FF53A, 0x510E527F, 0x9B05688C, 0x1F83D9AB, 0x5BE0CD19};
+	u_char block[64];
+	size_t blockLen = 0;
+	const u_char *pieces[2] = {first, second};
+	size_t pieceLens[2] = {firstLen, secondLen};
+	for(int piece = 0; piece < 2; piece++){
+		const u_char *data = pieces[piece];
+		size_t len = pieceLens[piece];
+		while(len > 0){
+			// Whole blocks straight from the data when nothing is waiting, otherwise fill up the waiting block first.
+			if(blockLen == 0 && len >= 64){
+				sha256Block(state, data);
+				data += 64;
+				len -= 64;
+				continue;
+			}
+			size_t take = 64 - blockLen < len ? 64 - blockLen : len;
+			memcpy(block + blockLen, data, take);
+			blockLen += take;
+			data += take;
+			len -= take;
+			if(blockLen == 64){
+				sha256Block(state, block);
+				blockLen = 0;
+			}
+		}
+	}
+
+	// Padding: a 1 bit, zeros, then the length in bits as a 64 bit big endian number at the end of the last block.
+	u_int64_t bits = ((u_int64_t)firstLen + secondLen) * 8;
+	block[blockLen++] = 0x80;
+	if(blockLen > 56){
+		memset(block + blockLen, 0, 64 - blockLen);
+		sha256Block(state, block);
+		blockLen = 0;
+	}
+	memset(block + blockLen, 0, 56 - blockLen);
+	for(int i = 0; i < 8; i++){
+		block[56 + i] = (u_char)(bits >> (56 - 8 * i));
+	}
+	sha256Block(state, block);
+
+	CacheKey key;
+	for(int i = 0; i < 8; i++){
+		key.bytes[i * 4] = (u_char)(state[i] >> 24);
+		key.bytes[i * 4 + 1] = (u_char)(state[i] >> 16);
+		key.bytes[i * 4 + 2] = (u_char)(state[i] >> 8);
+		key.bytes[i * 4 + 3] = (u_char)state[i];
+	}
+	return key;
+}
+
+// Hash len bytes of data into key using every thread. The result only depends on the data, not on how many threads there are.
+// Returns false (after saying so) if memory cannot be allocated.
+bool hashContent(const u_char *data, long long int len, CacheKey *key){
+	long long int numChunks = (len + RENDER_CACHE_CHUNK_SIZE - 1) / RENDER_CACHE_CHUNK_SIZE;
+	CacheKey *chunkKeys = (CacheKey *)malloc((numChunks > 0 ? numChunks : 1) * sizeof(CacheKey));
+	if(NULL == chunkKeys){
+		fprintf(stderr, "Unable to allocate cache hash array... May have run out of RAM.\n");
+		return false;
+	}
+
+	#pragma omp parallel for schedule(static)
+	for(long long int i = 0; i < numChunks; i++){
+		long long int start = i * RENDER_CACHE_CHUNK_SIZE;
+		long long int chunkLen = len - start < RENDER_CACHE_CHUNK_SIZE ? len - start : RENDER_CACHE_CHUNK_SIZE;
+		chunkKeys[i] = sha256(data + start, chunkLen, NULL, 0);
+	}
+
+	// The key is the SHA-256 of the total length followed by the chunk hashes in order.
+	u_char lenBytes[8];
+	for(int i = 0; i < 8; i++){
+		lenBytes[i] = (u_char)((u_int64_t)len >> (56 - 8 * i));
+	}
+	*key = sha256(lenBytes, sizeof(lenBytes), (const u_char *)chunkKeys, numChunks * sizeof(CacheKey));
+	free(chunkKeys);
+	return true;
+}
+
+// Mix more data (such as the render options) into a key. The new key is the SHA-256 of the old one followed by the data.
+CacheKey cacheKeyAdd(CacheKey key, const void *data, size_t len){
+	return sha256(key.bytes, sizeof(key.bytes), (const u_char *)data, len);
+}
+
+// Make sure the cache directory exists, creating it if needed. Returns false (after saying why) if it cannot be used.
+bool renderCacheOpen(const char *dir){
+	if(mkdir(dir, 0777) != 0 && errno != EEXIST){
+		fprintf(stderr, "Unable to create the cache directory %s: %s\n", dir, strerror(errno));
+		return false;
+	}
+	struct stat info;
+	if(stat(dir, &info) != 0 || !S_ISDIR(info.st_mode)){
+		fprintf(stderr, "Cache %s is not a directory.\n", dir);
+		return false;
+	}
+	return true;
+}
+
+// Path of the image for key in the cache directory. Returns false if the path does not fit in size.
+bool renderCachePath(const char *dir, CacheKey key, char *path, size_t size){
+	char hex[sizeof(key.bytes) * 2 + 1];
+	for(size_t i = 0; i < sizeof(key.bytes); i++){
+		snprintf(hex + i * 2, 3, "%02x", key.bytes[i]);
+	}
+	int len = snprintf(path, size, "%s/%s%s", dir, hex, RENDER_CACHE_EXTENSION);
+	return len >= 0 && (size_t)len < size;
+}
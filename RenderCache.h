@@ -0,0 +1,44 @@
+/*
+	https://github.com/cole8888/Gene2Pic
+
+	Content addressed cache of finished images. Each image is stored under a SHA-256 hash of the input file's contents and the
+	options it was rendered with, so asking for the same image again only has to hash the input instead of rendering it. The input is
+	hashed in fixed size pieces on every thread, and the key is the SHA-256 of their hashes, so a different input practically never
+	gets another input's image.
+*/
+
+#ifndef RENDERCACHE_H
+#define RENDERCACHE_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <omp.h>
+
+#define RENDER_CACHE_CHUNK_SIZE (1024LL * 1024LL)	// Size of the pieces the input is split into when hashing it on every thread.
+#define RENDER_CACHE_VERSION 5	// Part of every key. Bump it whenever the same options would start giving a different image.
+#define RENDER_CACHE_EXTENSION ".png"
+
+// Hash of an input and the options it is rendered with.
+typedef struct{
+	u_char bytes[32];
+} CacheKey;
+
+// Hash len bytes of data into key using every thread. The result only depends on the data, not on how many threads there are.
+// Returns false (after saying so) if memory cannot be allocated.
+bool hashContent(const u_char *data, long long int len, CacheKey *key);
+
+// Mix more data (such as the render options) into a key.
+CacheKey cacheKeyAdd(CacheKey key, const void *data, size_t len);
+
+// Make sure the cache directory exists, creating it if needed. Returns false (after saying why) if it cannot be used.
+bool renderCacheOpen(const char *dir);
+
+// Path of the image for key in the cache directory. Returns false if the path does not fit in size.
+bool renderCachePath(const char *dir, CacheKey key, char *path, size_t size);
+
+#endif
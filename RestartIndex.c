@@ -0,0 +1,313 @@
+/*
+	https://github.com/cole8888/Gene2Pic
+
+	Index of places a PNG's image data can be inflated from, and reading scanlines from the middle of an image with it.
+*/
+
+#include "RestartIndex.h"
+#include "PngWriter.h"
+
+// Store a 64 bit value big endian, like the rest of the integers in a PNG.
+static void writeUint64BE(u_char *buffer, u_int64_t value){
+	for(int i = 0; i < 8; i++){
+		buffer[i] = (u_char)(value >> (56 - 8 * i));
+	}
+}
+
+// Read a 64 bit big endian value.
+static u_int64_t readUint64BE(const u_char *buffer){
+	u_int64_t value = 0;
+	for(int i = 0; i < 8; i++){
+		value = (value << 8) | buffer[i];
+	}
+	return value;
+}
+
+// Start an empty index for a new zlib stream. The first data compressed goes right after the zlib header.
+void restartIndexInit(RestartIndex *index){
+	memset(index, 0, sizeof(RestartIndex));
+	index->compressedLen = ZLIB_HEADER_SIZE;
+}
+
+// Free the points.
+void restartIndexFree(RestartIndex *index){
+	free(index->points);
+	index->points = NULL;
+	index->numPoints = 0;
+	index->capacity = 0;
+}
+
+// Record that inflating can start at these offsets. Returns false (after saying so) if memory cannot be allocated, the index is left as it was.
+bool restartIndexAdd(RestartIndex *index, u_int64_t rawOffset, u_int64_t compressedOffset){
+	if(index->numPoints == index->capacity){
+		size_t capacity = index->capacity == 0 ? 64 : index->capacity * 2;
+		RestartPoint *points = (RestartPoint *)realloc(index->points, capacity * sizeof(RestartPoint));
+		if(NULL == points){
+			fprintf(stderr, "Unable to allocate restart index... May have run out of RAM.\n");
+			return false;
+		}
+		index->points = points;
+		index->capacity = capacity;
+	}
+	index->points[index->numPoints].rawOffset = rawOffset;
+	index->points[index->numPoints].compressedOffset = compressedOffset;
+	index->numPoints++;
+	return true;
+}
+
+// Lay the points out the way they are stored in the chunk. Returns a malloc'd buffer and sets size, or NULL (after saying so) if memory
+// cannot be allocated.
+u_char *restartIndexEncode(const RestartIndex *index, size_t *size){
+	*size = index->numPoints * RESTART_POINT_SIZE;
+	u_char *data = (u_char *)malloc(*size > 0 ? *size : 1);
+	if(NULL == data){
+		fprintf(stderr, "Unable to allocate restart index chunk... May have run out of RAM.\n");
+		return NULL;
+	}
+	for(size_t i = 0; i < index->numPoints; i++){
+		writeUint64BE(data + i * RESTART_POINT_SIZE, index->points[i].rawOffset);
+		writeUint64BE(data + i * RESTART_POINT_SIZE + 8, index->points[i].compressedOffset);
+	}
+	return data;
+}
+
+// Read the points of a chunk back into an empty index. Returns false if they are not in order or do not fit in a zlib stream of streamLen bytes.
+bool restartIndexDecode(const u_char *data, size_t size, u_int64_t streamLen, RestartIndex *index){
+	if(size % RESTART_POINT_SIZE != 0){
+		return false;
+	}
+	for(size_t i = 0; i < size / RESTART_POINT_SIZE; i++){
+		u_int64_t rawOffset = readUint64BE(data + i * RESTART_POINT_SIZE);
+		u_int64_t compressedOffset = readUint64BE(data + i * RESTART_POINT_SIZE + 8);
+		if(compressedOffset < ZLIB_HEADER_SIZE || compressedOffset >= streamLen || (index->numPoints > 0
+			&& (rawOffset <= index->points[index->numPoints - 1].rawOffset || compressedOffset <= index->points[index->numPoints - 1].compressedOffset))){
+			return false;
+		}
+		if(!restartIndexAdd(index, rawOffset, compressedOffset)){
+			return false;
+		}
+	}
+	return true;
+}
+
+// Paeth predictor from the PNG spec: whichever of left, above and upper left is closest to left + above - upper left.
+static u_char paethPredictor(int left, int above, int upperLeft){
+	int p = left + above - upperLeft;
+	int pLeft = abs(p - left);
+	int pAbove = abs(p - above);
+	int pUpperLeft = abs(p - upperLeft);
+	return pLeft <= pAbove && pLeft <= pUpperLeft ? left : pAbove <= pUpperLeft ? above : upperLeft;
+}
+
+// Undo the filter of one scanline in place. Above is the unfiltered row above, or NULL for zeros. (The first row of the image has zeros
+// above it, and rows filtered with None or Sub do not need the row above.)
+// Returns false if the filter type is not valid.
+static bool unfilterRow(u_char *row, const u_char *above, size_t rowBytes, size_t pixelBytes, u_char filterType){
+	if(filterType == PNG_FILTER_NONE){
+		return true;
+	}
+	for(size_t i = 0; i < rowBytes; i++){
+		int left = i >= pixelBytes ? row[i - pixelBytes] : 0;
+		int up = NULL != above ? above[i] : 0;
+		int upperLeft = NULL != above && i >= pixelBytes ? above[i - pixelBytes] : 0;
+		switch(filterType){
+			case PNG_FILTER_SUB:
+				row[i] += left;
+				break;
+			case PNG_FILTER_UP:
+				row[i] += up;
+				break;
+			case PNG_FILTER_AVERAGE:
+				row[i] += (left + up) / 2;
+				break;
+			case PNG_FILTER_PAETH:
+				row[i] += paethPredictor(left, up, upperLeft);
+				break;
+			default:
+				return false;
+		}
+	}
+	return true;
+}
+
+// Find the IDAT chunks and the restart index of a PNG. The IDAT data is given as the offset of each chunk's data in the file, in order.
+// Returns the number of IDAT chunks (0 if the chunks are broken or there is not enough memory for the list) and sets idatData to a malloc'd array.
+static size_t findImageData(const u_char *png, size_t pngSize, size_t **idatData, const u_char **indexData, size_t *indexSize){
+	size_t numIdat = 0, capacity = 0;
+	*idatData = NULL;
+	*indexData = NULL;
+	*indexSize = 0;
+	size_t pos = 8;	// After the signature.
+	while(pos + 12 <= pngSize){
+		const u_char *chunk = png + pos;
+		size_t len = lodepng_chunk_length(chunk);
+		if(len > pngSize - pos - 12){
+			break;	// Runs off the end of the file.
+		}
+		if(lodepng_chunk_type_equals(chunk, "IDAT")){
+			if(numIdat == capacity){
+				capacity = capacity == 0 ? 64 : capacity * 2;
+				size_t *grown = (size_t *)realloc(*idatData, capacity * sizeof(size_t));
+				if(NULL == grown){
+					fprintf(stderr, "Unable to allocate IDAT chunk list... May have run out of RAM.\n");
+					free(*idatData);
+					*idatData = NULL;
+					return 0;
+				}
+				*idatData = grown;
+			}
+			(*idatData)[numIdat++] = pos + 8;
+		}
+		else if(lodepng_chunk_type_equals(chunk, RESTART_INDEX_CHUNK_TYPE) && !lodepng_chunk_check_crc(chunk)){
+			*indexData = chunk + 8;
+			*indexSize = len;
+		}
+		else if(lodepng_chunk_type_equals(chunk, "IEND")){
+			return numIdat;
+		}
+		pos += len + 12;
+	}
+	return 0;	// No IEND, the file was cut short.
+}
+
+// Read scanlines firstRow to lastRow of a PNG held in memory (which lodepng_inspect() has already checked the header of), with rows
+// of width pixels at bitsPerPixel. Inflating starts from the last restart point before the rows and stops at the first one after them.
+// Images without an index are inflated from the start. Only the CRCs of the IDAT chunks read are checked, not the Adler-32 of the whole
+// stream. Returns a malloc'd buffer of the unfiltered rows, each starting on a byte, or NULL (after saying why) if the image data is
+// broken or the image is interlaced.
+u_char *pngReadRows(const u_char *png, size_t pngSize, unsigned width, unsigned bitsPerPixel, unsigned firstRow, unsigned lastRow){
+	size_t rowBytes = ((size_t)width * bitsPerPixel + 7) / 8;
+	size_t pixelBytes = bitsPerPixel < 8 ? 1 : bitsPerPixel / 8;	// How far back the left neighbour is for the Sub, Average and Paeth filters.
+	u_int64_t stride = rowBytes + 1;	// Each row starts with its filter type.
+	u_int64_t needStart = firstRow * stride;
+	u_int64_t needEnd = (lastRow + (u_int64_t)1) * stride;
+
+	// Interlaced rows are spread over seven passes, so they are not where the restart points say they are.
+	if(png[IHDR_INTERLACE_OFFSET] != 0){
+		fprintf(stderr, "\nThe image is interlaced, so its rows cannot be read on their own.\n");
+		return NULL;
+	}
+
+	size_t *idatData;
+	const u_char *indexData;
+	size_t indexSize;
+	size_t numIdat = findImageData(png, pngSize, &idatData, &indexData, &indexSize);
+	u_int64_t streamLen = 0;
+	for(size_t i = 0; i < numIdat; i++){
+		streamLen += lodepng_chunk_length(png + idatData[i] - 8);
+	}
+	RestartIndex index;
+	restartIndexInit(&index);
+	if(streamLen <= ZLIB_HEADER_SIZE + ZLIB_TRAILER_SIZE || (NULL != indexData && !restartIndexDecode(indexData, indexSize, streamLen, &index))){
+		fprintf(stderr, "\nThe image data is broken, the file may have been cut short or edited.\n");
+		free(idatData);
+		restartIndexFree(&index);
+		return NULL;
+	}
+	if(index.numPoints == 0 || index.points[0].rawOffset != 0){
+		restartIndexFree(&index);
+		if(!restartIndexAdd(&index, 0, ZLIB_HEADER_SIZE)){	// No usable index, the start of the stream is always a place to start.
+			free(idatData);
+			return NULL;
+		}
+	}
+
+	// Start at the last point at or before the first row, the rows before it are only needed if the first row is filtered against the row above.
+	size_t start = 0;
+	while(start + 1 < index.numPoints && index.points[start + 1].rawOffset <= needStart){
+		start++;
+	}
+	u_char *rows = NULL;
+	for(;;){
+		// Stop at the first point after the last row. Deflate data which does not end the stream ends on a byte boundary (a sync flush), so
+		// it can be finished off with an empty final block. (Fixed Huffman block with just the end of block code, 03 00.)
+		size_t end = start + 1;
+		while(end < index.numPoints && index.points[end].rawOffset < needEnd){
+			end++;
+		}
+		u_int64_t from = index.points[start].compressedOffset;
+		u_int64_t to = end < index.numPoints ? index.points[end].compressedOffset : streamLen - ZLIB_TRAILER_SIZE;
+		u_char *compressed = (u_char *)malloc(to - from + 2);
+		if(NULL == compressed){
+			fprintf(stderr, "Unable to allocate compressed data buffer... May have run out of RAM.\n");
+			break;
+		}
+		// Only the chunks the data is copied from have their CRC checked. The Adler-32 at the end of the stream covers all of the image
+		// data, so it cannot be checked without inflating everything.
+		u_int64_t chunkStart = 0;	// Offset of the chunk's data in the zlib stream.
+		bool damaged = false;
+		for(size_t i = 0; i < numIdat && chunkStart < to; i++){
+			u_int64_t chunkLen = lodepng_chunk_length(png + idatData[i] - 8);
+			u_int64_t copyFrom = from > chunkStart ? from : chunkStart;
+			u_int64_t copyTo = to < chunkStart + chunkLen ? to : chunkStart + chunkLen;
+			if(copyFrom < copyTo){
+				if(lodepng_chunk_check_crc(png + idatData[i] - 8)){
+					fprintf(stderr, "\nThe image data is broken, IDAT chunk %zu does not match its checksum.\n", i + 1);
+					damaged = true;
+					break;
+				}
+				memcpy(compressed + (copyFrom - from), png + idatData[i] + (copyFrom - chunkStart), copyTo - copyFrom);
+			}
+			chunkStart += chunkLen;
+		}
+		if(damaged){
+			free(compressed);
+			break;
+		}
+		compressed[to - from] = 0x03;
+		compressed[to - from + 1] = 0x00;
+
+		LodePNGDecompressSettings settings;
+		lodepng_decompress_settings_init(&settings);
+		u_char *raw = NULL;
+		size_t rawSize = 0;
+		unsigned error = lodepng_inflate(&raw, &rawSize, compressed, to - from + 2, &settings);
+		free(compressed);
+		u_int64_t rawOffset = index.points[start].rawOffset;
+		if(error || rawOffset + rawSize < needEnd){
+			fprintf(stderr, "\nUnable to read the image data, lodepng returned an error.\nError %u: %s\n", error, error ? lodepng_error_text(error) : "image data is too short");
+			free(raw);
+			break;
+		}
+
+		// Unfilter every whole row inflated up to the last one wanted. A row filtered against the row above can only be unfiltered if the row
+		// above was, if one of the wanted rows cannot be the inflating has to start from an earlier point.
+		bool aboveKnown = rawOffset == 0;
+		bool usable = true;
+		for(u_int64_t row = (rawOffset + stride - 1) / stride; row <= lastRow && usable; row++){
+			u_char *line = raw + (row * stride - rawOffset);
+			bool needsAbove = line[0] != PNG_FILTER_NONE && line[0] != PNG_FILTER_SUB;
+			if(needsAbove && !aboveKnown && row >= firstRow){
+				usable = false;
+			}
+			else if(!needsAbove || aboveKnown){
+				if(!unfilterRow(line + 1, row == 0 || !aboveKnown ? NULL : line + 1 - stride, rowBytes, pixelBytes, line[0])){
+					fprintf(stderr, "\nThe image data is broken, a row has an unknown filter type %d.\n", line[0]);
+					break;
+				}
+				aboveKnown = true;
+			}
+			else{
+				aboveKnown = false;
+			}
+			if(row == lastRow){
+				rows = (u_char *)malloc((lastRow - firstRow + (size_t)1) * rowBytes);
+				if(NULL == rows){
+					fprintf(stderr, "Unable to allocate row buffer... May have run out of RAM.\n");
+					break;
+				}
+				for(u_int64_t r = firstRow; r <= lastRow; r++){
+					memcpy(rows + (r - firstRow) * rowBytes, raw + (r * stride - rawOffset) + 1, rowBytes);
+				}
+			}
+		}
+		free(raw);
+		if(usable || start == 0){
+			break;	// Either done or broken. (Inflating from the very start can always unfilter every row.)
+		}
+		start--;
+	}
+	free(idatData);
+	restartIndexFree(&index);
+	return rows;
+}
@@ -0,0 +1,64 @@
+/*
+	https://github.com/cole8888/Gene2Pic
+
+	Places in a PNG's compressed image data where inflating can start without anything before it, so part of an image can be read
+	without inflating all of it. parallelDeflate() compresses every few chunks without a dictionary when it is given an index, and
+	records where those chunks start in the scanlines and in the zlib stream. The index is saved in a private "gpIX" chunk after the
+	image data, and pngReadRows() uses it to inflate only the chunks holding the scanlines it was asked for.
+*/
+
+#ifndef RESTARTINDEX_H
+#define RESTARTINDEX_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <sys/types.h>
+#include "LODEPNG/lodepng.h"
+
+#define RESTART_INDEX_CHUNK_TYPE "gpIX"	// Ancillary, private and unsafe to copy, since it is wrong as soon as the image data changes.
+#define RESTART_POINT_SIZE 16	// Bytes each point takes in the chunk, both offsets as 64 bit big endian integers.
+#define ZLIB_HEADER_SIZE 2
+#define ZLIB_TRAILER_SIZE 4	// Adler-32 of the uncompressed data.
+#define IHDR_INTERLACE_OFFSET 28	// Interlace method in the IHDR chunk, which is always the first chunk after the signature.
+
+typedef struct{
+	u_int64_t rawOffset;	// Where the point is in the uncompressed data (the filtered scanlines).
+	u_int64_t compressedOffset;	// Where the point is in the zlib stream (all the IDAT data joined together, starting with the zlib header).
+} RestartPoint;
+
+typedef struct{
+	RestartPoint *points;	// In order.
+	size_t numPoints;
+	size_t capacity;
+
+	// Amount of data compressed so far, which is where the next point would go.
+	u_int64_t rawLen;
+	u_int64_t compressedLen;
+} RestartIndex;
+
+// Start an empty index for a new zlib stream. The first data compressed goes right after the zlib header.
+void restartIndexInit(RestartIndex *index);
+
+// Free the points.
+void restartIndexFree(RestartIndex *index);
+
+// Record that inflating can start at these offsets. Returns false (after saying so) if memory cannot be allocated, the index is left as it was.
+bool restartIndexAdd(RestartIndex *index, u_int64_t rawOffset, u_int64_t compressedOffset);
+
+// Lay the points out the way they are stored in the chunk. Returns a malloc'd buffer and sets size, or NULL (after saying so) if memory
+// cannot be allocated.
+u_char *restartIndexEncode(const RestartIndex *index, size_t *size);
+
+// Read the points of a chunk back into an empty index. Returns false if they are not in order or do not fit in a zlib stream of streamLen bytes.
+bool restartIndexDecode(const u_char *data, size_t size, u_int64_t streamLen, RestartIndex *index);
+
+// Read scanlines firstRow to lastRow of a PNG held in memory (which lodepng_inspect() has already checked the header of), with rows
+// of width pixels at bitsPerPixel. Inflating starts from the last restart point before the rows and stops at the first one after them.
+// Images without an index are inflated from the start. Only the CRCs of the IDAT chunks read are checked, not the Adler-32 of the whole
+// stream. Returns a malloc'd buffer of the unfiltered rows, each starting on a byte, or NULL (after saying why) if the image data is
+// broken or the image is interlaced.
+u_char *pngReadRows(const u_char *png, size_t pngSize, unsigned width, unsigned bitsPerPixel, unsigned firstRow, unsigned lastRow);
+
+#endif
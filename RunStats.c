@@ -0,0 +1,184 @@
+/*
+	https://github.com/cole8888/Gene2Pic
+
+	Collects the wall time, CPU time and amount of data handled by each stage of a run and writes it out as JSON.
+*/
+
+#include "RunStats.h"
+
+// Clock used for the CPU time of stages started on this thread.
+static _Thread_local clockid_t cpuClock = CLOCK_PROCESS_CPUTIME_ID;
+
+// Seconds between two timestamps.
+static double secondsBetween(struct timespec start, struct timespec finish){
+	return (finish.tv_sec - start.tv_sec) + (finish.tv_nsec - start.tv_nsec) / 1000000000.0;
+}
+
+// Bases per second, or 0 if the time was too short to measure.
+static double throughput(u_int64_t bases, double secs){
+	return secs > 0 ? bases / secs : 0;
+}
+
+// Write a string as a JSON string literal, escaping anything JSON does not allow as is.
+static void writeJsonString(FILE *file, const char *str){
+	fputc('"', file);
+	for(const u_char *c = (const u_char *)(NULL == str ? "" : str); *c != '\0'; c++){
+		if(*c == '"' || *c == '\\'){
+			fprintf(file, "\\%c", *c);
+		}
+		else if(*c < 0x20){
+			fprintf(file, "\\u%04x", *c);
+		}
+		else{
+			fputc(*c, file);
+		}
+	}
+	fputc('"', file);
+}
+
+// Clear the stats and start timing the whole run.
+void runStatsInit(RunStats *stats){
+	memset(stats, 0, sizeof(RunStats));
+	stageTimerStart(&stats->total);
+}
+
+// Measure CPU time used by the calling thread only instead of the whole process, for runs which share the process with other runs
+// happening at the same time. Only affects the calling thread.
+void runStatsUseThreadCpuTime(bool threadOnly){
+	cpuClock = threadOnly ? CLOCK_THREAD_CPUTIME_ID : CLOCK_PROCESS_CPUTIME_ID;
+}
+
+// Start timing a stage.
+void stageTimerStart(StageTimer *timer){
+	clock_gettime(CLOCK_MONOTONIC, &timer->wallStart);
+	clock_gettime(cpuClock, &timer->cpuStart);
+}
+
+// Wall clock seconds since the timer was started.
+double stageTimerElapsed(const StageTimer *timer){
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return secondsBetween(timer->wallStart, now);
+}
+
+// Record a stage which started at timer and has just finished. Returns the wall clock seconds it took, for the progress message.
+// A stage that runs more than once (once per record for example) is added to the totals of the earlier runs.
+double runStatsAddStage(RunStats *stats, const char *name, const StageTimer *timer, u_int64_t bytesIn, u_int64_t bytesOut, u_int64_t bases){
+	struct timespec wallFinish, cpuFinish;
+	clock_gettime(CLOCK_MONOTONIC, &wallFinish);
+	clock_gettime(cpuClock, &cpuFinish);
+	double wallSecs = secondsBetween(timer->wallStart, wallFinish);
+
+	StageStats *stage = NULL;
+	for(int i = 0; i < stats->numStages && NULL == stage; i++){
+		stage = strcmp(stats->stages[i].name, name) == 0 ? &stats->stages[i] : NULL;
+	}
+	if(NULL == stage && stats->numStages < RUN_STATS_MAX_STAGES){
+		stage = &stats->stages[stats->numStages++];
+		memset(stage, 0, sizeof(StageStats));
+		stage->name = name;
+	}
+	if(NULL != stage){
+		stage->wallSecs += wallSecs;
+		stage->cpuSecs += secondsBetween(timer->cpuStart, cpuFinish);
+		stage->bytesIn += bytesIn;
+		stage->bytesOut += bytesOut;
+		stage->bases += bases;
+	}
+	return wallSecs;
+}
+
+// Remember which file the image was written to.
+void runStatsSetOutput(RunStats *stats, const char *outputFile){
+	snprintf(stats->outputFile, sizeof(stats->outputFile), "%s", outputFile);
+}
+
+// Stop the clock on the whole run and note the peak memory use so far. Does nothing if the run was already finished.
+void runStatsFinish(RunStats *stats){
+	if(stats->finished){
+		return;
+	}
+	struct timespec wallFinish, cpuFinish;
+	clock_gettime(CLOCK_MONOTONIC, &wallFinish);
+	clock_gettime(cpuClock, &cpuFinish);
+	stats->wallSecs = secondsBetween(stats->total.wallStart, wallFinish);
+	stats->cpuSecs = secondsBetween(stats->total.cpuStart, cpuFinish);
+
+	// Linux reports the peak resident set size in kilobytes.
+	struct rusage usage;
+	stats->peakRssBytes = getrusage(RUSAGE_SELF, &usage) == 0 ? (long long int)usage.ru_maxrss * 1024 : 0;
+	stats->finished = true;
+}
+
+// Write one run as a JSON object, with every line after the first starting with indent.
+static void writeRunJson(FILE *file, const RunStats *stats, const char *indent){
+	RunStats finished = *stats;
+	runStatsFinish(&finished);
+
+	fprintf(file, "{\n");
+	fprintf(file, "%s  \"input_file\": ", indent);
+	writeJsonString(file, finished.inputFile);
+	fprintf(file, ",\n%s  \"output_file\": ", indent);
+	writeJsonString(file, finished.outputFile);
+	fprintf(file, ",\n%s  \"input_bytes\": %llu,\n", indent, (unsigned long long)finished.inputBytes);
+	if(!finished.basesUnknown){
+		fprintf(file, "%s  \"bases\": %llu,\n", indent, (unsigned long long)finished.bases);
+	}
+	fprintf(file, "%s  \"records\": %llu,\n", indent, (unsigned long long)finished.records);
+	fprintf(file, "%s  \"width\": %llu,\n", indent, (unsigned long long)finished.width);
+	fprintf(file, "%s  \"height\": %llu,\n", indent, (unsigned long long)finished.height);
+	fprintf(file, "%s  \"scale\": %d,\n", indent, finished.scale);
+	fprintf(file, "%s  \"layout\": ", indent);
+	writeJsonString(file, finished.layout);
+	fprintf(file, ",\n%s  \"simd\": ", indent);
+	writeJsonString(file, finished.simd);
+	fprintf(file, ",\n%s  \"threads\": %d,\n", indent, finished.threads);
+	fprintf(file, "%s  \"wall_secs\": %.6f,\n", indent, finished.wallSecs);
+	fprintf(file, "%s  \"cpu_secs\": %.6f,\n", indent, finished.cpuSecs);
+	if(!finished.basesUnknown){
+		fprintf(file, "%s  \"bases_per_sec\": %.1f,\n", indent, throughput(finished.bases, finished.wallSecs));
+	}
+	fprintf(file, "%s  \"peak_rss_bytes\": %lld,\n", indent, finished.peakRssBytes);
+	fprintf(file, "%s  \"stages\": [", indent);
+	for(int i = 0; i < finished.numStages; i++){
+		const StageStats *stage = &finished.stages[i];
+		fprintf(file, "%s\n%s    {\"name\": ", i == 0 ? "" : ",", indent);
+		writeJsonString(file, stage->name);
+		fprintf(file, ", \"wall_secs\": %.6f, \"cpu_secs\": %.6f, \"bytes_in\": %llu, \"bytes_out\": %llu, \"bases\": %llu, \"bases_per_sec\": %.1f}",
+			stage->wallSecs, stage->cpuSecs, (unsigned long long)stage->bytesIn, (unsigned long long)stage->bytesOut,
+			(unsigned long long)stage->bases, throughput(stage->bases, stage->wallSecs));
+	}
+	if(finished.numStages != 0){
+		fprintf(file, "\n%s  ", indent);
+	}
+	fprintf(file, "]\n%s}", indent);
+}
+
+// Write the report as JSON to path. A single run is written as one object. A batch is always written as an array with one object
+// per run, even when it only has one run (or none), so readers never have to guess. Runs which were not finished yet get the totals
+// up to now. Returns false if the file could not be written.
+bool runStatsWriteJson(const RunStats *stats, long long int numRuns, bool batch, const char *path){
+	FILE *file = fopen(path, "w");
+	if(NULL == file){
+		return false;
+	}
+
+	if(!batch){
+		writeRunJson(file, stats, "");
+	}
+	else{
+		fprintf(file, "[");
+		for(long long int i = 0; i < numRuns; i++){
+			fprintf(file, "%s\n  ", i == 0 ? "" : ",");
+			writeRunJson(file, &stats[i], "  ");
+		}
+		fprintf(file, "%s]", numRuns == 0 ? "" : "\n");
+	}
+	fprintf(file, "\n");
+
+	bool written = !ferror(file);
+	if(fclose(file) != 0){
+		written = false;
+	}
+	return written;
+}
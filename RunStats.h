@@ -0,0 +1,91 @@
+/*
+	https://github.com/cole8888/Gene2Pic
+
+	Collects the wall time, CPU time and amount of data handled by each stage of a run so it can be written out as JSON
+	(--stats-json) for scripts and dashboards, instead of having to scrape the progress messages.
+*/
+
+#ifndef RUNSTATS_H
+#define RUNSTATS_H
+
+#include <time.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <sys/types.h>
+#include <sys/resource.h>
+
+#define RUN_STATS_MAX_STAGES 16	// More than any run has, later stages are dropped if there are too many. (Repeated stages share one entry.)
+
+// Start of a stage, on the wall clock and in CPU time used by the whole process (all threads), or by just the calling thread
+// after runStatsUseThreadCpuTime(true).
+typedef struct{
+	struct timespec wallStart;
+	struct timespec cpuStart;
+} StageTimer;
+
+typedef struct{
+	const char *name;	// Short name used as the key in the report, must be a string literal.
+	double wallSecs;
+	double cpuSecs;	// CPU time of every thread added together, so can be larger than wallSecs.
+	u_int64_t bytesIn;
+	u_int64_t bytesOut;
+	u_int64_t bases;	// Bases this stage went through, used to work out its throughput.
+} StageStats;
+
+typedef struct{
+	StageTimer total;	// Started when the run starts.
+	StageStats stages[RUN_STATS_MAX_STAGES];
+	int numStages;
+
+	// Description of the run. Left zero or empty if a run never got as far as knowing them.
+	char inputFile[PATH_MAX];
+	char outputFile[PATH_MAX];
+	u_int64_t inputBytes;
+	u_int64_t bases;
+	bool basesUnknown;	// Set for an image copied from the cache without metadata, the bases and their throughput are left out of the report.
+	u_int64_t records;	// FASTA records in the input.
+	u_int64_t width;
+	u_int64_t height;
+	int scale;
+	const char *layout;
+	const char *simd;	// Validation kernel.
+	int threads;
+
+	// Totals for the whole run, filled in by runStatsFinish().
+	bool finished;
+	double wallSecs;
+	double cpuSecs;
+	long long int peakRssBytes;	// Of the whole process, shared by every run in a batch.
+} RunStats;
+
+// Clear the stats and start timing the whole run.
+void runStatsInit(RunStats *stats);
+
+// Measure CPU time used by the calling thread only instead of the whole process, for runs which share the process with other runs
+// happening at the same time. Only affects the calling thread.
+void runStatsUseThreadCpuTime(bool threadOnly);
+
+// Start timing a stage.
+void stageTimerStart(StageTimer *timer);
+
+// Wall clock seconds since the timer was started.
+double stageTimerElapsed(const StageTimer *timer);
+
+// Record a stage which started at timer and has just finished. Returns the wall clock seconds it took, for the progress message.
+// A stage that runs more than once (once per record for example) is added to the totals of the earlier runs.
+double runStatsAddStage(RunStats *stats, const char *name, const StageTimer *timer, u_int64_t bytesIn, u_int64_t bytesOut, u_int64_t bases);
+
+// Remember which file the image was written to.
+void runStatsSetOutput(RunStats *stats, const char *outputFile);
+
+// Stop the clock on the whole run and note the peak memory use so far. Does nothing if the run was already finished.
+void runStatsFinish(RunStats *stats);
+
+// Write the report as JSON to path. A single run is written as one object, a batch always as an array with one object per run (even
+// with only one run). Runs which were not finished yet get the totals up to now. Returns false if the file could not be written.
+bool runStatsWriteJson(const RunStats *stats, long long int numRuns, bool batch, const char *path);
+
+#endif
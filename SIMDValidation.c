@@ -0,0 +1,245 @@
+/*
+	https://github.com/cole8888/Gene2Pic
+
+	SIMD kernels for removing invalid characters from a genetic sequence.
+
+	Every character is classified using two 16 entry lookup tables indexed by its low and high nibble (pshufb does 16 or 64 of
+	these lookups at once). The low nibble table says which of the two letter groups the low nibble can belong to, and the high
+	nibble table says which group the high nibble belongs to. A character is only valid if both agree:
+
+		Group 1: A C G (0x41 0x43 0x47) and a c g (0x61 0x63 0x67)	High nibble 4 or 6, low nibble 1, 3 or 7.
+		Group 2: T U   (0x54 0x55)		and t u   (0x74 0x75)		High nibble 5 or 7, low nibble 4 or 5.
+
+	Valid characters are then folded to uppercase by clearing bit 5, Uracil is turned into Thymine by subtracting 1, and the valid
+	ones are packed together. AVX-512 VBMI2 can do that directly with vpcompressb, the older instruction sets use a table of pshufb
+	masks to pack 8 characters at a time.
+*/
+
+#include "SIMDValidation.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define SIMD_VALIDATION_X86
+#endif
+
+// pshufb masks to move the valid characters in an 8 character group to the front. Indexed by the validity bitmask of the group.
+static u_int8_t compactTable[256][8];
+
+// Fill out compactTable.
+static void buildCompactTable(void){
+	for(int mask = 0; mask < 256; mask++){
+		int count = 0;
+		for(int bit = 0; bit < 8; bit++){
+			if(mask & (1 << bit)){
+				compactTable[mask][count++] = (u_int8_t)bit;
+			}
+		}
+		// Unused slots are zeroed by pshufb (high bit set).
+		while(count < 8){
+			compactTable[mask][count++] = 0x80;
+		}
+	}
+}
+
+#ifdef SIMD_VALIDATION_X86
+
+// Lookup tables for the low and high nibble of each character. (See the comment at the top of the file.)
+#define LOW_NIBBLE_CLASSES  0, 1, 0, 1, 2, 2, 0, 1, 0, 0, 0, 0, 0, 0, 0, 0
+#define HIGH_NIBBLE_CLASSES 0, 0, 0, 0, 1, 2, 1, 2, 0, 0, 0, 0, 0, 0, 0, 0
+
+__attribute__((target("ssse3,popcnt")))
+static long long int validateSSSE3(const char *input, char *output, long long int len, long long int outputCapacity, long long int *consumed, bool writeOutput){
+	const __m128i lowLut = _mm_setr_epi8(LOW_NIBBLE_CLASSES);
+	const __m128i highLut = _mm_setr_epi8(HIGH_NIBBLE_CLASSES);
+	const __m128i nibble = _mm_set1_epi8(0x0F);
+	const __m128i caseMask = _mm_set1_epi8((char)0xDF);
+	const __m128i uracil = _mm_set1_epi8('U');
+
+	long long int i = 0;
+	long long int written = 0;
+	// Stop once there might not be room for a full vector in the output, since the stores below can write a few characters past the valid ones.
+	for(; i + 16 <= len && (!writeOutput || written + 16 <= outputCapacity); i += 16){
+		__m128i chars = _mm_loadu_si128((const __m128i *)(input + i));
+		__m128i classes = _mm_and_si128(_mm_shuffle_epi8(lowLut, _mm_and_si128(chars, nibble)), _mm_shuffle_epi8(highLut, _mm_and_si128(_mm_srli_epi16(chars, 4), nibble)));
+		unsigned int mask = ~_mm_movemask_epi8(_mm_cmpeq_epi8(classes, _mm_setzero_si128())) & 0xFFFF;
+		if(!writeOutput || mask == 0){
+			written += __builtin_popcount(mask);
+			continue;
+		}
+
+		// Uppercase everything, then turn U into T. (cmpeq gives -1 where the character is U.)
+		__m128i bases = _mm_and_si128(chars, caseMask);
+		bases = _mm_add_epi8(bases, _mm_cmpeq_epi8(bases, uracil));
+
+		if(mask == 0xFFFF){
+			// All valid, nothing to pack.
+			_mm_storeu_si128((__m128i *)(output + written), bases);
+			written += 16;
+			continue;
+		}
+
+		// Pack each half separately.
+		__m128i low = _mm_shuffle_epi8(bases, _mm_loadl_epi64((const __m128i *)compactTable[mask & 0xFF]));
+		_mm_storel_epi64((__m128i *)(output + written), low);
+		written += __builtin_popcount(mask & 0xFF);
+		__m128i high = _mm_shuffle_epi8(_mm_srli_si128(bases, 8), _mm_loadl_epi64((const __m128i *)compactTable[mask >> 8]));
+		_mm_storel_epi64((__m128i *)(output + written), high);
+		written += __builtin_popcount(mask >> 8);
+	}
+	*consumed = i;
+	return written;
+}
+
+__attribute__((target("avx2,popcnt")))
+static long long int validateAVX2(const char *input, char *output, long long int len, long long int outputCapacity, long long int *consumed, bool writeOutput){
+	const __m256i lowLut = _mm256_setr_epi8(LOW_NIBBLE_CLASSES, LOW_NIBBLE_CLASSES);
+	const __m256i highLut = _mm256_setr_epi8(HIGH_NIBBLE_CLASSES, HIGH_NIBBLE_CLASSES);
+	const __m256i nibble = _mm256_set1_epi8(0x0F);
+	const __m256i caseMask = _mm256_set1_epi8((char)0xDF);
+	const __m256i uracil = _mm256_set1_epi8('U');
+
+	long long int i = 0;
+	long long int written = 0;
+	// Stop once there might not be room for a full vector in the output, since the stores below can write a few characters past the valid ones.
+	for(; i + 32 <= len && (!writeOutput || written + 32 <= outputCapacity); i += 32){
+		__m256i chars = _mm256_loadu_si256((const __m256i *)(input + i));
+		__m256i classes = _mm256_and_si256(_mm256_shuffle_epi8(lowLut, _mm256_and_si256(chars, nibble)), _mm256_shuffle_epi8(highLut, _mm256_and_si256(_mm256_srli_epi16(chars, 4), nibble)));
+		unsigned int mask = ~(unsigned int)_mm256_movemask_epi8(_mm256_cmpeq_epi8(classes, _mm256_setzero_si256()));
+		if(!writeOutput || mask == 0){
+			written += __builtin_popcount(mask);
+			continue;
+		}
+
+		// Uppercase everything, then turn U into T. (cmpeq gives -1 where the character is U.)
+		__m256i bases = _mm256_and_si256(chars, caseMask);
+		bases = _mm256_add_epi8(bases, _mm256_cmpeq_epi8(bases, uracil));
+
+		if(mask == 0xFFFFFFFF){
+			// All valid, nothing to pack.
+			_mm256_storeu_si256((__m256i *)(output + written), bases);
+			written += 32;
+			continue;
+		}
+
+		// pshufb cannot move characters between the two 128 bit lanes, so pack each group of 8 on its own.
+		__m128i halves[2] = {_mm256_castsi256_si128(bases), _mm256_extracti128_si256(bases, 1)};
+		for(int group = 0; group < 4; group++){
+			unsigned int groupMask = (mask >> (group * 8)) & 0xFF;
+			__m128i groupChars = (group & 1) ? _mm_srli_si128(halves[group >> 1], 8) : halves[group >> 1];
+			_mm_storel_epi64((__m128i *)(output + written), _mm_shuffle_epi8(groupChars, _mm_loadl_epi64((const __m128i *)compactTable[groupMask])));
+			written += __builtin_popcount(groupMask);
+		}
+	}
+	*consumed = i;
+	return written;
+}
+
+__attribute__((target("avx512f,avx512bw,avx512vbmi2,popcnt")))
+static long long int validateAVX512(const char *input, char *output, long long int len, long long int outputCapacity, long long int *consumed, bool writeOutput){
+	(void)outputCapacity;	// Masked stores never write past the valid characters so there is no need to leave room.
+	const __m512i lowLut = _mm512_broadcast_i32x4(_mm_setr_epi8(LOW_NIBBLE_CLASSES));
+	const __m512i highLut = _mm512_broadcast_i32x4(_mm_setr_epi8(HIGH_NIBBLE_CLASSES));
+	const __m512i nibble = _mm512_set1_epi8(0x0F);
+	const __m512i caseMask = _mm512_set1_epi8((char)0xDF);
+	const __m512i uracil = _mm512_set1_epi8('U');
+	const __m512i one = _mm512_set1_epi8(1);
+
+	long long int i = 0;
+	long long int written = 0;
+	for(; i + 64 <= len; i += 64){
+		__m512i chars = _mm512_loadu_si512((const void *)(input + i));
+		__m512i classes = _mm512_and_si512(_mm512_shuffle_epi8(lowLut, _mm512_and_si512(chars, nibble)), _mm512_shuffle_epi8(highLut, _mm512_and_si512(_mm512_srli_epi16(chars, 4), nibble)));
+		__mmask64 mask = _mm512_test_epi8_mask(classes, classes);
+		long long int count = __builtin_popcountll(mask);
+		if(writeOutput && count > 0){
+			// Uppercase everything, then turn U into T.
+			__m512i bases = _mm512_and_si512(chars, caseMask);
+			bases = _mm512_mask_sub_epi8(bases, _mm512_cmpeq_epi8_mask(bases, uracil), bases, one);
+			__mmask64 storeMask = count == 64 ? ~(__mmask64)0 : (((__mmask64)1 << count) - 1);
+			_mm512_mask_storeu_epi8(output + written, storeMask, _mm512_maskz_compress_epi8(mask, bases));
+		}
+		written += count;
+	}
+	*consumed = i;
+	return written;
+}
+
+#endif
+
+// Find the fastest kernel the CPU we are running on supports. Setting the GENE2PIC_SIMD environment variable to
+// "scalar", "ssse3", "avx2" or "avx512" lowers it to that level (useful for benchmarking). Call once before using the kernels.
+SIMDLevel detectSIMDLevel(void){
+	SIMDLevel level = SIMD_LEVEL_SCALAR;
+	buildCompactTable();
+
+#ifdef SIMD_VALIDATION_X86
+	__builtin_cpu_init();
+	if(__builtin_cpu_supports("ssse3") && __builtin_cpu_supports("popcnt")){
+		level = SIMD_LEVEL_SSSE3;
+		if(__builtin_cpu_supports("avx2")){
+			level = SIMD_LEVEL_AVX2;
+			if(__builtin_cpu_supports("avx512bw") && __builtin_cpu_supports("avx512vbmi2")){
+				level = SIMD_LEVEL_AVX512;
+			}
+		}
+	}
+#endif
+
+	// Let the user pick a slower kernel, but never one the CPU does not support.
+	char *requested = getenv("GENE2PIC_SIMD");
+	if(NULL != requested){
+		for(SIMDLevel option = SIMD_LEVEL_SCALAR; option <= level; option++){
+			if(strcmp(requested, simdLevelName(option)) == 0){
+				level = option;
+				break;
+			}
+		}
+	}
+	return level;
+}
+
+// Human readable name of a SIMD level.
+const char *simdLevelName(SIMDLevel level){
+	switch(level){
+		case SIMD_LEVEL_SSSE3:
+			return "ssse3";
+		case SIMD_LEVEL_AVX2:
+			return "avx2";
+		case SIMD_LEVEL_AVX512:
+			return "avx512";
+		default:
+			return "scalar";
+	}
+}
+
+// Run the kernel for the requested level. Scalar level does nothing and leaves everything to the caller.
+static long long int runKernel(SIMDLevel level, const char *input, char *output, long long int len, long long int outputCapacity, long long int *consumed, bool writeOutput){
+	*consumed = 0;
+#ifdef SIMD_VALIDATION_X86
+	switch(level){
+		case SIMD_LEVEL_SSSE3:
+			return validateSSSE3(input, output, len, outputCapacity, consumed, writeOutput);
+		case SIMD_LEVEL_AVX2:
+			return validateAVX2(input, output, len, outputCapacity, consumed, writeOutput);
+		case SIMD_LEVEL_AVX512:
+			return validateAVX512(input, output, len, outputCapacity, consumed, writeOutput);
+		default:
+			break;
+	}
+#else
+	(void)level; (void)input; (void)output; (void)len; (void)outputCapacity; (void)writeOutput;
+#endif
+	return 0;
+}
+
+// Copy the valid bases (ATCGU, upper or lowercase) from input to output as uppercase letters, with Uracil written as Thymine.
+// Only whole vectors are handled, the number of characters consumed is written to consumed and the caller must finish the rest with the scalar loop.
+// Never writes past output + outputCapacity. Output may be the same array as input. Returns the number of valid bases written.
+long long int validateBasesSIMD(SIMDLevel level, const char *input, char *output, long long int len, long long int outputCapacity, long long int *consumed){
+	return runKernel(level, input, output, len, outputCapacity, consumed, true);
+}
+
+// Count the valid bases in input without writing them anywhere. Same rules for consumed as validateBasesSIMD().
+long long int countValidBasesSIMD(SIMDLevel level, const char *input, long long int len, long long int *consumed){
+	return runKernel(level, input, NULL, len, 0, consumed, false);
+}
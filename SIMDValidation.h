@@ -0,0 +1,40 @@
+/*
+	https://github.com/cole8888/Gene2Pic
+
+	SIMD kernels for removing invalid characters from a genetic sequence.
+*/
+
+#ifndef SIMDVALIDATION_H
+#define SIMDVALIDATION_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <sys/types.h>
+
+// Instruction sets the validation kernels can use, in order from slowest to fastest.
+typedef enum{
+	SIMD_LEVEL_SCALAR,	// No SIMD kernel, everything is done by the scalar loop.
+	SIMD_LEVEL_SSSE3,	// 16 characters at a time, compacted with pshufb.
+	SIMD_LEVEL_AVX2,	// 32 characters at a time, compacted with pshufb.
+	SIMD_LEVEL_AVX512	// 64 characters at a time, compacted with vpcompressb. (Needs AVX-512 VBMI2)
+} SIMDLevel;
+
+// Find the fastest kernel the CPU we are running on supports. Setting the GENE2PIC_SIMD environment variable to
+// "scalar", "ssse3", "avx2" or "avx512" lowers it to that level (useful for benchmarking). Call once before using the kernels.
+SIMDLevel detectSIMDLevel(void);
+
+// Human readable name of a SIMD level.
+const char *simdLevelName(SIMDLevel level);
+
+// Copy the valid bases (ATCGU, upper or lowercase) from input to output as uppercase letters, with Uracil written as Thymine.
+// Only whole vectors are handled, the number of characters consumed is written to consumed and the caller must finish the rest with the scalar loop.
+// Never writes past output + outputCapacity. Output may be the same array as input. Returns the number of valid bases written.
+long long int validateBasesSIMD(SIMDLevel level, const char *input, char *output, long long int len, long long int outputCapacity, long long int *consumed);
+
+// Count the valid bases in input without writing them anywhere. Same rules for consumed as validateBasesSIMD().
+long long int countValidBasesSIMD(SIMDLevel level, const char *input, long long int len, long long int *consumed);
+
+#endif
@@ -0,0 +1,139 @@
+/*
+	https://github.com/cole8888/Gene2Pic
+
+	Hilbert and Z-order (Morton) curves.
+*/
+
+#include "SpaceFillingCurve.h"
+
+// Position of cell d along a Hilbert curve covering a grid with 2^order cells on each side. (The usual iterative method, working up from the smallest level.)
+static void hilbertD2XY(int order, u_int64_t d, u_int32_t *x, u_int32_t *y){
+	u_int32_t cellX = 0, cellY = 0;
+	for(int level = 0; level < order; level++){
+		u_int32_t s = 1u << level;
+		u_int32_t rx = (u_int32_t)(d >> 1) & 1;
+		u_int32_t ry = (u_int32_t)(d ^ rx) & 1;
+
+		// Rotate the part of the curve done so far into the right orientation for this quadrant.
+		if(ry == 0){
+			if(rx == 1){
+				cellX = s - 1 - cellX;
+				cellY = s - 1 - cellY;
+			}
+			u_int32_t tmp = cellX;
+			cellX = cellY;
+			cellY = tmp;
+		}
+		cellX += s * rx;
+		cellY += s * ry;
+		d >>= 2;
+	}
+	*x = cellX;
+	*y = cellY;
+}
+
+// Gather every second bit of value (starting with bit 0) into the low half.
+static u_int32_t compactBits(u_int64_t value){
+	value &= 0x5555555555555555ULL;
+	value = (value | (value >> 1)) & 0x3333333333333333ULL;
+	value = (value | (value >> 2)) & 0x0F0F0F0F0F0F0F0FULL;
+	value = (value | (value >> 4)) & 0x00FF00FF00FF00FFULL;
+	value = (value | (value >> 8)) & 0x0000FFFF0000FFFFULL;
+	value = (value | (value >> 16)) & 0x00000000FFFFFFFFULL;
+	return (u_int32_t)value;
+}
+
+// Position of cell d along a Morton curve, the X bits are the even bits of d and the Y bits are the odd ones.
+static void mortonD2XY(u_int64_t d, u_int32_t *x, u_int32_t *y){
+	*x = compactBits(d);
+	*y = compactBits(d >> 1);
+}
+
+// Set up the tables for a curve covering a square at least dim cells on each side, transposed or not. Exits if memory cannot be allocated.
+void curveTableInit(CurveTable *table, CurveType type, long long int dim, bool transposed){
+	memset(table, 0, sizeof(CurveTable));
+	table->type = type;
+	table->transposed = transposed;
+	while((1LL << table->order) < dim){
+		table->order++;
+	}
+	table->tileBits = table->order < CURVE_TILE_BITS ? table->order : CURVE_TILE_BITS;
+	table->numTiles = 1ULL << (2 * (table->order - table->tileBits));
+
+	u_int32_t tileSize = 1u << table->tileBits;
+	u_int32_t tileCells = tileSize * tileSize;
+	for(int i = 0; i < CURVE_ORIENTATIONS; i++){
+		table->tileCells[i] = (u_int16_t *)malloc(tileCells * sizeof(u_int16_t));
+		if(NULL == table->tileCells[i]){
+			fprintf(stderr, "Unable to allocate curve tables... May have run out of RAM.\n");
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	// The small curve for one tile, then the same curve transposed, anti-transposed and rotated 180 degrees. Inside a bigger Hilbert curve every
+	// tile is one of these. (Morton tiles only ever use the first, or the second when transposed.)
+	for(u_int32_t d = 0; d < tileCells; d++){
+		u_int32_t x, y;
+		if(type == CURVE_HILBERT){
+			hilbertD2XY(table->tileBits, d, &x, &y);
+		}
+		else{
+			mortonD2XY(d, &x, &y);
+		}
+		u_int32_t last = tileSize - 1;
+		table->tileCells[0][d] = (u_int16_t)(x | (y << 8));
+		table->tileCells[1][d] = (u_int16_t)(y | (x << 8));
+		table->tileCells[2][d] = (u_int16_t)((last - y) | ((last - x) << 8));
+		table->tileCells[3][d] = (u_int16_t)((last - x) | ((last - y) << 8));
+	}
+}
+
+// Free the tables.
+void curveTableFree(CurveTable *table){
+	for(int i = 0; i < CURVE_ORIENTATIONS; i++){
+		free(table->tileCells[i]);
+		table->tileCells[i] = NULL;
+	}
+}
+
+// Position of cell d along the curve.
+void curveD2XY(const CurveTable *table, u_int64_t d, u_int32_t *x, u_int32_t *y){
+	if(table->transposed){
+		u_int32_t *tmp = x;
+		x = y;
+		y = tmp;
+	}
+	if(table->type == CURVE_HILBERT){
+		hilbertD2XY(table->order, d, x, y);
+	}
+	else{
+		mortonD2XY(d, x, y);
+	}
+}
+
+// Find the tile covered by cells tile * tileSize^2 to (tile + 1) * tileSize^2 - 1 along the curve. Gives its top left corner and the positions of its
+// cells (relative to that corner) in the order the curve visits them.
+void curveTile(const CurveTable *table, u_int64_t tile, u_int32_t *originX, u_int32_t *originY, const u_int16_t **cells){
+	u_int32_t tileMask = ~((1u << table->tileBits) - 1);
+	u_int64_t firstCell = tile << (2 * table->tileBits);
+	u_int32_t x0, y0;
+	curveD2XY(table, firstCell, &x0, &y0);
+	*originX = x0 & tileMask;
+	*originY = y0 & tileMask;
+	*cells = table->tileCells[table->transposed ? 1 : 0];
+	if(table->type == CURVE_MORTON || table->tileBits == 0){
+		return;
+	}
+
+	// Work out which way round the tile's curve is from where its first two cells are.
+	u_int32_t x1, y1;
+	curveD2XY(table, firstCell + 1, &x1, &y1);
+	u_int16_t first = (u_int16_t)((x0 - *originX) | ((y0 - *originY) << 8));
+	u_int16_t second = (u_int16_t)((x1 - *originX) | ((y1 - *originY) << 8));
+	for(int i = 0; i < CURVE_ORIENTATIONS; i++){
+		if(table->tileCells[i][0] == first && table->tileCells[i][1] == second){
+			*cells = table->tileCells[i];
+			return;
+		}
+	}
+}
@@ -0,0 +1,53 @@
+/*
+	https://github.com/cole8888/Gene2Pic
+
+	Hilbert and Z-order (Morton) curves for laying out a sequence so that bases which are close together in the sequence end up close
+	together in the image.
+
+	Both curves cover a square grid whose side is a power of two. The grid is split into tiles of CURVE_TILE_SIZE x CURVE_TILE_SIZE cells,
+	and because both curves are recursive, each run of CURVE_TILE_SIZE^2 consecutive cells along the curve fills exactly one tile. The
+	order of the cells inside a tile is always the same small curve, only flipped or transposed, so it is looked up from a table
+	instead of being worked out cell by cell. Tiles can be filled independently, which makes it easy to lay out the image on every thread.
+*/
+
+#ifndef SPACEFILLINGCURVE_H
+#define SPACEFILLINGCURVE_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <sys/types.h>
+
+#define CURVE_TILE_BITS 6	// Tiles are 64x64 cells. (Local coordinates must fit in a byte.)
+#define CURVE_ORIENTATIONS 4	// Hilbert tiles are the same curve transformed in one of 4 ways. Morton tiles are all the same.
+
+typedef enum{
+	CURVE_HILBERT,
+	CURVE_MORTON
+} CurveType;
+
+typedef struct{
+	CurveType type;
+	int order;	// The grid is 2^order cells on each side.
+	int tileBits;	// Tiles are 2^tileBits cells on each side. (Smaller than CURVE_TILE_BITS if the whole grid is.)
+	bool transposed;	// X and Y are swapped.
+	u_int64_t numTiles;
+	// Position of every cell inside a tile in the order the curve visits them, for each orientation. X is in the low byte and Y in the high byte.
+	u_int16_t *tileCells[CURVE_ORIENTATIONS];
+} CurveTable;
+
+// Set up the tables for a curve covering a square at least dim cells on each side, transposed or not. Exits if memory cannot be allocated.
+void curveTableInit(CurveTable *table, CurveType type, long long int dim, bool transposed);
+
+// Free the tables.
+void curveTableFree(CurveTable *table);
+
+// Position of cell d along the curve.
+void curveD2XY(const CurveTable *table, u_int64_t d, u_int32_t *x, u_int32_t *y);
+
+// Find the tile covered by cells tile * tileSize^2 to (tile + 1) * tileSize^2 - 1 along the curve. Gives its top left corner and the positions of its
+// cells (relative to that corner) in the order the curve visits them.
+void curveTile(const CurveTable *table, u_int64_t tile, u_int32_t *originX, u_int32_t *originY, const u_int16_t **cells);
+
+#endif
@@ -0,0 +1,295 @@
+/*
+	https://github.com/cole8888/Gene2Pic
+
+	Writes an image as a Deep Zoom (DZI) tile pyramid.
+*/
+
+#include "TilePyramid.h"
+
+// Pixels across a level. Each level is half the size of the one below it, rounded up.
+static long long int levelSize(long long int size, int level, int maxLevel){
+	int shift = maxLevel - level;
+	return (size + (1LL << shift) - 1) >> shift;
+}
+
+// Bytes per pixel of the tiles of a level. Palette indices, or RGB for the averaged levels.
+static int levelChannels(const TilePyramid *pyramid, int level){
+	return pyramid->mode == DOWNSAMPLE_AVERAGE && level < pyramid->maxLevel ? 3 : 1;
+}
+
+// Read a downsample mode name. Returns false if it is not one we know.
+bool parseDownsampleMode(const char *arg, DownsampleMode *mode){
+	if(strcasecmp(arg, "majority") == 0){
+		*mode = DOWNSAMPLE_MAJORITY;
+	}
+	else if(strcasecmp(arg, "average") == 0){
+		*mode = DOWNSAMPLE_AVERAGE;
+	}
+	else{
+		return false;
+	}
+	return true;
+}
+
+// Stop the pyramid from being finished because it could not be allocated. Only the first problem is reported, others are likely to follow it.
+static void tileAllocationFailed(TilePyramid *pyramid){
+	#pragma omp critical(tilePyramidError)
+	{
+		if(!pyramid->failed){
+			fprintf(stderr, "\nUnable to allocate tile... May have run out of RAM.\n");
+		}
+		pyramid->failed = true;
+	}
+}
+
+// Encode a tile and write it to <NAME>_files/<LEVEL>/<COLUMN>_<ROW>.png.
+static void saveTile(TilePyramid *pyramid, int level, long long int col, long long int row, const u_char *pixels, long long int width, long long int height){
+	// The colour type is given instead of letting lodepng analyse every tile to pick one, and the pixels are handed over already in
+	// that format so lodepng does not have to convert them. Palette tiles are 4 bits per pixel, enough for the bases and the blank
+	// pixels, packed as one long run of bits the way lodepng wants them.
+	LodePNGState state;
+	lodepng_state_init(&state);
+	state.encoder = pyramid->encoder;
+	state.encoder.auto_convert = 0;
+	state.encoder.zlibsettings.custom_zlib = parallelZlibCompress;	// Much faster than lodepng's deflate. (A tile is one chunk, so this stays on the one thread.)
+	u_char *filters = pngFilterPlan(&state.encoder, pixels, width * levelChannels(pyramid, level), height);	// Before the palette indices are packed.
+	u_char *packed = NULL;
+	if(levelChannels(pyramid, level) == 1){
+		state.info_raw.colortype = LCT_PALETTE;
+		state.info_raw.bitdepth = 4;
+		for(int i = 0; i < pyramid->paletteSize; i++){
+			lodepng_palette_add(&state.info_raw, pyramid->palette[i][0], pyramid->palette[i][1], pyramid->palette[i][2], 255);
+		}
+		packed = (u_char *)calloc((width * height + 1) / 2, sizeof(u_char));
+		if(NULL == packed){
+			tileAllocationFailed(pyramid);
+			free(filters);
+			lodepng_state_cleanup(&state);
+			return;
+		}
+		for(long long int i = 0; i < width * height; i++){
+			packed[i / 2] |= pixels[i] << (i % 2 == 0 ? 4 : 0);
+		}
+		pixels = packed;
+	}
+	else{
+		state.info_raw.colortype = LCT_RGB;
+		state.info_raw.bitdepth = 8;
+	}
+	lodepng_color_mode_copy(&state.info_png.color, &state.info_raw);
+
+	u_char *png = NULL;
+	size_t pngSize = 0;
+	char path[PATH_MAX];
+	unsigned error = lodepng_encode(&png, &pngSize, pixels, width, height, &state);
+	bool saved = error == 0 && snprintf(path, sizeof(path), "%s/%d/%lld_%lld.png", pyramid->filesDir, level, col, row) < (int)sizeof(path)
+		&& lodepng_save_file(png, pngSize, path) == 0;
+	free(png);
+	free(packed);
+	free(filters);
+	lodepng_state_cleanup(&state);
+
+	#pragma omp atomic
+	pyramid->tilesWritten++;
+	#pragma omp atomic
+	pyramid->bytesWritten += pngSize;
+	if(!saved){
+		#pragma omp critical(tilePyramidError)
+		{
+			if(!pyramid->failed){
+				fprintf(stderr, "\nUnable to write tile %lld_%lld of level %d to %s/%d.\n", col, row, level, pyramid->filesDir, level);
+			}
+			pyramid->failed = true;
+		}
+	}
+}
+
+// Shrink a tile of childLevel by half into the part of its parent tile starting at (offsetX, offsetY).
+static void shrinkTile(const TilePyramid *pyramid, int childLevel, const u_char *child, long long int childWidth, long long int childHeight,
+	u_char *parent, long long int parentWidth, long long int offsetX, long long int offsetY){
+	int childChannels = levelChannels(pyramid, childLevel);
+	int parentChannels = levelChannels(pyramid, childLevel - 1);
+	for(long long int y = 0; y < (childHeight + 1) / 2; y++){
+		for(long long int x = 0; x < (childWidth + 1) / 2; x++){
+			u_char *out = parent + ((offsetY + y) * parentWidth + offsetX + x) * parentChannels;
+			long long int lastY = 2 * y + 1 < childHeight ? 2 * y + 1 : 2 * y;
+			long long int lastX = 2 * x + 1 < childWidth ? 2 * x + 1 : 2 * x;
+			if(pyramid->mode == DOWNSAMPLE_MAJORITY){
+				// Ties go to the first entry in the palette. Blank only wins if there are no bases at all.
+				int counts[TILE_PYRAMID_MAX_PALETTE] = {0};
+				for(long long int cy = 2 * y; cy <= lastY; cy++){
+					for(long long int cx = 2 * x; cx <= lastX; cx++){
+						counts[child[cy * childWidth + cx]]++;
+					}
+				}
+				int best = pyramid->blankIndex;
+				for(int i = 0; i < pyramid->paletteSize; i++){
+					if(i != pyramid->blankIndex && counts[i] > (best == pyramid->blankIndex ? 0 : counts[best])){
+						best = i;
+					}
+				}
+				*out = (u_char)best;
+			}
+			else{
+				int sums[3] = {0, 0, 0};
+				int numPixels = 0;
+				for(long long int cy = 2 * y; cy <= lastY; cy++){
+					for(long long int cx = 2 * x; cx <= lastX; cx++){
+						const u_char *pixel = child + (cy * childWidth + cx) * childChannels;
+						const u_char *rgb = childChannels == 1 ? pyramid->palette[*pixel] : pixel;
+						sums[0] += rgb[0];
+						sums[1] += rgb[1];
+						sums[2] += rgb[2];
+						numPixels++;
+					}
+				}
+				for(int c = 0; c < 3; c++){
+					out[c] = (u_char)((sums[c] + numPixels / 2) / numPixels);
+				}
+			}
+		}
+	}
+}
+
+// Make a tile, either by drawing it (most detailed level) or from the up to four tiles below it, and save it. Returns its pixels, or
+// NULL if it could not be made (the tiles above it are made without it, and the pyramid is not finished).
+static u_char *buildTile(TilePyramid *pyramid, int level, long long int col, long long int row){
+	long long int levelWidth = levelSize(pyramid->width, level, pyramid->maxLevel);
+	long long int levelHeight = levelSize(pyramid->height, level, pyramid->maxLevel);
+	long long int width = levelWidth - col * TILE_PYRAMID_TILE_SIZE < TILE_PYRAMID_TILE_SIZE ? levelWidth - col * TILE_PYRAMID_TILE_SIZE : TILE_PYRAMID_TILE_SIZE;
+	long long int height = levelHeight - row * TILE_PYRAMID_TILE_SIZE < TILE_PYRAMID_TILE_SIZE ? levelHeight - row * TILE_PYRAMID_TILE_SIZE : TILE_PYRAMID_TILE_SIZE;
+	u_char *pixels = (u_char *)malloc(width * height * levelChannels(pyramid, level));
+	if(NULL == pixels){
+		tileAllocationFailed(pyramid);
+		return NULL;
+	}
+
+	if(level == pyramid->maxLevel){
+		if(!pyramid->draw(pyramid->source, col * TILE_PYRAMID_TILE_SIZE, row * TILE_PYRAMID_TILE_SIZE, width, height, pixels, width)){
+			#pragma omp critical(tilePyramidError)
+			pyramid->failed = true;
+			free(pixels);
+			return NULL;
+		}
+	}
+	else{
+		// The tiles below are made as separate tasks, so the pyramid is spread over every thread.
+		long long int childLevelWidth = levelSize(pyramid->width, level + 1, pyramid->maxLevel);
+		long long int childLevelHeight = levelSize(pyramid->height, level + 1, pyramid->maxLevel);
+		u_char *children[4] = {NULL, NULL, NULL, NULL};
+		int numChildren = 0, numMade = 0;
+		for(int i = 0; i < 4; i++){
+			long long int childCol = 2 * col + (i & 1);
+			long long int childRow = 2 * row + (i >> 1);
+			if(childCol * TILE_PYRAMID_TILE_SIZE < childLevelWidth && childRow * TILE_PYRAMID_TILE_SIZE < childLevelHeight){
+				numChildren++;
+				#pragma omp task shared(children) firstprivate(i, childCol, childRow)
+				children[i] = buildTile(pyramid, level + 1, childCol, childRow);
+			}
+		}
+		#pragma omp taskwait
+
+		for(int i = 0; i < 4; i++){
+			if(NULL == children[i]){
+				continue;
+			}
+			long long int childX = (2 * col + (i & 1)) * TILE_PYRAMID_TILE_SIZE;
+			long long int childY = (2 * row + (i >> 1)) * TILE_PYRAMID_TILE_SIZE;
+			long long int childWidth = childLevelWidth - childX < TILE_PYRAMID_TILE_SIZE ? childLevelWidth - childX : TILE_PYRAMID_TILE_SIZE;
+			long long int childHeight = childLevelHeight - childY < TILE_PYRAMID_TILE_SIZE ? childLevelHeight - childY : TILE_PYRAMID_TILE_SIZE;
+			shrinkTile(pyramid, level + 1, children[i], childWidth, childHeight, pixels, width, (i & 1) * TILE_PYRAMID_TILE_SIZE / 2, (i >> 1) * TILE_PYRAMID_TILE_SIZE / 2);
+			free(children[i]);
+			numMade++;
+		}
+		if(numMade < numChildren){
+			free(pixels);	// Part of this tile would be missing too.
+			return NULL;
+		}
+	}
+	saveTile(pyramid, level, col, row, pixels, width, height);
+	return pixels;
+}
+
+// Create a directory unless it is already there. Returns false (after saying why) if it cannot be made.
+static bool makeDirectory(const char *path){
+	if(mkdir(path, 0777) != 0 && errno != EEXIST){
+		fprintf(stderr, "Unable to create the directory %s: %s\n", path, strerror(errno));
+		return false;
+	}
+	return true;
+}
+
+// Write the pyramid for a width x height image as NAME.dzi and the tiles under NAME_files/<LEVEL>/<COLUMN>_<ROW>.png. A name ending in
+// .dzi has it removed first. The tiles of the most detailed level are drawn by draw(source, ...). Returns false (after saying why)
+// if anything could not be written. tilesWritten and bytesWritten are set either way.
+bool writeTilePyramid(const char *name, long long int width, long long int height, DownsampleMode mode, const u_char *palette, int paletteSize,
+	int blankIndex, const LodePNGEncoderSettings *encoder, TileDrawFunction draw, const void *source, u_int64_t *tilesWritten, u_int64_t *bytesWritten){
+	*tilesWritten = 0;
+	*bytesWritten = 0;
+	TilePyramid pyramid;
+	memset(&pyramid, 0, sizeof(TilePyramid));
+	pyramid.width = width;
+	pyramid.height = height;
+	pyramid.mode = mode;
+	pyramid.paletteSize = paletteSize < TILE_PYRAMID_MAX_PALETTE ? paletteSize : TILE_PYRAMID_MAX_PALETTE;
+	memcpy(pyramid.palette, palette, pyramid.paletteSize * 3);
+	pyramid.blankIndex = blankIndex;
+	pyramid.encoder = *encoder;
+	pyramid.draw = draw;
+	pyramid.source = source;
+
+	// Level 0 is one pixel, and every level after it doubles in size until the whole image fits.
+	while((1LL << pyramid.maxLevel) < (width > height ? width : height)){
+		pyramid.maxLevel++;
+	}
+
+	char dziPath[PATH_MAX];
+	int nameLen = strlen(name);
+	if(nameLen >= 4 && strcmp(name + nameLen - 4, ".dzi") == 0){
+		nameLen -= 4;
+	}
+	if(snprintf(pyramid.filesDir, sizeof(pyramid.filesDir), "%.*s_files", nameLen, name) >= (int)sizeof(pyramid.filesDir) - 16
+		|| snprintf(dziPath, sizeof(dziPath), "%.*s.dzi", nameLen, name) >= (int)sizeof(dziPath)){
+		fprintf(stderr, "Tile pyramid name %s is too long.\n", name);
+		return false;
+	}
+	if(!makeDirectory(pyramid.filesDir)){
+		return false;
+	}
+	for(int level = 0; level <= pyramid.maxLevel; level++){
+		char levelDir[PATH_MAX];
+		if(snprintf(levelDir, sizeof(levelDir), "%s/%d", pyramid.filesDir, level) >= (int)sizeof(levelDir) || !makeDirectory(levelDir)){
+			return false;
+		}
+	}
+
+	u_char *top = NULL;
+	#pragma omp parallel
+	{
+		#pragma omp single
+		top = buildTile(&pyramid, 0, 0, 0);
+	}
+	free(top);
+	*tilesWritten = pyramid.tilesWritten;
+	*bytesWritten = pyramid.bytesWritten;
+	if(pyramid.failed){
+		return false;
+	}
+
+	// The descriptor is written last, so a viewer never finds it before the tiles are there.
+	FILE *dzi = fopen(dziPath, "w");
+	if(NULL == dzi){
+		fprintf(stderr, "Unable to write %s: %s\n", dziPath, strerror(errno));
+		return false;
+	}
+	fprintf(dzi, "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n");
+	fprintf(dzi, "<Image xmlns=\"http://schemas.microsoft.com/deepzoom/2008\" TileSize=\"%d\" Overlap=\"0\" Format=\"png\">\n", TILE_PYRAMID_TILE_SIZE);
+	fprintf(dzi, "  <Size Width=\"%lld\" Height=\"%lld\"/>\n", width, height);
+	fprintf(dzi, "</Image>\n");
+	bool written = !ferror(dzi);
+	if(fclose(dzi) != 0 || !written){
+		fprintf(stderr, "Unable to write %s.\n", dziPath);
+		return false;
+	}
+	return true;
+}
@@ -0,0 +1,68 @@
+/*
+	https://github.com/cole8888/Gene2Pic
+
+	Writes an image as a Deep Zoom (DZI) tile pyramid instead of one huge PNG, so viewers only have to load the tiles they are
+	showing. The tiles of the most detailed level are drawn straight from the sequence by a callback, and every level above is made
+	by shrinking the four tiles below each tile by half. The pyramid is built depth first on every thread, so only a few tiles per
+	level are ever held in memory no matter how big the image is.
+*/
+
+#ifndef TILEPYRAMID_H
+#define TILEPYRAMID_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <limits.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <omp.h>
+#include "LODEPNG/lodepng.h"
+#include "ParallelDeflate.h"
+#include "PngWriter.h"
+
+#define TILE_PYRAMID_TILE_SIZE 256	// Tiles are this many pixels on each side, except at the right and bottom edges.
+#define TILE_PYRAMID_MAX_PALETTE 16
+#define TILE_PYRAMID_MAX_DIMENSION (1LL << 62)	// Largest width or height, so the size of every level still fits in a long long.
+
+// How the pixels of one level are shrunk into the level above.
+typedef enum{
+	DOWNSAMPLE_MAJORITY,	// Most common colour of the 2x2 pixels, blank only if all of them are. Keeps the palette.
+	DOWNSAMPLE_AVERAGE		// Average colour of the 2x2 pixels. The tiles above the most detailed level are RGB.
+} DownsampleMode;
+
+// Draw part of the full resolution image as palette indices, one byte per pixel with stride bytes from one row to the next.
+// Returns false (after saying why) if it could not be drawn.
+typedef bool (*TileDrawFunction)(const void *source, long long int x, long long int y, long long int width, long long int height, u_char *indices, long long int stride);
+
+typedef struct{
+	char filesDir[PATH_MAX];	// <NAME>_files, which holds a directory for every level.
+	long long int width;	// Size of the most detailed level.
+	long long int height;
+	int maxLevel;			// Most detailed level. Level 0 is a single pixel.
+	DownsampleMode mode;
+	u_char palette[TILE_PYRAMID_MAX_PALETTE][3];
+	int paletteSize;
+	int blankIndex;			// Palette entry of the pixels with no base, ignored by the majority vote.
+	LodePNGEncoderSettings encoder;	// How hard the tiles are compressed.
+	TileDrawFunction draw;
+	const void *source;
+
+	// Totals, added to by every thread.
+	u_int64_t tilesWritten;
+	u_int64_t bytesWritten;
+	bool failed;
+} TilePyramid;
+
+// Read a downsample mode name. Returns false if it is not one we know.
+bool parseDownsampleMode(const char *arg, DownsampleMode *mode);
+
+// Write the pyramid for a width x height image as NAME.dzi and the tiles under NAME_files/<LEVEL>/<COLUMN>_<ROW>.png. A name ending in
+// .dzi has it removed first. The tiles of the most detailed level are drawn by draw(source, ...) and compressed with the given encoder
+// settings. Returns false (after saying why) if anything could not be written. tilesWritten and bytesWritten are set either way.
+bool writeTilePyramid(const char *name, long long int width, long long int height, DownsampleMode mode, const u_char *palette, int paletteSize,
+	int blankIndex, const LodePNGEncoderSettings *encoder, TileDrawFunction draw, const void *source, u_int64_t *tilesWritten, u_int64_t *bytesWritten);
+
+#endif
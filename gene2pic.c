@@ -11,6 +11,51 @@
 
 #include "gene2pic.h"
 
+// Fastest validation kernel the CPU supports. Set once at the start of main().
+static SIMDLevel validationLevel = SIMD_LEVEL_SCALAR;
+
+// Timings and sizes of each stage of the run, written out by --stats-json.
+static RunStats runStats;
+
+// Where images are written. NULL picks a new GenePic<N>.png in the current directory for each image.
+static const char *outputPath = NULL;
+
+// Stream the images are written to instead of a file. Standard output set aside for the PNG when the output is "-" (the progress
+// messages go to standard error instead), or the in-memory buffer of a daemon job.
+static FILE *imageStream = NULL;
+
+// Set if any image could not be saved, so the run can finish with a failure exit status.
+static bool saveFailed = false;
+
+// Colours of the palette entries, in palette order. Set from the render options for each file.
+static u_char paletteColours[PALETTE_SIZE][3] = PALETTE_COLOURS;
+
+// lodepng encoder settings for the --png preset. Set from the render options for each file.
+static LodePNGEncoderSettings pngEncoder;
+
+// Metadata written into the image being saved so --decode can read it back, see setImageMetadata(). Empty for images which can't be decoded.
+static char imageMetadata[IMAGE_METADATA_SIZE];
+
+// Batch mode renders several files at once, one per thread, so each thread keeps its own copy of the per-file state above.
+#pragma omp threadprivate(runStats, outputPath, imageStream, saveFailed, paletteColours, pngEncoder, imageMetadata)
+
+// The process umask, read once at the start of main(). umask() can only be read by setting it, which is not safe once batch mode
+// has several threads saving images at the same time.
+static mode_t fileCreationMask = 022;
+
+// Progress messages are only shown when this is set. Batch mode turns them off since the messages of files rendered at the same time would be mixed together.
+static bool showProgress = true;
+
+// printf() for progress messages, which are left out when showProgress is off.
+void progress(const char *format, ...){
+	if(showProgress){
+		va_list args;
+		va_start(args, format);
+		vprintf(format, args);
+		va_end(args);
+	}
+}
+
 // Quickly find the length of the input file. This may not actually be the gene sequence length since
 // characters like newlines or letters that are not a,t,c,g,u (upper and lower case) will be ignored.
 long long int getFileLen(FILE *f){
@@ -27,31 +72,34 @@ long long int findSquareSize(long long int len){
 	return (long long int)ceil(dim);
 }
 
-// Calculate the amount of time in seconds between the provided start and finish timespec structs.
-double getElapsedTime(struct timespec start, struct timespec finish){
-	return (finish.tv_sec - start.tv_sec) + (finish.tv_nsec - start.tv_nsec) / 1000000000.0;
+// Work out the width and height (in bases) of the image for len bases. A fixed --width is used as it is and the image is as tall as it
+// needs to be. Otherwise the image is as close to the --aspect ratio as it can be with less than one row of blank pixels, or the square
+// from findSquareSize() if no aspect ratio (or 1:1) was asked for.
+void findImageSize(long long int len, const RenderOptions *options, long long int *width, long long int *height){
+	if(options->width > 0){
+		*width = options->width;
+		*height = (len + options->width - 1) / options->width;
+	}
+	else if(options->aspect > 0 && options->aspect != 1.0){
+		double rows = sqrt(len / options->aspect);
+		*height = rows < 1 ? 1 : rows > len ? len : (long long int)llround(rows);
+		*width = (len + *height - 1) / *height;
+	}
+	else{
+		*width = *height = findSquareSize(len);
+	}
 }
 
 // Functions to determine whether or not a string starts with or ends with a particular string.
 bool endsWith(char *str, char *toCheck){
-	int n = strlen(str);
-	int cl = strlen(toCheck);
-	if(n < cl){
-		return false;
-	}
-	char *subbuff = (char *)malloc(cl * sizeof(char));
-	memcpy(subbuff, &str[n - cl], cl);
-	return (strcmp(subbuff, toCheck) == 0);
+	size_t n = strlen(str);
+	size_t cl = strlen(toCheck);
+	return n >= cl && strncmp(&str[n - cl], toCheck, cl) == 0;
 }
 bool startsWith(char *str, char* toCheck){
-	int n = strlen(str);
-	int cl = strlen(toCheck);
-	if(n < cl){
-		return false;
-	}
-	char *subbuff = (char *)malloc(cl * sizeof(char));
-	memcpy(subbuff, &str[0 - cl], cl);
-	return (strcmp(subbuff, toCheck) == 0);
+	size_t n = strlen(str);
+	size_t cl = strlen(toCheck);
+	return n >= cl && strncmp(str, toCheck, cl) == 0;
 }
 
 // Construct a filepath from two strings. sizeFile is the number of valid characters in the file string.
@@ -84,393 +132,3179 @@ char *path_join(char* dir, char* file, int sizeFile){
 	return buf;
 }
 
-// Determine how many digits are in a base 10 integer.
-int getIntDigits(int num){
-	int digits = 0;
-	while(num != 0){
-		num /= 10;
-		++digits;
+// Find the highest N of the GenePic<N>.png images already in dir (GenePic.png counts as 1). Returns 0 if there are none.
+// Done in one pass over the directory instead of checking every possible name in turn.
+long long int findHighestImageNumber(const char *dir){
+	DIR *directory = opendir(dir);
+	if(NULL == directory){
+		return 0;
+	}
+	size_t prefixLen = strlen(DEFAULT_FILENAME);
+	size_t extLen = strlen(IMAGE_EXTENSION);
+	long long int highest = 0;
+	struct dirent *entry;
+	while(NULL != (entry = readdir(directory))){
+		char *name = entry->d_name;
+		size_t len = strlen(name);
+		if(len < prefixLen + extLen || !startsWith(name, DEFAULT_FILENAME) || !endsWith(name, IMAGE_EXTENSION)){
+			continue;
+		}
+		long long int number = 1;	// GenePic.png
+		if(len > prefixLen + extLen){
+			char *end;
+			number = strtoll(name + prefixLen, &end, 10);
+			if(!isdigit((u_char)name[prefixLen]) || end != name + len - extLen){
+				continue;	// Something else that happens to start with GenePic.
+			}
+		}
+		highest = number > highest ? number : highest;
 	}
-	return digits;
+	closedir(directory);
+	return highest;
 }
 
-// Save the image, do not overwrite any previous images.
-void saveImg(u_char *img, long long int dim){
+/*
+	Create a new GenePic<N>.png in the current working directory without overwriting any previous images. The directory is only
+	looked through once per run to find the highest N in use, after that the numbers carry on from there. The file is created with
+	O_EXCL, so if another run takes the same name first we just move on to the next number instead of both writing to the same file.
+*/
+bool createNumberedOutput(OutputFile *output){
+	static long long int nextImageNumber = 0;	// 0 until the directory has been looked through.
 	char *cwd = get_current_dir_name();	// Current working directory.
-	char ext[] = ".png";	// File extention. Must be .PNG
-	char buff[FILENAME_BUFFER_SIZE];	// Buffer to store the filename while we figure out what the file should be called.
-	char *file;	// Once we settle on a filename, this will hold it.
-
-	// See if an image with this name exists. If so, append a number and keep incrementing that number until we find one where that name is not in use.
-	sprintf(buff, "%s%s", DEFAULT_FILENAME, ext);
-	if(access(path_join(cwd, buff, strlen(DEFAULT_FILENAME) + strlen(ext)), F_OK) == 0){
-		// File with this filename already exists. Let's try another one.
-		int num = 2;	// Start by trying to append the number 2.
-		int digits = 1;	// 2 has one digit.
-		sprintf(buff, "%s%d%s", DEFAULT_FILENAME, num, ext);
-		
-		// Increment the appended number until we find a name that is not in use.
-		while(access(path_join(cwd, buff, digits + strlen(DEFAULT_FILENAME) + strlen(ext)), F_OK) == 0){
-			num++;
-			digits = getIntDigits(num);
-			sprintf(buff, "%s%d%s", DEFAULT_FILENAME, num, ext);
+	if(NULL == cwd){
+		fprintf(stderr, "\nUnable to find the current directory to save the image in.\n");
+		return false;
+	}
+	if(nextImageNumber == 0){
+		nextImageNumber = findHighestImageNumber(cwd) + 1;
+	}
+
+	bool created = false;
+	for(int attempt = 0; attempt < OUTPUT_CREATE_ATTEMPTS && !created; attempt++){
+		char buff[FILENAME_BUFFER_SIZE];
+		if(nextImageNumber == 1){
+			snprintf(buff, sizeof(buff), "%s%s", DEFAULT_FILENAME, IMAGE_EXTENSION);
 		}
-		
-		// Save the filename with the number at the end.
-		sprintf(buff, "%s%d%s", DEFAULT_FILENAME, num, ext);
-		file = path_join(cwd, buff, digits + strlen(DEFAULT_FILENAME) + strlen(ext));
+		else{
+			snprintf(buff, sizeof(buff), "%s%lld%s", DEFAULT_FILENAME, nextImageNumber, IMAGE_EXTENSION);
+		}
+		nextImageNumber++;
+
+		char *file = path_join(cwd, buff, strlen(buff));
+		if(NULL == file){
+			break;
+		}
+		int fd = open(file, O_WRONLY | O_CREAT | O_EXCL, 0666);
+		if(fd >= 0){
+			output->file = fdopen(fd, "wb");
+			snprintf(output->path, sizeof(output->path), "%s", file);
+			created = NULL != output->file;
+			if(!created){
+				// Give the number back instead of leaving an empty image with it behind.
+				close(fd);
+				unlink(file);
+			}
+		}
+		else if(errno != EEXIST){
+			fprintf(stderr, "\nUnable to create %s: %s\n", file, strerror(errno));
+			free(file);
+			break;
+		}
+		free(file);
 	}
-	else{
-		// File with this name does not exist, lets use this name for the new file.
-		sprintf(buff, "%s%s", DEFAULT_FILENAME, ext);
-		file = path_join(cwd, buff, strlen(DEFAULT_FILENAME) + strlen(ext));
+	free(cwd);
+	return created;
+}
+
+/*
+	Open the file the next image should be written to. An image given with -o is written to a temporary file next to it and renamed
+	over it once it is finished, so nothing reading that path ever sees half an image. Without -o a new numbered image is created.
+	Returns false (after saying so) if the file could not be opened.
+*/
+bool openOutputFile(OutputFile *output){
+	output->tempPath[0] = '\0';
+	if(NULL != imageStream){
+		output->file = imageStream;
+		snprintf(output->path, sizeof(output->path), "standard output");
+		return true;
+	}
+	if(NULL == outputPath){
+		return createNumberedOutput(output);
+	}
+
+	snprintf(output->path, sizeof(output->path), "%s", outputPath);
+	if(snprintf(output->tempPath, sizeof(output->tempPath), "%s.XXXXXX", outputPath) >= (int)sizeof(output->tempPath)){
+		fprintf(stderr, "\nOutput path %s is too long.\n", outputPath);
+		return false;
+	}
+	int fd = mkstemp(output->tempPath);
+	if(fd < 0){
+		fprintf(stderr, "\nUnable to open %s for writing: %s\n", outputPath, strerror(errno));
+		return false;
+	}
+
+	// mkstemp() only gives the owner access, give the image the permissions a normal new file would get.
+	fchmod(fd, 0666 & ~fileCreationMask);
+	output->file = fdopen(fd, "wb");
+	if(NULL == output->file){
+		close(fd);
+		unlink(output->tempPath);
+		return false;
+	}
+	return true;
+}
+
+// Finish writing an image opened with openOutputFile(). Written says whether everything before this went fine. If it did the image is
+// moved into place, otherwise the partial file is removed. Returns true if the image was saved.
+bool closeOutputFile(OutputFile *output, bool written){
+	if(output->file == imageStream){
+		return fflush(output->file) == 0 && written;	// Standard output stays open in case there is more to write.
+	}
+	bool saved = fclose(output->file) == 0 && written;
+	if(output->tempPath[0] != '\0'){
+		if(saved && rename(output->tempPath, output->path) != 0){
+			fprintf(stderr, "\nUnable to move the image into place at %s: %s\n", output->path, strerror(errno));
+			saved = false;
+		}
+		if(!saved){
+			unlink(output->tempPath);
+		}
+	}
+	else if(!saved){
+		unlink(output->path);	// Do not leave half an image behind.
+	}
+	output->file = NULL;
+	return saved;
+}
+
+// Keep standard output for the PNG (or the sequence with --decode), and send the progress messages that would normally go there to standard
+// error instead. Only text may go to a terminal. Returns false (after saying why) if standard output cannot be used.
+bool useStdoutForImage(bool text){
+	if(!text && isatty(STDOUT_FILENO)){
+		fprintf(stderr, "Refusing to write a PNG to a terminal, redirect standard output to a file or pipe.\n");
+		return false;
+	}
+	fflush(stdout);
+	int pngFd = dup(STDOUT_FILENO);
+	if(pngFd < 0 || dup2(STDERR_FILENO, STDOUT_FILENO) < 0 || NULL == (imageStream = fdopen(pngFd, "wb"))){
+		fprintf(stderr, "Unable to set up standard output for the image.\n");
+		return false;
+	}
+	return true;
+}
+
+// Make sure an image of width x height bases is no more than maxDimension pixels on either side once it is upscaled by scale. The sizes
+// are compared before they are multiplied, so huge images cannot overflow. Returns false (after saying so) if it is too big.
+bool checkImageSize(long long int width, long long int height, int scale, long long int maxDimension){
+	if(width <= maxDimension / scale && height <= maxDimension / scale){
+		return true;
 	}
+	fprintf(stderr, "\nImage would be %lldx%lld bases at a scale of %d, which is more than the %lld pixels on each side %s allows.\n", width, height, scale, maxDimension,
+		maxDimension == PNG_MAX_DIMENSION ? "PNG" : "a tile pyramid");
+	fprintf(stderr, "Try a smaller scale, a different --width or --aspect%s.\n", maxDimension == PNG_MAX_DIMENSION ? ", or --tiles which can be much bigger" : "");
+	return false;
+}
 
-	// If the filename is NULL for some reason, let the user know, but still try to save saving the image. (Since this might have taken a long time to compute and there is no need to exit for this error.)
-	if(NULL == file){
-		fprintf(stderr, "\nError when making filename, it is NULL. Will attempt saving anyway using filename gene2pic_backupName.png\n");
-		file = "gene2pic_backupName.png";
+// Save the palette image, do not overwrite any previous images.
+void saveImg(u_char *img, long long int width, long long int height, int bitDepth){
+	OutputFile output;
+	if(!openOutputFile(&output)){
+		saveFailed = true;
+		return;
 	}
 
 	// Start the timer and then save the image.
-	struct timespec start, finish;
-	clock_gettime(CLOCK_MONOTONIC, &start);
-	unsigned error = lodepng_encode24_file(file, img, dim, dim);
-	clock_gettime(CLOCK_MONOTONIC, &finish);
+	StageTimer timer;
+	stageTimerStart(&timer);
+
+	// The image is already palette indices, so tell lodepng to write it exactly as it is instead of analysing the colours.
+	LodePNGState state;
+	lodepng_state_init(&state);
+	state.encoder = pngEncoder;
+	u_char *filters = pngFilterPlan(&state.encoder, img, PALETTE_ROW_BYTES(width, bitDepth), height);	// Rows still start on a byte here, like in the PNG.
+
+	// lodepng wants images with less than 8 bits per pixel as one long run of bits, rows do not start on a new byte like they do in the PNG.
+	removeRowPadding(img, width, height, bitDepth);
+	setPaletteColourMode(&state.info_raw, bitDepth);
+	setPaletteColourMode(&state.info_png.color, bitDepth);
+	state.encoder.auto_convert = 0;
+	state.encoder.zlibsettings.custom_zlib = parallelZlibCompress;	// Compress on every thread instead of lodepng's single threaded deflate.
+	state.encoder.text_compression = 0;	// Keep the metadata readable as a plain tEXt chunk.
+	if(imageMetadata[0] != '\0'){
+		lodepng_add_text(&state.info_png, IMAGE_METADATA_KEYWORD, imageMetadata);
+	}
+
+	RestartIndex index;
+	restartIndexInit(&index);
+	state.encoder.zlibsettings.custom_context = &index;	// Filled in by parallelZlibCompress().
+
+	u_char *png = NULL;
+	size_t pngSize = 0;
+	unsigned error = lodepng_encode(&png, &pngSize, img, width, height, &state);
+
+	// lodepng has already written the IEND chunk (the last 12 bytes), the restart index goes in just before it.
+	size_t indexSize;
+	u_char *indexData = restartIndexEncode(&index, &indexSize);
+	u_char *indexChunk = NULL;
+	size_t indexChunkSize = 0;
+	error = error ? error : NULL == indexData ? 83 : lodepng_chunk_create(&indexChunk, &indexChunkSize, indexSize, RESTART_INDEX_CHUNK_TYPE, indexData);	// (83 is lodepng's out of memory error.)
+	bool written = !error && fwrite(png, 1, pngSize - 12, output.file) == pngSize - 12 && fwrite(indexChunk, 1, indexChunkSize, output.file) == indexChunkSize
+		&& fwrite(png + pngSize - 12, 1, 12, output.file) == 12;
+	bool saved = closeOutputFile(&output, written);
+	pngSize += indexChunkSize;
+	free(png);
+	free(indexData);
+	free(indexChunk);
+	restartIndexFree(&index);
+	free(filters);
+	lodepng_state_cleanup(&state);
+	double secs = runStatsAddStage(&runStats, "save", &timer, PALETTE_ROW_BYTES(width, bitDepth) * height, pngSize, runStats.bases);
+	runStatsSetOutput(&runStats, output.path);
 
 	// See if there was an issue when saving the image.
 	if(error){
 		fprintf(stderr, "\nUnable to save the image, lodepng returned an error.\nError %u: %s\n", error, lodepng_error_text(error));
 	}
+	else if(!saved){
+		fprintf(stderr, "\nUnable to save the image, writing to %s failed.\n", output.path);
+	}
 	else{
-		printf("Saved to %s (%f secs)\n\n", file, getElapsedTime(start, finish));
+		progress("Saved to %s (%f secs)\n\n", output.path, secs);
 	}
+	saveFailed |= !saved;
 }
 
-// Assign each base in the sequence a coloured pixel in the image.
-void base2colour(const char *gene, long long int dim, long long int len, int scale, bool serpentineLastRowFlip){
-	printf("\nStart assigning bases to colours...\n");
-	// Corresponding pixel values for each base colour. (You can change these in the header file.)
-	u_char baseColour[4][3] = {
-		CYTOSINE_COLOUR,
-		GUANINE_COLOUR,
-		ADENINE_COLOUR,
-		THYMINE_COLOUR
-	};
+/*
+	Save the palette image upscaled by scale, do not overwrite any previous images. The upscaled image is never held in memory, each
+	upscaled row is made from the 1:1 image just before it is needed. The first copy of each row is written with filter type None, and the
+	scale - 1 copies under it cost almost nothing to compress: they are either the same bytes again (one long match) or, when the row is
+	too long for deflate to look back to, filter type Up (difference from the row above) which makes them all zeros.
+*/
+void saveUpscaledImg(const u_char *img, long long int width, long long int height, int scale, int bitDepth){
+	if(!checkImageSize(width, height, scale, PNG_MAX_DIMENSION)){
+		saveFailed = true;
+		return;
+	}
+	long long int scaledWidth = width * (long long int)scale;	// Dimmensions of the upscaled image.
+	long long int scaledHeight = height * (long long int)scale;
+	long long int rowBytes = PALETTE_ROW_BYTES(width, bitDepth);
+	long long int scaledRowBytes = PALETTE_ROW_BYTES(scaledWidth, bitDepth);
 
-	// Hold all the colour values which will then be turned into an image. No need to zero, will be completely overwritten.
-	u_char *img = (u_char *)malloc(dim * dim * (long long int)3 * sizeof(u_char));
-	if(NULL == img){
-		fprintf(stderr, "Unable to allocate img array... May have run out of RAM.\n");
-		exit(EXIT_FAILURE);
+	u_char *scaledRow = (u_char *)malloc(scaledRowBytes * sizeof(u_char));
+	u_char *repeatRow = (u_char *)calloc(scaledRowBytes, sizeof(u_char));	// An Up filtered copy of the row above is all zeros.
+	if(NULL == scaledRow || NULL == repeatRow){
+		fprintf(stderr, "Unable to allocate upscaled row buffers... May have run out of RAM.\n");
+		free(scaledRow);
+		free(repeatRow);
+		saveFailed = true;
+		return;
 	}
 
-	// Time how long it takes to go through all the bases.
-	struct timespec start, finish;
-	clock_gettime(CLOCK_MONOTONIC, &start);
+	OutputFile output;
+	if(!openOutputFile(&output)){
+		free(scaledRow);
+		free(repeatRow);
+		saveFailed = true;
+		return;
+	}
 
-	// long long int diff = len % dim;	// Number of bases on the incomplete row of the image.
+	// Start the timer and then save the image.
+	StageTimer timer;
+	stageTimerStart(&timer);
 
-	// Branchlessly assign the proper colours to each base. Done using multiprocessing to speed it up.
-	#pragma omp parallel for
-	for(long long int i = 0; i < len; i++){
-		// Since we already removed all invalid characters at the start, we only actually need to test for 3 base pairs.
-		u_int8_t baseId = 0;	// Default to cytosine.
-		// baseId += ((gene[i] == 'C') ? 0 : 0);	// Cytosine	(Commented because we only need to check for 3 base pairs since we know all bases are valid, speeds up colour assignment.)
-		baseId += ((gene[i] == 'G') ? 1 : 0);		// Guanine
-		baseId += ((gene[i] == 'A') ? 2 : 0);		// Adenine
-		baseId += ((gene[i] == 'T') ? 3 : 0);		// Thymine
-		
-		// Assign the colour to this pixel.
-		img[(long long int)3 * i] = baseColour[baseId][0];						// R
-		img[(long long int)3 * i + (long long int)1] = baseColour[baseId][1];	// G
-		img[(long long int)3 * i + (long long int)2] = baseColour[baseId][2];	// B
+	PngWriter writer;
+	pngWriterOpen(&writer, output.file, scaledWidth, scaledHeight, LCT_PALETTE, bitDepth, &paletteColours[0][0], PALETTE_SIZE, &pngEncoder.zlibsettings);
+	if(imageMetadata[0] != '\0'){
+		pngWriterWriteText(&writer, IMAGE_METADATA_KEYWORD, imageMetadata);
 	}
-	
-	// Number of bases does not fit perfectly into the image, will be blank spots we need to zero and fill out the incomplete row.
-	if(len < dim * dim){
-		// Make sure the pixels we did not overwrite at the end are zeroed (Prevents garbage from memory from sneaking into the image). (Not enough for multithreading to make sense).
-		for(long long int i = 0; i < (dim * dim) - len; i++){
-			img[(long long int)3 * (len + i)] = 0;						// R
-			img[(long long int)3 * (len + i) + (long long int)1] = 0;	// G
-			img[(long long int)3 * (len + i) + (long long int)2] = 0;	// B
-		}
-	}
-
-	// If serpentine mode was selected and we previously detected that the last row is partially completed and it needs to be flipped, then handle the flipping of the last row here.
-	// (Cannot do it earlier in program because the geneSequence array does not have characters at these blank positions.)
-	if(serpentineLastRowFlip){
-		long long int filledRows = len / dim;	// Number of rows which have been completely filled previously. (Tells us which row is the partially completed one and it is not necessarily the last row in the image.)
-		// Swap the pixels from one half of this row with the ones in the other half making sure to place them in the right places so the row is flipped.
-		for(long long int j = 0; j < dim / (long long int)2; j++){
-			// Copy the data for the pixel we are about to overwrite so that we can swap it later.
-			u_char tmpR = img[(filledRows * dim + j) * (long long int)3];						// R
-			u_char tmpG = img[(filledRows * dim + j) * (long long int)3 + (long long int)1];	// G
-			u_char tmpB = img[(filledRows * dim + j) * (long long int)3 + (long long int)2];	// B
-			
-			// Overwrite the pixel we just made a temporary copy of with the one in the corresponding position in the other half of the row.
-			img[(filledRows * dim + j) * (long long int)3] = img[(filledRows * dim + dim - (long long int)1 - j) * 3];														// R
-			img[(filledRows * dim + j) * (long long int)3 + (long long int)1] = img[(filledRows * dim + dim - (long long int)1 - j) * (long long int)3 + (long long int)1];	// G
-			img[(filledRows * dim + j) * (long long int)3 + (long long int)2] = img[(filledRows * dim + dim - (long long int)1 - j) * (long long int)3 + (long long int)2];	// B
-			
-			// Overwrite the pixel we just copied from with the temporary copy of the pixel it overwrote.
-			img[(filledRows * dim + dim - (long long int)1 - j) * (long long int)3] = tmpR;						// R
-			img[(filledRows * dim + dim - (long long int)1 - j) * (long long int)3 + (long long int)1] = tmpG;	// G
-			img[(filledRows * dim + dim - (long long int)1 - j) * (long long int)3 + (long long int)2] = tmpB;	// B
+	u_char repeatFilter = pngRepeatRowFilter(&pngEncoder.zlibsettings, scaledRowBytes);
+	for(long long int y = 0; y < height; y++){
+		upscaleNN_IndexedRow(img + y * rowBytes, scaledRow, width, scale, bitDepth);
+		pngWriterWriteRow(&writer, PNG_FILTER_NONE, scaledRow);
+		for(int k = 1; k < scale; k++){
+			pngWriterWriteRow(&writer, repeatFilter, repeatFilter == PNG_FILTER_UP ? repeatRow : scaledRow);
 		}
 	}
+	bool saved = closeOutputFile(&output, pngWriterClose(&writer));
+	double secs = runStatsAddStage(&runStats, "upscale_save", &timer, rowBytes * height, writer.bytesWritten, runStats.bases);
+	runStatsSetOutput(&runStats, output.path);
 
-	// Stop the clock, we finished assigning colours to bases.
-	clock_gettime(CLOCK_MONOTONIC, &finish);
-	printf("Finished assigning colours to bases.\t(%f secs)\n", getElapsedTime(start, finish));
-
-	// See if we should upscale the image.
-	if(scale > 1){
-		// We want to upscale the image.
-		printf("\nStart upscaling the image...\n");
-		
-		// Allocate memory for the upscaled image.
-		long long int scaledDim = dim * (long long int)scale;	// Dimmension of the upscaled image.
-		u_char *upscaledImg = (u_char *)malloc(scaledDim * scaledDim * (long long int)3 * sizeof(u_char));
-		if(NULL == upscaledImg){
-			fprintf(stderr, "Unable to allocate upscaledImg array... May have run out of RAM.\n");
-			exit(EXIT_FAILURE);
-		}
-		
-		clock_gettime(CLOCK_MONOTONIC, &start);	// Start the timer.
-		
-		upscaleNN_RGB(img, upscaledImg, dim, dim, scale);	// Upscale the original image.
-		
-		clock_gettime(CLOCK_MONOTONIC, &finish);	// Stop the timer.
-		printf("Finished upscaling the image.\t\t(%f secs)\n", getElapsedTime(start, finish));
-
-		free(img);	// Free the original unscaled image.
-		
-		printf("\nStart saving the image...\n");
-		saveImg(upscaledImg, scaledDim);	// Save the array as an image.
-		free(upscaledImg);	// Free the upscaled image.
+	// See if there was an issue when saving the image.
+	if(!saved){
+		fprintf(stderr, "\nUnable to save the image, writing to %s failed.\n", output.path);
+		saveFailed = true;
 	}
 	else{
-		// We do not want to upscale the image. Save the 1:1 image.
-		printf("\nStart saving the image...\n");
-		saveImg(img, dim);	// Save the array as an image.
-		free(img);	// Free the image.
+		progress("Saved to %s (%f secs)\n\n", output.path, secs);
 	}
+	free(scaledRow);
+	free(repeatRow);
 }
 
-/* Flips every other row so that instead of:
-	1->2->3
-	<------
-	4->5->6
-	<------
-	7->8->9
-
-	It does:
-	1->2->3
-		  |
-	6<-5<-4
-	|
-	7->8->9
-
-	This may be a more natural way to view the sequence since if you were to lay out the DNA strand using the
-	non-serpentine method it would require you to snip the strand every time you want to go to a new row in the image.
-	This way if you were to draw it out on paper, you could traverse the whole sequence without ever taking your pencil
-	off the paper. 
+// Set up a lodepng colour mode for our palette (the 4 base colours followed by the colour of blank pixels) at the given bit depth.
+void setPaletteColourMode(LodePNGColorMode *mode, int bitDepth){
+	mode->colortype = LCT_PALETTE;
+	mode->bitdepth = bitDepth;
+	lodepng_palette_clear(mode);
+	for(int i = 0; i < PALETTE_SIZE; i++){
+		lodepng_palette_add(mode, paletteColours[i][0], paletteColours[i][1], paletteColours[i][2], 255);
+	}
+}
 
-	Unfortunately I need to wait until later in the program to flip the incomplete row, since the gene sequence char array
-	does not have a character I can use to indicate it is blank. Adding one would get rid of the sneaky trick which lets
-	me only check 3 bases instead of 4 in base2colour().
+// Pick the smallest palette bit depth for the image. The 4 bases fit in 2 bits, but if there are any blank pixels black needs a 5th entry.
+int paletteBitDepth(long long int len, long long int pixels){
+	return len < pixels ? 4 : 2;
+}
 
-	Returns a boolean which indicates whether or not base2colour() needs to flip the incomplete row.
-*/
-bool applySerpentine(char *geneSequence, long long int dim, long long int len){
-	printf("\nStart applying serpentine pattern to sequence...\n");
-	long long int filledRows = len/dim;	// Number of rows which can be completely filled. Excludes the incomplete row near the end if it exists, that is handled in base2colour().
+// Pack count palette indices (one per byte) into a row of the image at the given bit depth, first pixel in the most significant bits.
+void packIndexRow(const u_int8_t *indices, long long int count, int bitDepth, u_char *row){
+	int pixelsPerByte = 8 / bitDepth;
+	long long int fullBytes = count / pixelsPerByte;
+	if(bitDepth == 2){
+		for(long long int i = 0; i < fullBytes; i++){
+			const u_int8_t *four = indices + i * 4;
+			row[i] = (four[0] << 6) | (four[1] << 4) | (four[2] << 2) | four[3];
+		}
+	}
+	else{
+		for(long long int i = 0; i < fullBytes; i++){
+			row[i] = (indices[i * 2] << 4) | indices[i * 2 + 1];
+		}
+	}
+	// The last byte may only be partly used, the rest of it is left as zeros.
+	if(fullBytes * pixelsPerByte < count){
+		u_char last = 0;
+		for(long long int i = fullBytes * pixelsPerByte; i < count; i++){
+			last |= indices[i] << (8 - bitDepth * (int)(i % pixelsPerByte + 1));
+		}
+		row[fullBytes] = last;
+	}
+}
 
-	// Start the timer.
-	struct timespec start, finish;
-	clock_gettime(CLOCK_MONOTONIC, &start);
+// Set pixel x of a palette image row to the given palette index.
+void setPalettePixel(u_char *row, long long int x, int bitDepth, u_int8_t index){
+	int pixelsPerByte = 8 / bitDepth;
+	int shift = 8 - bitDepth * (int)(x % pixelsPerByte + 1);
+	u_char *byte = &row[x / pixelsPerByte];
+	*byte = (*byte & ~(((1 << bitDepth) - 1) << shift)) | (index << shift);
+}
 
-	// For every second row, flip it so the bases at the start are the ones at the end and vice versa. Use multi-processing because why not.
+// Number of bases before each tile of a curve covering a width x height image, plus one more entry at the end with the total. Cells
+// outside the image do not use up a base. The caller frees the array. Returns NULL (after saying so) if memory cannot be allocated.
+long long int *curveTileStarts(const CurveTable *table, long long int width, long long int height){
+	long long int tileSize = 1LL << table->tileBits;
+	long long int *tileStart = (long long int *)malloc((table->numTiles + 1) * sizeof(long long int));
+	if(NULL == tileStart){
+		fprintf(stderr, "Unable to allocate curve tile array... May have run out of RAM.\n");
+		return NULL;
+	}
 	#pragma omp parallel for
-	for(long long int i = 1; i < filledRows; i+=2){
-		for(long long int j = 0; j < dim / (long long int)2; j++){
-			char tmp = geneSequence[i * dim + j];
-			geneSequence[i * dim + j] = geneSequence[i*dim + dim - (long long int)1 - j];
-			geneSequence[i * dim + dim - (long long int)1 - j] = tmp;
-		}
+	for(long long int tile = 0; tile < (long long int)table->numTiles; tile++){
+		u_int32_t originX, originY;
+		const u_int16_t *cells;
+		curveTile(table, tile, &originX, &originY, &cells);
+		long long int cellsX = width - originX < tileSize ? width - originX : tileSize;
+		long long int cellsY = height - originY < tileSize ? height - originY : tileSize;
+		tileStart[tile + 1] = cellsX > 0 && cellsY > 0 ? cellsX * cellsY : 0;
 	}
+	tileStart[0] = 0;
+	for(u_int64_t tile = 0; tile < table->numTiles; tile++){
+		tileStart[tile + 1] += tileStart[tile];
+	}
+	return tileStart;
+}
 
-	// Stop the timer.
-	clock_gettime(CLOCK_MONOTONIC, &finish);
-	printf("Finished applying serpentine.\t\t(%f secs)\n", getElapsedTime(start, finish));
-	
-	// Figure out if we need to ask base2colour() to flip the incomplete row (if it exists).
-	if((filledRows)%2 != 0){
-		// Incomplete row is on an uneven row index.
-		if(len%dim != 0){
-			// Incomplete row is actually incomplete and does have blank spots.
-			return true;
-		}
+// Set up the curve squares covering a width x height image. Returns false (after saying so) if memory cannot be allocated.
+bool curveLayoutInit(CurveLayout *layout, CurveType type, long long int width, long long int height){
+	memset(layout, 0, sizeof(CurveLayout));
+	layout->width = width;
+	layout->height = height;
+	layout->vertical = height > width;
+	long long int shortSide = layout->vertical ? width : height;
+	long long int longSide = layout->vertical ? height : width;
+
+	// Transposing the squares which go down the image keeps a Hilbert curve's end right next to the start of the next square.
+	curveTableInit(&layout->curve, type, shortSide, layout->vertical);
+	layout->squareSide = 1LL << layout->curve.order;
+	layout->numSquares = (longSide + layout->squareSide - 1) / layout->squareSide;
+	layout->numTiles = layout->numSquares * layout->curve.numTiles;
+
+	// Every square is cut to the shorter side of the image, and the last one is also cut short by the end of the image.
+	long long int lastLength = longSide - (layout->numSquares - 1) * layout->squareSide;
+	layout->tileStarts = curveTileStarts(&layout->curve, layout->vertical ? width : layout->squareSide, layout->vertical ? layout->squareSide : height);
+	layout->lastTileStarts = curveTileStarts(&layout->curve, layout->vertical ? width : lastLength, layout->vertical ? lastLength : height);
+	if(NULL == layout->tileStarts || NULL == layout->lastTileStarts){
+		curveLayoutFree(layout);
+		return false;
 	}
-	return false;
+	layout->squareBases = layout->tileStarts[layout->curve.numTiles];
+	return true;
 }
 
-// Read in the data from the sequence file and ignore any characters that are not ATCGU (upper or lowercase). Also convert lowercase to uppercase.
-long long int readAndValidateInput(char *geneSequence, FILE *geneFile, long long int len){
-	printf("Start validation of input sequence...\n");
-	// Length of the valid gene sequence.
-	long long int validBaseCount = 0;
+// Free the curve squares.
+void curveLayoutFree(CurveLayout *layout){
+	free(layout->tileStarts);
+	free(layout->lastTileStarts);
+	layout->tileStarts = NULL;
+	layout->lastTileStarts = NULL;
+	curveTableFree(&layout->curve);
+}
 
-	// Initialize and start the timer.
-	struct timespec start, finish;
-	clock_gettime(CLOCK_MONOTONIC, &start);
-	
-	// Read the entire sequence all at once into the geneSequence array. (Slightly faster than reading one letter at a time.) 
-	fread(geneSequence, sizeof(char), len, geneFile);
+// Find curve tile number tile over all the squares. Gives its top left corner in the image, the positions of its cells (relative to that
+// corner) in curve order and the number of bases before it. Returns the number of its cells which are inside the image.
+long long int curveLayoutTile(const CurveLayout *layout, u_int64_t tile, long long int *originX, long long int *originY, const u_int16_t **cells, long long int *base){
+	long long int square = tile / layout->curve.numTiles;
+	u_int64_t squareTile = tile % layout->curve.numTiles;
+	u_int32_t squareX, squareY;
+	curveTile(&layout->curve, squareTile, &squareX, &squareY, cells);
+	*originX = squareX + (layout->vertical ? 0 : square * layout->squareSide);
+	*originY = squareY + (layout->vertical ? square * layout->squareSide : 0);
+	const long long int *tileStart = square == layout->numSquares - 1 ? layout->lastTileStarts : layout->tileStarts;
+	*base = square * layout->squareBases + tileStart[squareTile];
+	return tileStart[squareTile + 1] - tileStart[squareTile];
+}
 
-	// Remove any invalid characters from the sequence.
-	// Cannot be multithreaded without using mutex when writing to the geneSequence array and incrementing validBaseCount, which slows it down even more.
-	// So I'm leaving this single threaded since it is already pretty damn fast.
-	for(long long int i = 0; i < len; i++){
-		// Make a copy of the letter and change it to it's ordinal form so we can do math on it.
-		u_int8_t normLetter = (u_int8_t)geneSequence[i];
-		
-		// Branchlessly convert the letter to uppercase.
-		normLetter -= 32 * (normLetter >= 'a' && normLetter <= 'z');
+// Find the curve tiles firstTile to endTile - 1 of the squares holding bases start to end - 1, so a region does not have to look at every tile.
+void curveLayoutTileRange(const CurveLayout *layout, long long int start, long long int end, u_int64_t *firstTile, u_int64_t *endTile){
+	long long int lastSquare = (end - 1) / layout->squareBases;
+	lastSquare = lastSquare < layout->numSquares - 1 ? lastSquare : layout->numSquares - 1;
+	*firstTile = (start / layout->squareBases) * layout->curve.numTiles;
+	*endTile = (lastSquare + 1) * layout->curve.numTiles;
+}
 
-		// Treat Uracil (U) as if it is Thymine (T) by subracting 1 from the ordinal value. (84 = T, 85 = U)
-		normLetter -= normLetter == 'U' ? 1 : 0;
+/*
+	Lay the bases out along a Hilbert or Morton curve instead of row by row. The image is covered by curve squares (see CurveLayout) and
+	cells of a square which fall outside the image are skipped, so the bases still fill the image from the start of the first square with
+	the blank pixels at the end.
 
-		// Determine if the current letter is a valid character. (This commented one is slower despite the fact it stops early when the letter is found. Intuitively I'd think this would have been faster.)
-		// normLetter == 'C' ? geneSequence[validBaseCount++] = (char)normLetter : normLetter == 'G' ? geneSequence[validBaseCount++] = (char)normLetter :  normLetter == 'A' ? geneSequence[validBaseCount++] = (char)normLetter : normLetter == 'T' ? geneSequence[validBaseCount++] = (char)normLetter : 0;
-		u_int8_t isValid = 0;
-		isValid += normLetter == 'C' ? 1 : 0;
-		isValid += normLetter == 'G' ? 1 : 0;
-		isValid += normLetter == 'A' ? 1 : 0;
-		isValid += normLetter == 'T' ? 1 : 0;
-		isValid ? geneSequence[validBaseCount++] = (char)normLetter : 0; // If base is valid, then add it to the sequence and then increment the length counter.
+	The curve is handled one tile at a time (see SpaceFillingCurve.h). How many of a tile's cells are inside the image only depends on
+	where the tile is, so a prefix sum over those counts tells every tile which base it starts at and all the tiles can be filled at
+	once. Tiles start on a multiple of their width, so as long as they are at least 4 pixels wide (or each one has rows of its own) two
+	threads never write to the same byte. Returns false (after saying so) if memory cannot be allocated.
+*/
+bool layoutAlongCurve(const u_char *packedSequence, long long int width, long long int height, long long int len, CurveType type, u_char *img, long long int rowBytes, int bitDepth){
+	CurveLayout layout;
+	if(!curveLayoutInit(&layout, type, width, height)){
+		return false;
 	}
+	long long int tileCells = 1LL << (2 * layout.curve.tileBits);
 
-	// Stop the timer and figure out how long it took to read in and validate all the bases.
-	clock_gettime(CLOCK_MONOTONIC, &finish);
-	printf("Valid input sequence is %lld bases.\t(%f secs)\n", validBaseCount, getElapsedTime(start, finish));
+	// Fill in the tiles. Cells outside the image are skipped without using up a base.
+	#pragma omp parallel for schedule(dynamic, 16) if(layout.vertical || layout.curve.tileBits >= 2)
+	for(long long int tile = 0; tile < (long long int)layout.numTiles; tile++){
+		long long int originX, originY, base;
+		const u_int16_t *cells;
+		if(curveLayoutTile(&layout, tile, &originX, &originY, &cells, &base) == 0){
+			continue;	// Whole tile is outside the image.
+		}
+		for(long long int i = 0; i < tileCells; i++){
+			long long int x = originX + (cells[i] & 0xFF);
+			long long int y = originY + (cells[i] >> 8);
+			if(x >= width || y >= height){
+				continue;
+			}
+			u_int8_t index = base < len ? getPackedBase(packedSequence, base) : BLANK_INDEX;
+			setPalettePixel(img + y * rowBytes, x, bitDepth, index);
+			base++;
+		}
+	}
+	curveLayoutFree(&layout);
+	return true;
+}
 
-	// Close the input file, we are done with it now.
-	fclose(geneFile);
-	
-	return validBaseCount;
+// Slide the rows of a palette image together (in place) so there are no unused bits at the end of each row. This is the layout lodepng expects.
+void removeRowPadding(u_char *img, long long int width, long long int height, int bitDepth){
+	long long int rowBits = width * bitDepth;
+	long long int rowBytes = PALETTE_ROW_BYTES(width, bitDepth);
+	if(rowBits % 8 == 0){
+		return;	// Rows already end on a byte boundary.
+	}
+	// Every row moves towards the start of the image, so working forwards never overwrites anything that has not been moved yet.
+	for(long long int y = 1; y < height; y++){
+		const u_char *src = img + y * rowBytes;
+		u_char *dst = img + y * rowBits / 8;
+		int shift = (int)(y * rowBits % 8);	// Bits of the previous row already in the first byte.
+		if(shift == 0){
+			memmove(dst, src, rowBytes);
+			continue;
+		}
+		dst[0] = (dst[0] & (u_char)(0xFF << (8 - shift))) | (src[0] >> shift);
+		for(long long int b = 1; b < rowBytes; b++){
+			dst[b] = (u_char)(src[b - 1] << (8 - shift)) | (src[b] >> shift);
+		}
+		dst[rowBytes] = (u_char)(src[rowBytes - 1] << (8 - shift));
+	}
 }
 
-// Main function, responsible for parsing the commandline arguments, opening the text file then coordinating other functions.
-int main(int argc, char *argv[]){
-	int scale = SCALE_HARDCODED;
-	bool serpentine = SERPENTINE_HARDCODED;
-	char *inputFile = INPUT_FILE_HARDCODED;
+/*
+	Write the palette index of every base into a width x height rectangle of a palette image, in the order given by layout, with blank
+	pixels after the last base. img points at the top left byte of the rectangle and rowBytes is the length of a row of the whole image,
+	so the rectangle can be one tile of a bigger image as long as it starts on a byte. Returns false (after saying so) if memory cannot be allocated.
+*/
+bool layoutBases(const u_char *packedSequence, long long int width, long long int height, long long int len, Layout layout, bool serpentineLastRowFlip, u_char *img, long long int rowBytes, int bitDepth){
+	if(layout == LAYOUT_HILBERT || layout == LAYOUT_MORTON){
+		// Space filling curves visit the pixels in their own order.
+		return layoutAlongCurve(packedSequence, width, height, len, layout == LAYOUT_HILBERT ? CURVE_HILBERT : CURVE_MORTON, img, rowBytes, bitDepth);
+	}
+	long long int filledRows = len / width;	// Number of rows which have been completely filled. (Tells us which row is the partially completed one, if there is one.)
+	long long int pixelsPerByte = 8 / bitDepth;
+	long long int paddedWidth = (width + pixelsPerByte - 1) / pixelsPerByte * pixelsPerByte;	// Rows are packed a whole byte at a time.
 
-	// See if we should check the commandline arguments or use hardcoded ones instead.
-	if(!USE_HARDCODED_ARGS){
-		if(argc < 2 || argc > 4){
-			fprintf(stderr, "Incorrect number of arguments!\nAvailable usage modes:\n./gene2pic <INPUT_FILE>\n./gene2pic <INPUT_FILE> <SCALE>\n./gene2pic <INPUT_FILE> <SERPENTINE>\n./gene2pic <INPUT_FILE> <SERPENTINE> <SCALE>\n");
-			return EXIT_FAILURE;
+	// Build each row of the image. Done using multiprocessing to speed it up.
+	bool failed = false;
+	#pragma omp parallel
+	{
+		u_int8_t *rowIndices = (u_int8_t *)malloc(paddedWidth * sizeof(u_int8_t));
+		if(NULL == rowIndices){
+			fprintf(stderr, "Unable to allocate row buffer... May have run out of RAM.\n");
+			#pragma omp atomic write
+			failed = true;
 		}
-		else if(argc == 3){
-			// Only 2 arguments provided. Input file is first one and scale or serpentine is second. Find out which it is.
-
-			char *temp;
-			long value = strtol(argv[2], &temp, 10);
-			if(temp != argv[2] && *temp == '\0'){
-				// Argument is a number, so it is specifying a scale.
-				scale = (int)value;
-			}
-			else if(strcmp(argv[2], "serpentine") == 0 || strcmp(argv[2], "SERPENTINE") == 0){
-				// Argument matches the serpentine string, so enable serpentine mode.
-				serpentine = true;
-			}
-			else{
-				// Argument matches neither scale or serpentine, inform user.
-				fprintf(stderr, "Invalid data in last argument.\nFor serpentine it must be \"serpentine\" or be blank, and for scale it must be a non-zero integer.\nUsage: ./gene2pic <INPUT_FILE> <SERPENTINE> <SCALE>\n");
-				return EXIT_FAILURE;
-			}
+		else{
+			// The unused end of each row's last byte is blank, it may be the gap beside a record tile. (2 bit images have no blank pixels.)
+			memset(rowIndices + width, bitDepth == 2 ? 0 : BLANK_INDEX, paddedWidth - width);
 		}
-		else if(argc == 4){
-			// 3 arguments provided. Make sure they are in the right order and have acceptable values.
 
-			if(strcmp(argv[2], "serpentine") == 0 || strcmp(argv[2], "SERPENTINE") == 0){
-				// Argument matches the serpentine string, so enable serpentine mode.
-				serpentine = true;
-			}
-			else{
-				fprintf(stderr, "Invalid data for serpentine argument. Must be \"serpentine\" or left empty.\nUsage: ./gene2pic <INPUT_FILE> <SERPENTINE> <SCALE>\n");
-				return EXIT_FAILURE;
+		#pragma omp for
+		for(long long int y = 0; y < height; y++){
+			if(NULL == rowIndices){
+				continue;	// The image will not be saved anyway, the other threads finish the loop.
 			}
+			long long int rowStart = y * width;
+			long long int rowLen = len - rowStart < 0 ? 0 : len - rowStart < width ? len - rowStart : width;	// Bases in this row.
+			unpackBases(packedSequence, rowStart, rowLen, rowIndices);
+			memset(rowIndices + rowLen, BLANK_INDEX, width - rowLen);
 
-			char *temp;
-			long value = strtol(argv[3], &temp, 10);
-			if(temp != argv[3] && *temp == '\0'){
-				// Argument is a number, so it is specifying a scale.
-				scale = (int)value;
-			}
-			else{
-				fprintf(stderr, "Invalid data in scale argument. Must be a non-zero integer.\nUsage: ./gene2pic <INPUT_FILE> <SERPENTINE> <SCALE>\n");
-				return EXIT_FAILURE;
+			// If serpentine mode was selected and applySerpentine() told us the incomplete row needs flipping, flip it here now that it has its blank pixels.
+			if(serpentineLastRowFlip && y == filledRows){
+				for(long long int j = 0; j < width / (long long int)2; j++){
+					u_int8_t tmp = rowIndices[j];
+					rowIndices[j] = rowIndices[width - (long long int)1 - j];
+					rowIndices[width - (long long int)1 - j] = tmp;
+				}
 			}
+			packIndexRow(rowIndices, paddedWidth, bitDepth, img + y * rowBytes);
 		}
+		free(rowIndices);
+	}
+	return !failed;
+}
 
-		// Make sure scale is not an invalid value.
-		if(scale < 1){
-			fprintf(stderr, "Invalid data in scale argument. Must be a non-zero integer.\nUsage: ./gene2pic <INPUT_FILE> <SERPENTINE> <SCALE>\n");
-			return EXIT_FAILURE;
-		}
-		inputFile = argv[1];	// Read the filename from the user input.
+// Save a finished palette image, upscaling it on the way out if scale is more than 1. Frees the image.
+void savePaletteImage(u_char *img, long long int width, long long int height, int scale, int bitDepth){
+	// lodepng would overflow working out the size of a very big image, so those are written a row at a time like the upscaled ones.
+	if(scale == 1 && (width * bitDepth > LODEPNG_MAX_RAW_SIZE || height * (PALETTE_ROW_BYTES(width, bitDepth) + 1) > LODEPNG_MAX_RAW_SIZE)){
+		progress("\nStart saving the image a row at a time...\n");
+		saveUpscaledImg(img, width, height, 1, bitDepth);
+		free(img);
+	}
+	// See if we should upscale the image.
+	else if(scale > 1){
+		// We want to upscale the image. The upscaled image is never built, its rows are made one at a time while it is being saved.
+		progress("\nStart upscaling and saving the image...\n");
+		saveUpscaledImg(img, width, height, scale, bitDepth);
+		free(img);	// Free the original unscaled image.
 	}
+	else{
+		// We do not want to upscale the image. Save the 1:1 image.
+		progress("\nStart saving the image...\n");
+		saveImg(img, width, height, bitDepth);	// Save the array as an image.
+		free(img);	// Free the image.
+	}
+}
 
-	// Start timer to see how long the whole program takes.
-	struct timespec start, finish;
-	clock_gettime(CLOCK_MONOTONIC, &start);
+// Assign each base in the sequence a colour from the palette, giving a palette image with one pixel per base.
+void base2colour(const u_char *packedSequence, long long int width, long long int height, long long int len, int scale, Layout layout, bool serpentineLastRowFlip){
+	progress("\nStart assigning bases to colours...\n");
 
-	FILE *geneFile = fopen(inputFile, "r");	// Get the file, open with read permissions.
-	if(geneFile == (FILE *) NULL){
-		// Error when opening the file or the file was not found.
-		fprintf(stderr,"File %s not found!\n", inputFile);
-		return EXIT_FAILURE;
+	// The palette indices are the 2 bit base codes, so each row just needs the codes copied out of the packed sequence (with blank pixels
+	// added after the last base). No RGB is ever built, which keeps the image up to 12x smaller.
+	int bitDepth = paletteBitDepth(len, width * height);
+	long long int rowBytes = PALETTE_ROW_BYTES(width, bitDepth);
+	u_char *img = (u_char *)malloc(rowBytes * height * sizeof(u_char));
+	if(NULL == img){
+		fprintf(stderr, "Unable to allocate img array... May have run out of RAM.\n");
+		saveFailed = true;
+		return;
+	}
+
+	// Time how long it takes to go through all the bases.
+	StageTimer timer;
+	stageTimerStart(&timer);
+	if(!layoutBases(packedSequence, width, height, len, layout, serpentineLastRowFlip, img, rowBytes, bitDepth)){
+		free(img);
+		saveFailed = true;
+		return;
 	}
 
-	// Find the length of the file (including invalid characters).
-	long long int len = getFileLen(geneFile);
-	printf("Input file is %lld characters.\n\n", len);
+	// Stop the clock, we finished assigning colours to bases.
+	double secs = runStatsAddStage(&runStats, "colour", &timer, PACKED_SEQUENCE_BYTES(len), rowBytes * height, len);
+	progress("Finished assigning colours to bases.\t(%f secs)\n", secs);
+	savePaletteImage(img, width, height, scale, bitDepth);
+}
 
-	// Place to hold the sequence in memory.
-	char *geneSequence = (char *)malloc(len * sizeof(char));
-	if(NULL == geneSequence){
-		fprintf(stderr,"Unable to allocate geneSequence array. May have run out of RAM.");
-		return EXIT_FAILURE;
+/*
+	Lay every record of a multi-record file out in its own tile of one image. All the tiles are the size of the image the longest record
+	would get on its own (rounded up so every tile starts on a byte), and the tiles are placed left to right, top to bottom in a square
+	grid. Each record starts at the top left of its tile and uses the chosen layout inside it. With a fixed --width the records keep that
+	width and the rounding is left as a blank gap between the tiles.
+*/
+void renderTiles(const u_char *packedSequence, const FastaParser *parser, const RenderOptions *options){
+	long long int longest = 0;
+	for(long long int i = 0; i < parser->numRecords; i++){
+		longest = parser->records[i].len > longest ? parser->records[i].len : longest;
+	}
+	long long int tileWidth, tileHeight;
+	findImageSize(longest, options, &tileWidth, &tileHeight);
+	long long int tileSpacing = (tileWidth + TILE_ALIGNMENT - 1) / TILE_ALIGNMENT * TILE_ALIGNMENT;	// Distance from one tile to the next.
+	if(options->width == 0){
+		tileWidth = tileSpacing;
+		tileHeight = (tileHeight + TILE_ALIGNMENT - 1) / TILE_ALIGNMENT * TILE_ALIGNMENT;
+	}
+	long long int gridDim = findSquareSize(parser->numRecords);	// Tiles on each side of the grid.
+	long long int width = gridDim * tileSpacing;
+	long long int height = gridDim * tileHeight;
+	if(!checkImageSize(width, height, options->scale, PNG_MAX_DIMENSION)){
+		saveFailed = true;
+		return;
 	}
+	runStats.width = width * (long long int)options->scale;
+	runStats.height = height * (long long int)options->scale;
 
-	// Remove any invalid characters from the input sequence and determine how many valid bases there are.
-	long long int validBaseCount = readAndValidateInput(geneSequence, geneFile, len);
-	if(validBaseCount < 1){
-		// No valid bases.
-		fprintf(stderr, "Input file has 0 valid characters... Exiting.\n");
-		return EXIT_FAILURE;
+	progress("\nStart laying out %lld records as %lldx%lld tiles...\n", parser->numRecords, tileWidth, tileHeight);
+	int bitDepth = paletteBitDepth(parser->totalBases, width * height);
+	long long int rowBytes = PALETTE_ROW_BYTES(width, bitDepth);
+	u_char *img = (u_char *)malloc(rowBytes * height * sizeof(u_char));
+	u_char *tileSequence = (u_char *)malloc(PACKED_SEQUENCE_BYTES(longest) * sizeof(u_char));
+	if(NULL == img || NULL == tileSequence){
+		fprintf(stderr, "Unable to allocate tiled img array... May have run out of RAM.\n");
+		free(img);
+		free(tileSequence);
+		saveFailed = true;
+		return;
 	}
 
-	// Find the optimal sized square dimmensions which can fit the sequence with the least amount of blank pixels as possible.
-	long long int dim = findSquareSize(validBaseCount);
+	StageTimer timer;
+	stageTimerStart(&timer);
 
-	// If we want to represent the sequence using a serpentine pattern.
-	bool serpentineLastRowFlip = false;	// Flag to indicate if we need to flip the last row in base2colour.
-	if(serpentine){
-		serpentineLastRowFlip = applySerpentine(geneSequence, dim, validBaseCount);
+	// Grid cells without a record stay blank.
+	u_int8_t blankIndices[8];
+	u_char blankByte;
+	memset(blankIndices, BLANK_INDEX, sizeof(blankIndices));
+	packIndexRow(blankIndices, 8 / bitDepth, bitDepth, &blankByte);
+	memset(img, blankByte, rowBytes * height);
+
+	for(long long int i = 0; i < parser->numRecords; i++){
+		const FastaRecord *record = &parser->records[i];
+		long long int tileX = (i % gridDim) * tileSpacing;
+		long long int tileY = (i / gridDim) * tileHeight;
+		progress("Tile %lld (%lld, %lld): %s (%lld bases)\n", i + 1, tileX, tileY, record->name[0] == '\0' ? "(unnamed)" : record->name, record->len);
+
+		// Records are not byte aligned inside the packed sequence, so each one is copied out before it is laid out.
+		copyPackedBases(packedSequence, record->start, record->len, tileSequence);
+		bool serpentineLastRowFlip = false;
+		if(options->layout == LAYOUT_SERPENTINE && record->len > 0){
+			serpentineLastRowFlip = applySerpentine(tileSequence, tileWidth, record->len);
+		}
+		if(!layoutBases(tileSequence, tileWidth, tileHeight, record->len, options->layout, serpentineLastRowFlip, img + tileY * rowBytes + tileX * bitDepth / 8, rowBytes, bitDepth)){
+			free(tileSequence);
+			free(img);
+			saveFailed = true;
+			return;
+		}
 	}
+	free(tileSequence);
 
-	// Start assigning colours to bases, upscales the image (if wanted), and then sends the finished array to saveImg().
-	base2colour(geneSequence, dim, validBaseCount, scale, serpentineLastRowFlip);
+	double secs = runStatsAddStage(&runStats, "colour", &timer, PACKED_SEQUENCE_BYTES(parser->totalBases), rowBytes * height, parser->totalBases);
+	progress("Finished assigning colours to bases.\t(%f secs)\n", secs);
+	savePaletteImage(img, width, height, options->scale, bitDepth);
+}
 
-	// Stop the timer.
-	clock_gettime(CLOCK_MONOTONIC, &finish);
-	printf("DONE. Took %f seconds.\n", getElapsedTime(start, finish));
+/*
+	Draw part of the image as palette indices, straight from the packed sequence (TileDrawFunction for the tile pyramid). Every pixel
+	works out which base it shows the same way the whole image would be laid out, so the tiles match the full size image exactly.
+	Rows and serpentine rows are a formula. Curves go through each curve tile touching the region in curve order, which takes about as
+	long as filling the region since both are tiled. Returns false (after saying so) if memory cannot be allocated.
+*/
+bool drawImageRegion(const void *source, long long int x, long long int y, long long int width, long long int height, u_char *indices, long long int stride){
+	const ImageSource *image = (const ImageSource *)source;
 
-	free(geneSequence);	// Free the sequence character array.
-	return EXIT_SUCCESS;
-}
\ No newline at end of file
+	// Bases covered by the region, before upscaling.
+	long long int baseX = x / image->scale;
+	long long int baseY = y / image->scale;
+	long long int baseWidth = (x + width - 1) / image->scale - baseX + 1;
+	long long int baseHeight = (y + height - 1) / image->scale - baseY + 1;
+	u_int8_t *codes = (u_int8_t *)malloc(baseWidth * baseHeight * sizeof(u_int8_t));
+	if(NULL == codes){
+		fprintf(stderr, "Unable to allocate tile base buffer... May have run out of RAM.\n");
+		return false;
+	}
+
+	if(image->layout == LAYOUT_HILBERT || image->layout == LAYOUT_MORTON){
+		const CurveLayout *curve = &image->curve;
+		long long int tileBits = curve->curve.tileBits;
+		for(long long int tileY = baseY >> tileBits; tileY <= (baseY + baseHeight - 1) >> tileBits; tileY++){
+			for(long long int tileX = baseX >> tileBits; tileX <= (baseX + baseWidth - 1) >> tileBits; tileX++){
+				// Which square the tile is in, then which of the square's tiles it is.
+				long long int square = (curve->vertical ? tileY : tileX) / image->tilesPerSide;
+				long long int squareX = curve->vertical ? tileX : tileX - square * image->tilesPerSide;
+				long long int squareY = curve->vertical ? tileY - square * image->tilesPerSide : tileY;
+				u_int64_t tile = square * curve->curve.numTiles + image->tileAt[squareY * image->tilesPerSide + squareX];
+				long long int originX, originY, base;
+				const u_int16_t *cells;
+				curveLayoutTile(curve, tile, &originX, &originY, &cells, &base);
+				for(long long int i = 0; i < 1LL << (2 * tileBits); i++){
+					long long int cellX = originX + (cells[i] & 0xFF);
+					long long int cellY = originY + (cells[i] >> 8);
+					if(cellX >= image->width || cellY >= image->height){
+						continue;	// Outside the image, does not use up a base.
+					}
+					if(cellX >= baseX && cellX < baseX + baseWidth && cellY >= baseY && cellY < baseY + baseHeight){
+						codes[(cellY - baseY) * baseWidth + cellX - baseX] = base < image->len ? getPackedBase(image->packedSequence, base) : BLANK_INDEX;
+					}
+					base++;
+				}
+			}
+		}
+	}
+	else{
+		// Serpentine flips every odd row, including the last one with its blank pixels.
+		for(long long int row = 0; row < baseHeight; row++){
+			long long int rowY = baseY + row;
+			bool flipped = image->layout == LAYOUT_SERPENTINE && rowY % 2 == 1;
+			for(long long int col = 0; col < baseWidth; col++){
+				long long int colX = flipped ? image->width - 1 - (baseX + col) : baseX + col;
+				long long int base = rowY * image->width + colX;
+				codes[row * baseWidth + col] = base < image->len ? getPackedBase(image->packedSequence, base) : BLANK_INDEX;
+			}
+		}
+	}
+
+	// Upscale into the region.
+	for(long long int row = 0; row < height; row++){
+		const u_int8_t *baseRow = codes + ((y + row) / image->scale - baseY) * baseWidth;
+		for(long long int col = 0; col < width; col++){
+			indices[row * stride + col] = baseRow[(x + col) / image->scale - baseX];
+		}
+	}
+	free(codes);
+	return true;
+}
+
+// Write the image as a Deep Zoom tile pyramid (--tiles) instead of one PNG. The full size image is never built, the most detailed
+// tiles are drawn straight from the packed sequence.
+void renderTilePyramid(const u_char *packedSequence, long long int len, const RenderOptions *options){
+	progress("\nStart writing the tile pyramid...\n");
+	StageTimer timer;
+	stageTimerStart(&timer);
+
+	ImageSource image;
+	memset(&image, 0, sizeof(ImageSource));
+	image.packedSequence = packedSequence;
+	findImageSize(len, options, &image.width, &image.height);
+	if(!checkImageSize(image.width, image.height, options->scale, TILE_PYRAMID_MAX_DIMENSION)){
+		saveFailed = true;
+		return;
+	}
+	image.len = len;
+	image.scale = options->scale;
+	image.layout = options->layout;
+	runStats.width = image.width * (long long int)options->scale;
+	runStats.height = image.height * (long long int)options->scale;
+
+	// Curve layouts need to find the curve tile at any position. Every square has its tiles in the same places.
+	bool curve = options->layout == LAYOUT_HILBERT || options->layout == LAYOUT_MORTON;
+	if(curve){
+		if(!curveLayoutInit(&image.curve, options->layout == LAYOUT_HILBERT ? CURVE_HILBERT : CURVE_MORTON, image.width, image.height)){
+			saveFailed = true;
+			return;
+		}
+		image.tilesPerSide = 1LL << (image.curve.curve.order - image.curve.curve.tileBits);
+		image.tileAt = (u_int64_t *)malloc(image.curve.curve.numTiles * sizeof(u_int64_t));
+		if(NULL == image.tileAt){
+			fprintf(stderr, "Unable to allocate curve tile array... May have run out of RAM.\n");
+			curveLayoutFree(&image.curve);
+			saveFailed = true;
+			return;
+		}
+		#pragma omp parallel for
+		for(long long int tile = 0; tile < (long long int)image.curve.curve.numTiles; tile++){
+			u_int32_t originX, originY;
+			const u_int16_t *cells;
+			curveTile(&image.curve.curve, tile, &originX, &originY, &cells);
+			image.tileAt[(originY >> image.curve.curve.tileBits) * image.tilesPerSide + (originX >> image.curve.curve.tileBits)] = tile;
+		}
+	}
+
+	u_int64_t tilesWritten, bytesWritten;
+	bool written = writeTilePyramid(options->tilesName, runStats.width, runStats.height, options->downsample, &paletteColours[0][0], PALETTE_SIZE, BLANK_INDEX,
+		&pngEncoder, drawImageRegion, &image, &tilesWritten, &bytesWritten);
+	double secs = runStatsAddStage(&runStats, "tiles", &timer, PACKED_SEQUENCE_BYTES(len), bytesWritten, len);
+	if(written){
+		runStatsSetOutput(&runStats, options->tilesName);
+		progress("Wrote %llu tiles (%llu bytes) for %s (%f secs)\n\n", (unsigned long long)tilesWritten, (unsigned long long)bytesWritten, options->tilesName, secs);
+	}
+	else{
+		saveFailed = true;
+	}
+
+	if(curve){
+		free(image.tileAt);
+		curveLayoutFree(&image.curve);
+	}
+}
+
+// Render a sequence on its own as one image, following the render options.
+void renderSequence(u_char *packedSequence, long long int len, const RenderOptions *options){
+	if(NULL != options->tilesName){
+		renderTilePyramid(packedSequence, len, options);
+		return;
+	}
+
+	// Find the dimmensions which fit the sequence with the least amount of blank pixels as possible. (A square unless --width or --aspect was given.)
+	long long int width, height;
+	findImageSize(len, options, &width, &height);
+	if(!checkImageSize(width, height, options->scale, PNG_MAX_DIMENSION)){
+		saveFailed = true;
+		return;
+	}
+	runStats.width = width * (long long int)options->scale;
+	runStats.height = height * (long long int)options->scale;
+	setImageMetadata(len, width, height, options->scale, options->layout);
+
+	// If we want to represent the sequence using a serpentine pattern.
+	bool serpentineLastRowFlip = false;	// Flag to indicate if we need to flip the last row in base2colour.
+	if(options->layout == LAYOUT_SERPENTINE){
+		serpentineLastRowFlip = applySerpentine(packedSequence, width, len);
+	}
+
+	// Start assigning colours to bases, upscales the image (if wanted), and then sends the finished array to saveImg().
+	base2colour(packedSequence, width, height, len, options->scale, options->layout, serpentineLastRowFlip);
+}
+
+// Render every record of a multi-record file to its own image. Records without any bases are skipped.
+void renderRecords(const u_char *packedSequence, const FastaParser *parser, const RenderOptions *options){
+	long long int longest = 0;
+	for(long long int i = 0; i < parser->numRecords; i++){
+		longest = parser->records[i].len > longest ? parser->records[i].len : longest;
+	}
+	u_char *recordSequence = (u_char *)malloc(PACKED_SEQUENCE_BYTES(longest) * sizeof(u_char));
+	if(NULL == recordSequence){
+		fprintf(stderr, "Unable to allocate record array... May have run out of RAM.\n");
+		saveFailed = true;
+		return;
+	}
+
+	for(long long int i = 0; i < parser->numRecords; i++){
+		const FastaRecord *record = &parser->records[i];
+		progress("\nRecord %lld of %lld: %s (%lld bases)\n", i + 1, parser->numRecords, record->name[0] == '\0' ? "(unnamed)" : record->name, record->len);
+		if(record->len == 0){
+			progress("Record has no valid bases, skipping it.\n");
+			continue;
+		}
+		copyPackedBases(packedSequence, record->start, record->len, recordSequence);
+		renderSequence(recordSequence, record->len, options);
+	}
+	free(recordSequence);
+}
+
+// Describe the image about to be saved in the metadata written into it (see IMAGE_METADATA_KEYWORD).
+void setImageMetadata(long long int len, long long int width, long long int height, int scale, Layout layout){
+	int used = snprintf(imageMetadata, sizeof(imageMetadata), "bases=%lld width=%lld height=%lld scale=%d layout=%s colours=", len, width, height, scale, layoutName(layout));
+	static const char *names[PALETTE_SIZE] = {"A", "C", "T", "G", "blank"};	// In palette order, as --colours names them.
+	for(int i = 0; i < PALETTE_SIZE; i++){
+		used += snprintf(imageMetadata + used, sizeof(imageMetadata) - used, "%s%s=%02x%02x%02x", i == 0 ? "" : ",", names[i],
+			paletteColours[i][0], paletteColours[i][1], paletteColours[i][2]);
+	}
+}
+
+// Read the metadata of an image back. Returns false if anything is missing or does not make sense.
+bool parseImageMetadata(const char *text, ImageMetadata *metadata){
+	char copy[IMAGE_METADATA_SIZE];
+	if(snprintf(copy, sizeof(copy), "%s", text) >= (int)sizeof(copy)){
+		return false;
+	}
+	metadata->len = metadata->width = metadata->height = -1;
+	metadata->scale = -1;
+	bool haveLayout = false;
+
+	// Entries are KEY=VALUE separated by spaces. Anything else (such as the colours, which are only there for people to read) is skipped.
+	char *savePtr = NULL;
+	for(char *entry = strtok_r(copy, " ", &savePtr); NULL != entry; entry = strtok_r(NULL, " ", &savePtr)){
+		char *value = strchr(entry, '=');
+		if(NULL == value){
+			return false;
+		}
+		*value++ = '\0';
+		if(strcmp(entry, "bases") == 0){
+			char *end;
+			errno = 0;
+			metadata->len = strtoll(value, &end, 10);
+			if(errno != 0 || *end != '\0' || end == value){
+				return false;
+			}
+		}
+		else if(strcmp(entry, "width") == 0 && !parseWidth(value, &metadata->width)){
+			return false;
+		}
+		else if(strcmp(entry, "height") == 0 && !parseWidth(value, &metadata->height)){
+			return false;
+		}
+		else if(strcmp(entry, "scale") == 0 && !parseScale(value, &metadata->scale)){
+			return false;
+		}
+		else if(strcmp(entry, "layout") == 0){
+			if(!parseLayout(value, &metadata->layout)){
+				return false;
+			}
+			haveLayout = true;
+		}
+	}
+	return haveLayout && metadata->len > 0 && metadata->width > 0 && metadata->height > 0 && metadata->scale > 0
+		&& metadata->width <= LLONG_MAX / metadata->height && metadata->len <= metadata->width * metadata->height;
+}
+
+/*
+	Read the header and metadata of a PNG made by gene2pic into state and metadata, without decoding the image data. The chunks are
+	walked through one at a time and only the text chunks are read, so this stays quick however big the image is. Returns false (after
+	saying why) if the image is not one gene2pic made, or does not match its metadata.
+*/
+bool readImageMetadata(const char *inputFile, const u_char *png, size_t pngSize, LodePNGState *state, ImageMetadata *metadata){
+	unsigned pngWidth, pngHeight;
+	unsigned error = lodepng_inspect(&pngWidth, &pngHeight, state, png, pngSize);
+	if(error){
+		fprintf(stderr, "\nUnable to decode %s, lodepng returned an error.\nError %u: %s\n", inputFile, error, lodepng_error_text(error));
+		return false;
+	}
+	for(size_t pos = 8; pos + 12 <= pngSize && !lodepng_chunk_type_equals(png + pos, "IEND"); pos += lodepng_chunk_length(png + pos) + 12){
+		if(lodepng_chunk_type_equals(png + pos, "tEXt") && lodepng_inspect_chunk(state, pos, png, pngSize) != 0){
+			break;	// Broken chunk, the metadata is missing as far as we are concerned.
+		}
+	}
+
+	const char *text = NULL;
+	for(size_t i = 0; i < state->info_png.text_num; i++){
+		if(strcmp(state->info_png.text_keys[i], IMAGE_METADATA_KEYWORD) == 0){
+			text = state->info_png.text_strings[i];
+		}
+	}
+	if(NULL == text || !parseImageMetadata(text, metadata)){
+		fprintf(stderr, "\n%s has no gene2pic metadata, so there is no way to tell how its bases were laid out. Only images made by gene2pic can be decoded.\n", inputFile);
+		return false;
+	}
+	if(state->info_png.color.colortype != LCT_PALETTE || metadata->width > PNG_MAX_DIMENSION / metadata->scale || metadata->height > PNG_MAX_DIMENSION / metadata->scale
+		|| pngWidth != metadata->width * metadata->scale || pngHeight != metadata->height * metadata->scale){
+		fprintf(stderr, "\n%s is not the palette image its metadata describes, it may have been edited.\n", inputFile);
+		return false;
+	}
+	return true;
+}
+
+// Palette index of pixel (x, y) of decoded palette image rows which are rowBits long. (lodepng gives a whole image as one long run of bits
+// with no padding between rows, pngReadRows() gives rows which start on a byte.)
+u_int8_t getDecodedPixel(const u_char *pixels, long long int rowBits, int bitDepth, long long int x, long long int y){
+	u_int64_t bit = (u_int64_t)y * rowBits + (u_int64_t)x * bitDepth;
+	return (pixels[bit / 8] >> (8 - bitDepth - bit % 8)) & ((1 << bitDepth) - 1);
+}
+
+// Find the rows (before scaling) of an image holding bases start to end - 1. With a curve layout the bases are spread over the rows of
+// every curve tile they are in. Returns false (after saying so) if memory cannot be allocated.
+bool findRegionRows(const ImageMetadata *metadata, long long int start, long long int end, long long int *firstRow, long long int *lastRow){
+	if(metadata->layout == LAYOUT_ROWS || metadata->layout == LAYOUT_SERPENTINE){
+		*firstRow = start / metadata->width;
+		*lastRow = (end - 1) / metadata->width;
+		return true;
+	}
+	CurveLayout layout;
+	if(!curveLayoutInit(&layout, metadata->layout == LAYOUT_HILBERT ? CURVE_HILBERT : CURVE_MORTON, metadata->width, metadata->height)){
+		return false;
+	}
+	long long int tileSize = 1LL << layout.curve.tileBits;
+	u_int64_t firstTile, endTile;
+	curveLayoutTileRange(&layout, start, end, &firstTile, &endTile);
+	*firstRow = metadata->height - 1;
+	*lastRow = 0;
+	for(u_int64_t tile = firstTile; tile < endTile; tile++){
+		long long int originX, originY, base;
+		const u_int16_t *cells;
+		long long int count = curveLayoutTile(&layout, tile, &originX, &originY, &cells, &base);
+		if(base < end && base + count > start){
+			*firstRow = originY < *firstRow ? originY : *firstRow;
+			*lastRow = originY + tileSize - 1 > *lastRow ? originY + tileSize - 1 : *lastRow;
+		}
+	}
+	*lastRow = *lastRow < metadata->height - 1 ? *lastRow : metadata->height - 1;
+	curveLayoutFree(&layout);
+	return true;
+}
+
+/*
+	Read bases start to end - 1 back out of a decoded image, the reverse of layoutBases(). Pixels holds the image's rows of rowBits each,
+	starting from row firstRow (after scaling). Each base is read from the top left pixel of its scale x scale block, and its letter is
+	written to bases[base - start]. Returns false (after saying why) if a pixel where a base should be is not one of the 4 base colours,
+	or if memory cannot be allocated. InputFile is only used in the messages.
+*/
+bool readImageBases(const char *inputFile, const u_char *pixels, long long int rowBits, int bitDepth, long long int firstRow, const ImageMetadata *metadata, long long int start, long long int end, char *bases){
+	long long int width = metadata->width;
+	long long int height = metadata->height;
+	int scale = metadata->scale;
+	bool valid = true;
+	if(metadata->layout == LAYOUT_ROWS || metadata->layout == LAYOUT_SERPENTINE){
+		// Every second row of a serpentine image runs right to left, including the incomplete row and its blank pixels.
+		#pragma omp parallel for reduction(&&:valid)
+		for(long long int y = start / width; y <= (end - 1) / width; y++){
+			bool reversed = metadata->layout == LAYOUT_SERPENTINE && y % 2 == 1;
+			for(long long int x = 0; x < width; x++){
+				long long int base = y * width + (reversed ? width - 1 - x : x);
+				if(base < start || base >= end){
+					continue;
+				}
+				u_int8_t index = getDecodedPixel(pixels, rowBits, bitDepth, x * scale, y * scale - firstRow);
+				valid = valid && index < BLANK_INDEX;
+				bases[base - start] = BASE_LETTERS[index & 3];
+			}
+		}
+		if(!valid){
+			fprintf(stderr, "\n%s has pixels which are not bases where its metadata says there should be bases, it may have been edited.\n", inputFile);
+		}
+		return valid;
+	}
+
+	// Curves go through the curve tiles the same way layoutAlongCurve() does, skipping the cells outside the image.
+	CurveLayout layout;
+	if(!curveLayoutInit(&layout, metadata->layout == LAYOUT_HILBERT ? CURVE_HILBERT : CURVE_MORTON, width, height)){
+		return false;
+	}
+	long long int tileCells = 1LL << (2 * layout.curve.tileBits);
+	u_int64_t firstTile, endTile;
+	curveLayoutTileRange(&layout, start, end, &firstTile, &endTile);
+	#pragma omp parallel for schedule(dynamic, 16) reduction(&&:valid)
+	for(long long int tile = firstTile; tile < (long long int)endTile; tile++){
+		long long int originX, originY, base;
+		const u_int16_t *cells;
+		long long int count = curveLayoutTile(&layout, tile, &originX, &originY, &cells, &base);
+		if(base >= end || base + count <= start){
+			continue;	// None of the bases wanted (or outside the image).
+		}
+		for(long long int i = 0; i < tileCells && base < end; i++){
+			long long int x = originX + (cells[i] & 0xFF);
+			long long int y = originY + (cells[i] >> 8);
+			if(x >= width || y >= height){
+				continue;
+			}
+			if(base >= start){
+				u_int8_t index = getDecodedPixel(pixels, rowBits, bitDepth, x * scale, y * scale - firstRow);
+				valid = valid && index < BLANK_INDEX;
+				bases[base - start] = BASE_LETTERS[index & 3];
+			}
+			base++;
+		}
+	}
+	curveLayoutFree(&layout);
+	if(!valid){
+		fprintf(stderr, "\n%s has pixels which are not bases where its metadata says there should be bases, it may have been edited.\n", inputFile);
+	}
+	return valid;
+}
+
+/*
+	Turn an image made by gene2pic back into its sequence (--decode), following the layout in its metadata. The bases are written to
+	outputFile ("-" for standard output) as one line. With a --region (regionEnd more than 0) only bases regionStart to regionEnd - 1 are
+	written, and only the rows of the image they are in are inflated, starting from the image's restart index (see RestartIndex.h), so
+	the time it takes depends on the size of the region rather than of the image. Returns false (after saying why) if the image could
+	not be decoded.
+*/
+bool decodeFile(const char *inputFile, const char *outputFile, long long int regionStart, long long int regionEnd){
+	runStatsInit(&runStats);
+	snprintf(runStats.inputFile, sizeof(runStats.inputFile), "%s", inputFile);
+	runStats.threads = omp_get_max_threads();
+	outputPath = outputFile;
+	saveFailed = false;
+
+	InputBuffer input;
+	StageTimer timer;
+	stageTimerStart(&timer);
+	if((strcmp(inputFile, "-") == 0 || !mapInputFile(inputFile, &input)) && !readInputFile(inputFile, &input)){
+		return false;
+	}
+	runStatsAddStage(&runStats, "read", &timer, input.len, input.len, 0);
+	runStats.inputBytes = input.len;
+
+	// The palette indices are kept as they are instead of being converted to colours, since they are the base codes.
+	progress("\nStart decoding the image...\n");
+	stageTimerStart(&timer);
+	LodePNGState state;
+	lodepng_state_init(&state);
+	state.decoder.color_convert = 0;
+	ImageMetadata metadata;
+	const u_char *png = (const u_char *)input.data;
+	if(!readImageMetadata(inputFile, png, input.len, &state, &metadata)){
+		releaseInput(&input);
+		lodepng_state_cleanup(&state);
+		return false;
+	}
+	long long int start = 0, end = metadata.len;
+	if(regionEnd > 0){
+		if(regionStart >= metadata.len){
+			fprintf(stderr, "\nThe region starts at base %lld, but %s only has %lld bases.\n", regionStart + 1, inputFile, metadata.len);
+			releaseInput(&input);
+			lodepng_state_cleanup(&state);
+			return false;
+		}
+		if(regionEnd > metadata.len){
+			fprintf(stderr, "\nThe region ends at base %lld, but %s only has %lld bases.\n", regionEnd, inputFile, metadata.len);
+			releaseInput(&input);
+			lodepng_state_cleanup(&state);
+			return false;
+		}
+		start = regionStart;
+		end = regionEnd;
+	}
+
+	// A region only needs the rows it is in, which pngReadRows() inflates on their own, checking the CRC of each IDAT chunk it reads from
+	// but not the Adler-32 of the whole image data. Interlaced images (re-saved by another program) do not keep their rows together, so
+	// they are decoded whole like when there is no region. Whole images are decoded by lodepng, which checks every checksum.
+	int bitDepth = state.info_png.color.bitdepth;
+	long long int scaledWidth = metadata.width * metadata.scale;
+	long long int rowBits = scaledWidth * bitDepth;
+	long long int firstRow = 0;
+	u_char *pixels = NULL;
+	if(regionEnd > 0 && state.info_png.interlace_method == 0){
+		long long int lastRow;
+		if(findRegionRows(&metadata, start, end, &firstRow, &lastRow)){
+			firstRow *= metadata.scale;
+			pixels = pngReadRows(png, input.len, scaledWidth, bitDepth, firstRow, lastRow * metadata.scale);
+		}
+		rowBits = PALETTE_ROW_BYTES(scaledWidth, bitDepth) * 8;
+	}
+	else{
+		unsigned pngWidth, pngHeight;
+		unsigned error = lodepng_decode(&pixels, &pngWidth, &pngHeight, &state, png, input.len);
+		if(error){
+			fprintf(stderr, "\nUnable to decode %s, lodepng returned an error.\nError %u: %s\n", inputFile, error, lodepng_error_text(error));
+			free(pixels);
+			pixels = NULL;
+		}
+	}
+	long long int pngSize = input.len;
+	releaseInput(&input);
+	lodepng_state_cleanup(&state);
+	if(NULL == pixels){
+		return false;
+	}
+
+	char *bases = (char *)malloc(end - start + 1);
+	if(NULL == bases){
+		fprintf(stderr, "Unable to allocate sequence array... May have run out of RAM.\n");
+		free(pixels);
+		return false;
+	}
+	bool valid = readImageBases(inputFile, pixels, rowBits, bitDepth, firstRow, &metadata, start, end, bases);
+	free(pixels);
+	if(!valid){
+		free(bases);
+		return false;
+	}
+	runStats.bases = end - start;
+	runStats.width = scaledWidth;
+	runStats.height = metadata.height * metadata.scale;
+	runStats.scale = metadata.scale;
+	runStats.layout = layoutName(metadata.layout);
+	double secs = runStatsAddStage(&runStats, "decode", &timer, pngSize, end - start, end - start);
+	progress("Decoded %lld bases laid out in %s (%f secs)\n", end - start, layoutName(metadata.layout), secs);
+
+	// Write the sequence out as one line.
+	stageTimerStart(&timer);
+	bases[end - start] = '\n';
+	OutputFile output;
+	bool saved = openOutputFile(&output);
+	if(saved){
+		saved = closeOutputFile(&output, fwrite(bases, 1, end - start + 1, output.file) == (size_t)(end - start + 1));
+		if(!saved){
+			fprintf(stderr, "\nUnable to save the sequence, writing to %s failed.\n", output.path);
+		}
+	}
+	free(bases);
+	secs = runStatsAddStage(&runStats, "save", &timer, end - start + 1, end - start + 1, end - start);
+	if(saved){
+		runStatsSetOutput(&runStats, output.path);
+		progress("Saved to %s (%f secs)\n\n", output.path, secs);
+	}
+	saveFailed = !saved;
+	return saved;
+}
+
+/* Flips every other row so that instead of:
+	1->2->3
+	<------
+	4->5->6
+	<------
+	7->8->9
+
+	It does:
+	1->2->3
+		  |
+	6<-5<-4
+	|
+	7->8->9
+
+	This may be a more natural way to view the sequence since if you were to lay out the DNA strand using the
+	non-serpentine method it would require you to snip the strand every time you want to go to a new row in the image.
+	This way if you were to draw it out on paper, you could traverse the whole sequence without ever taking your pencil
+	off the paper. 
+
+	Unfortunately I need to wait until later in the program to flip the incomplete row, since the packed gene sequence
+	does not have a code I can use to indicate it is blank. Each 2 bit code only has room for the 4 bases.
+
+	Returns a boolean which indicates whether or not base2colour() needs to flip the incomplete row.
+*/
+bool applySerpentine(u_char *packedSequence, long long int width, long long int len){
+	progress("\nStart applying serpentine pattern to sequence...\n");
+	long long int filledRows = len/width;	// Number of rows which can be completely filled. Excludes the incomplete row near the end if it exists, that is handled in base2colour().
+
+	// Start the timer.
+	StageTimer timer;
+	stageTimerStart(&timer);
+
+	// For every second row, flip it so the bases at the start are the ones at the end and vice versa. Use multi-processing because why not.
+	// Each row is unpacked into a buffer first and then packed back in reverse order a whole byte at a time. Rows that are not a multiple of
+	// 4 bases long share their first and last bytes with the neighbouring rows, those are only ever written one base at a time and since
+	// only odd rows are written, two threads can only touch the same byte if the rows are shorter than a byte.
+	#pragma omp parallel if(width >= BASES_PER_BYTE)
+	{
+		u_int8_t *rowCodes = (u_int8_t *)malloc(width * sizeof(u_int8_t));
+
+		#pragma omp for
+		for(long long int i = 1; i < filledRows; i+=2){
+			long long int rowStart = i * width;
+
+			// Without room for the buffer the bases are swapped in place one pair at a time, which is slower but gives the same row.
+			if(NULL == rowCodes){
+				for(long long int j = 0; j < width / 2; j++){
+					u_int8_t code = getPackedBase(packedSequence, rowStart + j);
+					setPackedBase(packedSequence, rowStart + j, getPackedBase(packedSequence, rowStart + width - 1 - j));
+					setPackedBase(packedSequence, rowStart + width - 1 - j, code);
+				}
+				continue;
+			}
+			unpackBases(packedSequence, rowStart, width, rowCodes);
+
+			// Base rowStart + j gets the code from the other end of the row.
+			long long int j = 0;
+			for(; j < width && (rowStart + j) % BASES_PER_BYTE != 0; j++){
+				setPackedBase(packedSequence, rowStart + j, rowCodes[width - 1 - j]);
+			}
+			u_char *dst = packedSequence + (rowStart + j) / BASES_PER_BYTE;
+			for(; j + BASES_PER_BYTE <= width; j += BASES_PER_BYTE){
+				const u_int8_t *four = rowCodes + width - 1 - j;
+				*dst++ = (four[0] << 6) | (four[-1] << 4) | (four[-2] << 2) | four[-3];
+			}
+			for(; j < width; j++){
+				setPackedBase(packedSequence, rowStart + j, rowCodes[width - 1 - j]);
+			}
+		}
+		free(rowCodes);
+	}
+
+	// Stop the timer.
+	double secs = runStatsAddStage(&runStats, "serpentine", &timer, PACKED_SEQUENCE_BYTES(len), PACKED_SEQUENCE_BYTES(len), len);
+	progress("Finished applying serpentine.\t\t(%f secs)\n", secs);
+	
+	// Figure out if we need to ask base2colour() to flip the incomplete row (if it exists).
+	if((filledRows)%2 != 0){
+		// Incomplete row is on an uneven row index.
+		if(len%width != 0){
+			// Incomplete row is actually incomplete and does have blank spots.
+			return true;
+		}
+	}
+	return false;
+}
+
+// Map an open file into memory so validation can read directly from the page cache instead of copying the whole file onto the heap.
+// The file descriptor is left open. Returns false if the file cannot be mapped (for example if it is empty or not a regular file).
+bool mapInputDescriptor(int fd, InputBuffer *input){
+	// Only regular files with something in them can be mapped.
+	struct stat fileInfo;
+	if(fstat(fd, &fileInfo) != 0 || !S_ISREG(fileInfo.st_mode) || fileInfo.st_size < 1){
+		return false;
+	}
+
+	char *data = (char *)mmap(NULL, fileInfo.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if(data == MAP_FAILED){
+		return false;
+	}
+
+	// The file is only ever read once from start to finish, so ask the kernel to read ahead aggressively.
+	madvise(data, fileInfo.st_size, MADV_SEQUENTIAL);
+	madvise(data, fileInfo.st_size, MADV_WILLNEED);
+
+	input->data = data;
+	input->len = fileInfo.st_size;
+	input->mapped = true;
+	return true;
+}
+
+// Map the input file into memory, see mapInputDescriptor(). Returns false if the file cannot be mapped.
+bool mapInputFile(const char *inputFile, InputBuffer *input){
+	int fd = open(inputFile, O_RDONLY);
+	if(fd < 0){
+		return false;
+	}
+	bool mapped = mapInputDescriptor(fd, input);
+	close(fd);	// The mapping keeps its own reference to the file.
+	return mapped;
+}
+
+/*
+	Used instead of readInputFile() by --stream, so input which cannot be memory mapped does not have to fit in memory either. Standard
+	input ("-") or a pipe is copied to a temporary file in $TMPDIR (or /tmp), which is deleted straight away so it goes when the mapping
+	does, and the copy is mapped instead. Standard input redirected from a regular file is mapped directly. Returns false (after saying
+	why) if the input could not be read or copied.
+*/
+bool spoolInputFile(const char *inputFile, InputBuffer *input){
+	bool isStdin = strcmp(inputFile, "-") == 0;
+	int inputFd = isStdin ? STDIN_FILENO : open(inputFile, O_RDONLY);
+	if(inputFd < 0){
+		fprintf(stderr,"File %s not found!\n", inputFile);
+		return false;
+	}
+	struct stat fileInfo;
+	if(!isStdin && (fstat(inputFd, &fileInfo) != 0 || !(S_ISREG(fileInfo.st_mode) || S_ISFIFO(fileInfo.st_mode)))){
+		fprintf(stderr,"%s is not a regular file or a pipe.\n", inputFile);
+		close(inputFd);
+		return false;
+	}
+	if(mapInputDescriptor(inputFd, input)){
+		if(!isStdin){
+			close(inputFd);
+		}
+		return true;
+	}
+
+	const char *tempDir = getenv("TMPDIR");
+	tempDir = NULL != tempDir && tempDir[0] != '\0' ? tempDir : "/tmp";
+	char spoolPath[PATH_MAX];
+	snprintf(spoolPath, sizeof(spoolPath), "%s/gene2pic-input-XXXXXX", tempDir);
+	int spoolFd = mkstemp(spoolPath);
+	if(spoolFd < 0){
+		fprintf(stderr, "Unable to create a temporary file in %s to hold %s: %s\n", tempDir, inputFile, strerror(errno));
+		if(!isStdin){
+			close(inputFd);
+		}
+		return false;
+	}
+	unlink(spoolPath);
+
+	char *buffer = (char *)malloc(INPUT_SPOOL_BUFFER_SIZE * sizeof(char));
+	bool failed = NULL == buffer;
+	if(failed){
+		fprintf(stderr, "Unable to allocate input spool buffer... May have run out of RAM.\n");
+	}
+	while(!failed){
+		ssize_t bytesRead = read(inputFd, buffer, INPUT_SPOOL_BUFFER_SIZE);
+		if(bytesRead == 0){
+			break;
+		}
+		if(bytesRead < 0){
+			if(errno == EINTR){
+				continue;
+			}
+			fprintf(stderr, "Unable to read %s.\n", inputFile);
+			failed = true;
+			break;
+		}
+		for(ssize_t written = 0; written < bytesRead && !failed;){
+			ssize_t bytesWritten = write(spoolFd, buffer + written, bytesRead - written);
+			if(bytesWritten < 0 && errno != EINTR){
+				fprintf(stderr, "Unable to copy %s to a temporary file in %s: %s\n", inputFile, tempDir, strerror(errno));
+				failed = true;
+			}
+			written += bytesWritten > 0 ? bytesWritten : 0;
+		}
+	}
+	free(buffer);
+	if(!isStdin){
+		close(inputFd);
+	}
+
+	// Nothing to map if the input was empty.
+	if(!failed && !mapInputDescriptor(spoolFd, input)){
+		input->data = (char *)malloc(1);
+		input->len = 0;
+		input->mapped = false;
+		if(lseek(spoolFd, 0, SEEK_END) != 0 || NULL == input->data){
+			fprintf(stderr, "Unable to map the copy of %s into memory.\n", inputFile);
+			free(input->data);
+			failed = true;
+		}
+	}
+	close(spoolFd);
+	return !failed;
+}
+
+// Fallback for when the input cannot be memory mapped. Reads the whole file ("-" for standard input) into a heap buffer.
+// The buffer grows as the input is read, so pipes and other files whose length is not known up front work too. Anything that is not a
+// regular file, a pipe or standard input is refused. Returns false (after saying why) if the input could not be read.
+bool readInputFile(const char *inputFile, InputBuffer *input){
+	bool isStdin = strcmp(inputFile, "-") == 0;
+	FILE *geneFile = isStdin ? stdin : fopen(inputFile, "r");	// Get the file, open with read permissions.
+	if(geneFile == (FILE *) NULL){
+		fprintf(stderr,"File %s not found!\n", inputFile);
+		return false;
+	}
+
+	// Only regular files and pipes hold a sequence. A directory opens fine but has no sensible length and cannot be read.
+	struct stat fileInfo;
+	if(!isStdin && (fstat(fileno(geneFile), &fileInfo) != 0 || !(S_ISREG(fileInfo.st_mode) || S_ISFIFO(fileInfo.st_mode)))){
+		fprintf(stderr,"%s is not a regular file or a pipe.\n", inputFile);
+		fclose(geneFile);
+		return false;
+	}
+
+	// Start with room for the whole file if its length can be found, otherwise start small and double the buffer whenever it fills.
+	long long int capacity = isStdin || S_ISFIFO(fileInfo.st_mode) ? -1 : getFileLen(geneFile);
+	if(capacity < INPUT_READ_CHUNK_SIZE){
+		capacity = INPUT_READ_CHUNK_SIZE;
+	}
+	char *data = (char *)malloc(capacity * sizeof(char));
+	long long int len = 0;
+	while(NULL != data){
+		if(len == capacity){
+			capacity *= 2;
+			char *grown = (char *)realloc(data, capacity * sizeof(char));
+			if(NULL == grown){
+				free(data);
+				data = NULL;
+				break;
+			}
+			data = grown;
+		}
+		size_t bytesRead = fread(data + len, sizeof(char), capacity - len, geneFile);
+		if(bytesRead == 0){
+			break;
+		}
+		len += bytesRead;
+	}
+	bool readError = ferror(geneFile);
+
+	// Close the input file, we are done with it now.
+	if(!isStdin){
+		fclose(geneFile);
+	}
+	if(NULL == data){
+		fprintf(stderr,"Unable to allocate geneSequence array for %s. May have run out of RAM.\n", inputFile);
+		return false;
+	}
+	if(readError){
+		fprintf(stderr,"Unable to read %s.\n", inputFile);
+		free(data);
+		return false;
+	}
+	input->data = data;
+	input->len = len;
+	input->mapped = false;
+	return true;
+}
+
+// Release the memory mapping or heap buffer holding the input file.
+void releaseInput(InputBuffer *input){
+	if(input->mapped){
+		munmap(input->data, input->len);
+	}
+	else{
+		free(input->data);
+	}
+	input->data = NULL;
+	input->len = 0;
+}
+
+// Replace gzip or BGZF compressed input with its decompressed contents. Returns false (after saying what was wrong) if it could not be decompressed.
+bool decompressInput(InputBuffer *input){
+	progress("Start decompressing input...\n");
+	StageTimer timer;
+	stageTimerStart(&timer);
+
+	size_t decompressedLen = 0;
+	u_char *decompressed = gunzip((const u_char *)input->data, input->len, &decompressedLen);
+	if(NULL == decompressed){
+		return false;
+	}
+	long long int compressedLen = input->len;
+	releaseInput(input);
+	input->data = (char *)decompressed;
+	input->len = decompressedLen;
+	input->mapped = false;
+
+	double secs = runStatsAddStage(&runStats, "decompress", &timer, compressedLen, decompressedLen, 0);
+	progress("Decompressed input is %lld characters.\t(%f secs)\n\n", input->len, secs);
+	return true;
+}
+
+// Copy the valid bases from input to output, skipping any characters that are not ATCGU (upper or lowercase) and converting lowercase to uppercase.
+// Output may be the same array as input. Never writes past output + outputCapacity. Returns the number of valid bases written to output.
+long long int validateBases(const char *input, char *output, long long int len, long long int outputCapacity){
+	// Let the SIMD kernel do as much as it can, then finish whatever is left one character at a time.
+	long long int consumed = 0;
+	long long int validBaseCount = validateBasesSIMD(validationLevel, input, output, len, outputCapacity, &consumed);
+	for(long long int i = consumed; i < len; i++){
+		// Make a copy of the letter and change it to it's ordinal form so we can do math on it.
+		u_int8_t normLetter = (u_int8_t)input[i];
+		
+		// Branchlessly convert the letter to uppercase.
+		normLetter -= 32 * (normLetter >= 'a' && normLetter <= 'z');
+
+		// Treat Uracil (U) as if it is Thymine (T) by subracting 1 from the ordinal value. (84 = T, 85 = U)
+		normLetter -= normLetter == 'U' ? 1 : 0;
+
+		// Determine if the current letter is a valid character. (This commented one is slower despite the fact it stops early when the letter is found. Intuitively I'd think this would have been faster.)
+		// normLetter == 'C' ? output[validBaseCount++] = (char)normLetter : normLetter == 'G' ? output[validBaseCount++] = (char)normLetter :  normLetter == 'A' ? output[validBaseCount++] = (char)normLetter : normLetter == 'T' ? output[validBaseCount++] = (char)normLetter : 0;
+		u_int8_t isValid = 0;
+		isValid += normLetter == 'C' ? 1 : 0;
+		isValid += normLetter == 'G' ? 1 : 0;
+		isValid += normLetter == 'A' ? 1 : 0;
+		isValid += normLetter == 'T' ? 1 : 0;
+		isValid ? output[validBaseCount++] = (char)normLetter : 0; // If base is valid, then add it to the sequence and then increment the length counter.
+	}
+	return validBaseCount;
+}
+
+// Count how many valid bases (ATCGU, upper or lowercase) are in the input without copying them anywhere.
+long long int countValidBases(const char *input, long long int len){
+	long long int consumed = 0;
+	long long int validBaseCount = countValidBasesSIMD(validationLevel, input, len, &consumed);
+	for(long long int i = consumed; i < len; i++){
+		// Same normalisation as validateBases(), see there for details.
+		u_int8_t normLetter = (u_int8_t)input[i];
+		normLetter -= 32 * (normLetter >= 'a' && normLetter <= 'z');
+		normLetter -= normLetter == 'U' ? 1 : 0;
+		validBaseCount += (normLetter == 'C') + (normLetter == 'G') + (normLetter == 'A') + (normLetter == 'T');
+	}
+	return validBaseCount;
+}
+
+/*
+	Same as validateBases() but uses every thread in the OpenMP team. The input is split into one chunk per thread and each thread
+	counts the valid bases in its chunk. A prefix sum over those counts tells every thread where its compacted bases start in the
+	output, so they can all write at the same time without any locking. Output must not overlap the input.
+*/
+long long int validateBasesParallel(const char *input, char *output, long long int len){
+	int maxThreads = omp_get_max_threads();
+	long long int *chunkCounts = (long long int *)malloc(maxThreads * sizeof(long long int));	// Number of valid bases in each chunk.
+	long long int *chunkOffsets = (long long int *)malloc((maxThreads + 1) * sizeof(long long int));	// Where each chunk's valid bases start in the output.
+	if(NULL == chunkCounts || NULL == chunkOffsets){
+		free(chunkCounts);
+		free(chunkOffsets);
+		return validateBases(input, output, len, len);	// No room to split the work up, do it all on this thread.
+	}
+	int threads = 1;	// Number of threads OpenMP actually gave us.
+
+	#pragma omp parallel num_threads(maxThreads) if(len >= PARALLEL_VALIDATION_MIN_LEN)
+	{
+		int thread = omp_get_thread_num();
+		#pragma omp single
+		threads = omp_get_num_threads();
+
+		// Each thread takes an equal sized slice of the input.
+		long long int chunkStart = len * thread / threads;
+		long long int chunkLen = len * (thread + 1) / threads - chunkStart;
+
+		// First pass, find out how many valid bases are in this chunk.
+		chunkCounts[thread] = countValidBases(input + chunkStart, chunkLen);
+		#pragma omp barrier
+
+		// Prefix sum over the chunk counts to find where each chunk's bases go. (Implicit barrier at the end of single.)
+		#pragma omp single
+		{
+			chunkOffsets[0] = 0;
+			for(int i = 0; i < threads; i++){
+				chunkOffsets[i + 1] = chunkOffsets[i] + chunkCounts[i];
+			}
+		}
+
+		// Second pass, every thread writes its valid bases straight to its own region of the output.
+		// The region is exactly as big as the chunk's valid bases so the SIMD kernels cannot spill into the next thread's region.
+		validateBases(input + chunkStart, output + chunkOffsets[thread], chunkLen, chunkCounts[thread]);
+	}
+
+	long long int validBaseCount = chunkOffsets[threads];
+	free(chunkCounts);
+	free(chunkOffsets);
+	return validBaseCount;
+}
+
+// Read the 2 bit code of base i in a packed sequence.
+u_int8_t getPackedBase(const u_char *packedSequence, long long int i){
+	return (packedSequence[i / BASES_PER_BYTE] >> PACKED_BASE_SHIFT(i)) & 3;
+}
+
+// Overwrite the 2 bit code of base i in a packed sequence.
+void setPackedBase(u_char *packedSequence, long long int i, u_int8_t code){
+	u_char *byte = &packedSequence[i / BASES_PER_BYTE];
+	*byte = (*byte & ~(3 << PACKED_BASE_SHIFT(i))) | (code << PACKED_BASE_SHIFT(i));
+}
+
+// Copy the 2 bit codes of count bases starting at base number start out of a packed sequence, one code per byte.
+void unpackBases(const u_char *packedSequence, long long int start, long long int count, u_int8_t *codes){
+	const u_char *src = packedSequence + start / BASES_PER_BYTE;
+	int shift = PACKED_BASE_SHIFT(start);
+	for(long long int j = 0; j < count; j++){
+		codes[j] = (*src >> shift) & 3;
+		shift -= 2;
+		if(shift < 0){
+			shift = 6;
+			src++;
+		}
+	}
+}
+
+// Pack len validated bases (uppercase ACGT letters) into packedSequence starting at base number offset.
+void packBases(const char *bases, long long int len, u_char *packedSequence, long long int offset){
+	// Fill up the partially used byte at the end of what is already packed, so the rest starts on a byte boundary.
+	long long int i = 0;
+	for(; i < len && (offset + i) % BASES_PER_BYTE != 0; i++){
+		setPackedBase(packedSequence, offset + i, BASE_CODE(bases[i]));
+	}
+
+	// Then pack 4 bases into each byte using all the threads.
+	long long int fullBytes = (len - i) / BASES_PER_BYTE;
+	const char *src = bases + i;
+	u_char *dst = packedSequence + (offset + i) / BASES_PER_BYTE;
+	#pragma omp parallel for
+	for(long long int j = 0; j < fullBytes; j++){
+		const char *four = src + j * BASES_PER_BYTE;
+		dst[j] = (BASE_CODE(four[0]) << 6) | (BASE_CODE(four[1]) << 4) | (BASE_CODE(four[2]) << 2) | BASE_CODE(four[3]);
+	}
+	i += fullBytes * BASES_PER_BYTE;
+
+	// Whatever is left does not fill a whole byte.
+	for(; i < len; i++){
+		setPackedBase(packedSequence, offset + i, BASE_CODE(bases[i]));
+	}
+}
+
+// Read in the data from the sequence file and ignore any characters that are not ATCGU (upper or lowercase).
+// The valid bases are stored 2 bits each in packedSequence, which must have room for PACKED_SEQUENCE_BYTES(input->len) bytes and be zeroed.
+// Returns the number of valid bases, or -1 (after saying so) if memory cannot be allocated.
+long long int readAndValidateInput(u_char *packedSequence, const InputBuffer *input, FastaParser *parser){
+	progress("Start validation of input sequence... (%s kernel)\n", simdLevelName(validationLevel));
+	// Length of the valid gene sequence.
+	long long int validBaseCount = 0;
+
+	// Initialize and start the timer.
+	StageTimer timer;
+	stageTimerStart(&timer);
+
+	// Valid bases of one block are collected here as letters before they are packed.
+	long long int blockSize = input->len < VALIDATION_BLOCK_SIZE ? input->len : VALIDATION_BLOCK_SIZE;
+	char *validBlock = (char *)malloc(blockSize * sizeof(char));
+	if(NULL == validBlock){
+		fprintf(stderr, "Unable to allocate validation block... May have run out of RAM.\n");
+		return -1;
+	}
+
+	// Work through the input in blocks, removing any invalid characters using all the threads and then packing what is left.
+	// Pages of a memory mapping are handed back to the kernel as soon as we are done with them, so the whole file never has
+	// to be resident at once, only the packed bases we keep.
+	for(long long int offset = 0; offset < input->len; offset += VALIDATION_BLOCK_SIZE){
+		long long int blockLen = input->len - offset < VALIDATION_BLOCK_SIZE ? input->len - offset : VALIDATION_BLOCK_SIZE;
+		long long int blockBases = 0;
+
+		// Only the sequence between FASTA header lines is validated, so the letters of a header are never taken as bases.
+		long long int pos = 0;
+		const char *segment;
+		long long int segmentLen;
+		while(fastaNextSegment(parser, input->data + offset, blockLen, &pos, &segment, &segmentLen)){
+			long long int segmentBases = validateBasesParallel(segment, validBlock + blockBases, segmentLen);
+			fastaAddBases(parser, segmentBases);
+			blockBases += segmentBases;
+		}
+		packBases(validBlock, blockBases, packedSequence, validBaseCount);
+		validBaseCount += blockBases;
+		if(input->mapped){
+			madvise(input->data + offset, blockLen, MADV_DONTNEED);
+		}
+	}
+	free(validBlock);
+	if(parser->failed){
+		return -1;
+	}
+
+	// Stop the timer and figure out how long it took to validate all the bases.
+	double secs = runStatsAddStage(&runStats, "validate", &timer, input->len, PACKED_SEQUENCE_BYTES(validBaseCount), validBaseCount);
+	progress("Valid input sequence is %lld bases.\t(%f secs)\n", validBaseCount, secs);
+	
+	return validBaseCount;
+}
+
+// Copy count packed bases starting at base start of src to the start of dst, so they begin on a byte. Unused bits of the last byte are zeroed.
+void copyPackedBases(const u_char *src, long long int start, long long int count, u_char *dst){
+	const u_char *from = src + start / BASES_PER_BYTE;
+	int shift = 2 * (start % BASES_PER_BYTE);	// Bits to move every byte left by.
+	long long int bytes = PACKED_SEQUENCE_BYTES(count);
+	long long int lastByte = (start + count - 1) / BASES_PER_BYTE - start / BASES_PER_BYTE;	// Last byte of src (relative to from) holding one of the bases.
+	if(count <= 0){
+		return;
+	}
+	if(shift == 0){
+		memcpy(dst, from, bytes);
+	}
+	else{
+		#pragma omp parallel for if(bytes >= COUNT_CHUNK_SIZE)
+		for(long long int i = 0; i < bytes; i++){
+			dst[i] = (u_char)((from[i] << shift) | (i + 1 <= lastByte ? from[i + 1] >> (8 - shift) : 0));
+		}
+	}
+	if(count % BASES_PER_BYTE != 0){
+		dst[bytes - 1] &= (u_char)(0xFF << (8 - 2 * (count % BASES_PER_BYTE)));
+	}
+}
+
+// Count the valid bases in input using every thread. Nothing is written anywhere, so this can run over a read-only mapping.
+long long int countValidBasesParallel(const char *input, long long int len){
+	long long int validBaseCount = 0;
+	long long int chunks = (len + COUNT_CHUNK_SIZE - 1) / COUNT_CHUNK_SIZE;
+	#pragma omp parallel for reduction(+:validBaseCount) if(chunks > 1)
+	for(long long int i = 0; i < chunks; i++){
+		long long int chunkStart = i * COUNT_CHUNK_SIZE;
+		long long int chunkLen = len - chunkStart < COUNT_CHUNK_SIZE ? len - chunkStart : COUNT_CHUNK_SIZE;
+		validBaseCount += countValidBases(input + chunkStart, chunkLen);
+	}
+	return validBaseCount;
+}
+
+// Set up a reader which hands out the valid bases of the input a few at a time. Returns false (after saying so) if memory cannot be allocated,
+// the reader must still be freed with baseReaderFree().
+bool baseReaderInit(BaseReader *reader, const InputBuffer *input){
+	reader->input = input;
+	reader->inputPos = 0;
+	reader->bufferLen = 0;
+	reader->bufferPos = 0;
+	fastaParserInit(&reader->parser);
+	reader->buffer = (char *)malloc(STREAM_BLOCK_SIZE * sizeof(char));
+	if(NULL == reader->buffer){
+		fprintf(stderr, "Unable to allocate stream buffer... May have run out of RAM.\n");
+		return false;
+	}
+	return true;
+}
+
+// Copy up to count valid bases into output. Returns how many were copied, which is only less than count once the input runs out.
+long long int baseReaderRead(BaseReader *reader, char *output, long long int count){
+	long long int copied = 0;
+	while(copied < count){
+		// Validate the next block of input once everything from the last one has been handed out.
+		if(reader->bufferPos == reader->bufferLen){
+			if(reader->inputPos >= reader->input->len){
+				break;
+			}
+			long long int blockLen = reader->input->len - reader->inputPos < STREAM_BLOCK_SIZE ? reader->input->len - reader->inputPos : STREAM_BLOCK_SIZE;
+			reader->bufferLen = 0;
+			reader->bufferPos = 0;
+			long long int pos = 0;
+			const char *segment;
+			long long int segmentLen;
+			while(fastaNextSegment(&reader->parser, reader->input->data + reader->inputPos, blockLen, &pos, &segment, &segmentLen)){
+				reader->bufferLen += validateBasesParallel(segment, reader->buffer + reader->bufferLen, segmentLen);
+			}
+
+			// Pages of the mapping we are done with can be dropped so the file is never fully resident.
+			if(reader->input->mapped){
+				madvise(reader->input->data + reader->inputPos, blockLen, MADV_DONTNEED);
+			}
+			reader->inputPos += blockLen;
+		}
+
+		long long int available = reader->bufferLen - reader->bufferPos;
+		long long int toCopy = count - copied < available ? count - copied : available;
+		memcpy(output + copied, reader->buffer + reader->bufferPos, toCopy);
+		reader->bufferPos += toCopy;
+		copied += toCopy;
+	}
+	return copied;
+}
+
+// Free the reader's buffer. Does not release the input.
+void baseReaderFree(BaseReader *reader){
+	fastaParserFree(&reader->parser);
+	free(reader->buffer);
+	reader->buffer = NULL;
+}
+
+/*
+	Render the image without ever holding the whole sequence or image in memory. The valid bases are counted in a first pass to
+	find the image size, then a second pass validates the input a block at a time, colours it one row at a time and feeds the rows
+	(upscaled if needed) straight into a streaming PNG encoder. Peak memory is a few rows of the upscaled image plus one input block.
+*/
+bool renderStreaming(const InputBuffer *input, const RenderOptions *options){
+	progress("Start counting valid bases...\n");
+	StageTimer timer;
+	stageTimerStart(&timer);
+	long long int validBaseCount = 0;
+	FastaParser parser;
+	fastaParserInit(&parser);
+	for(long long int offset = 0; offset < input->len; offset += VALIDATION_BLOCK_SIZE){
+		long long int blockLen = input->len - offset < VALIDATION_BLOCK_SIZE ? input->len - offset : VALIDATION_BLOCK_SIZE;
+		long long int pos = 0;
+		const char *segment;
+		long long int segmentLen;
+		while(fastaNextSegment(&parser, input->data + offset, blockLen, &pos, &segment, &segmentLen)){
+			validBaseCount += countValidBasesParallel(segment, segmentLen);
+		}
+		if(input->mapped){
+			madvise(input->data + offset, blockLen, MADV_DONTNEED);	// Will be read again (from the page cache) when the image is rendered.
+		}
+	}
+	double secs = runStatsAddStage(&runStats, "count", &timer, input->len, 0, validBaseCount);
+	progress("Valid input sequence is %lld bases.\t(%f secs)\n", validBaseCount, secs);
+	runStats.records = parser.numRecords;
+	bool parsed = !parser.failed;
+	fastaParserFree(&parser);
+	if(!parsed){
+		return false;
+	}
+	if(validBaseCount < 1){
+		fprintf(stderr, "Input file has 0 valid characters... Exiting.\n");
+		return false;
+	}
+
+	long long int width, height;
+	findImageSize(validBaseCount, options, &width, &height);
+	if(!checkImageSize(width, height, options->scale, PNG_MAX_DIMENSION)){
+		return false;
+	}
+	long long int scaledWidth = width * (long long int)options->scale;	// Dimmensions of the upscaled image.
+	long long int scaledHeight = height * (long long int)options->scale;
+	runStats.bases = validBaseCount;
+	runStats.width = scaledWidth;
+	runStats.height = scaledHeight;
+	setImageMetadata(validBaseCount, width, height, options->scale, options->layout);
+
+	// Rows are written as palette indices, which are just the 2 bit base codes plus one more index for blank pixels.
+	int bitDepth = paletteBitDepth(validBaseCount, width * height);
+
+	// Only one row of bases, one row of palette indices (upscaled) and the packed row are kept at a time. (Plus the all zero row used for Up filtered repeated rows.)
+	char *rowBases = (char *)malloc(width * sizeof(char));
+	u_int8_t *rowIndices = (u_int8_t *)malloc(scaledWidth * sizeof(u_int8_t));
+	u_char *row = (u_char *)malloc(PALETTE_ROW_BYTES(scaledWidth, bitDepth) * sizeof(u_char));
+	u_char *repeatRow = (u_char *)calloc(PALETTE_ROW_BYTES(scaledWidth, bitDepth), sizeof(u_char));
+	BaseReader reader;
+	bool allocated = NULL != rowBases && NULL != rowIndices && NULL != row && NULL != repeatRow;
+	if(!allocated){
+		fprintf(stderr, "Unable to allocate row buffers... May have run out of RAM.\n");
+	}
+	if(!allocated || !baseReaderInit(&reader, input)){
+		if(allocated){
+			baseReaderFree(&reader);
+		}
+		free(rowBases);
+		free(rowIndices);
+		free(row);
+		free(repeatRow);
+		return false;
+	}
+
+	OutputFile output;
+	if(!openOutputFile(&output)){
+		baseReaderFree(&reader);
+		free(rowBases);
+		free(rowIndices);
+		free(row);
+		free(repeatRow);
+		return false;
+	}
+
+	progress("\nStart streaming the image...\n");
+	stageTimerStart(&timer);
+
+	PngWriter writer;
+	pngWriterOpen(&writer, output.file, scaledWidth, scaledHeight, LCT_PALETTE, bitDepth, &paletteColours[0][0], PALETTE_SIZE, &pngEncoder.zlibsettings);
+	if(imageMetadata[0] != '\0'){
+		pngWriterWriteText(&writer, IMAGE_METADATA_KEYWORD, imageMetadata);
+	}
+	u_char repeatFilter = pngRepeatRowFilter(&pngEncoder.zlibsettings, writer.rowBytes);
+
+	for(long long int y = 0; y < height; y++){
+		long long int rowLen = baseReaderRead(&reader, rowBases, width);
+
+		// Palette index of each base is its 2 bit code, with blank pixels after the last base.
+		for(long long int i = 0; i < rowLen; i++){
+			rowIndices[i] = BASE_CODE(rowBases[i]);
+		}
+		memset(rowIndices + rowLen, BLANK_INDEX, width - rowLen);
+
+		// Every second row is flipped in serpentine mode. The incomplete row (and any blank rows) are flipped along with the rest.
+		if(options->layout == LAYOUT_SERPENTINE && y % 2 == 1){
+			for(long long int j = 0; j < width / (long long int)2; j++){
+				u_int8_t tmp = rowIndices[j];
+				rowIndices[j] = rowIndices[width - (long long int)1 - j];
+				rowIndices[width - (long long int)1 - j] = tmp;
+			}
+		}
+
+		// Nearest neighbour upscaling, each pixel is repeated scale times across (done backwards so it can be done in place) and the whole row is repeated scale times down.
+		if(options->scale > 1){
+			for(long long int x = width - 1; x >= 0; x--){
+				memset(rowIndices + x * options->scale, rowIndices[x], options->scale);
+			}
+		}
+		packIndexRow(rowIndices, scaledWidth, bitDepth, row);
+		pngWriterWriteRow(&writer, PNG_FILTER_NONE, row);
+		for(int k = 1; k < options->scale; k++){
+			pngWriterWriteRow(&writer, repeatFilter, repeatFilter == PNG_FILTER_UP ? repeatRow : row);	// Same as the row above.
+		}
+	}
+	bool basesRead = !reader.parser.failed;	// Otherwise the rows after the failure were left blank.
+	baseReaderFree(&reader);
+
+	bool saved = closeOutputFile(&output, pngWriterClose(&writer) && basesRead);
+	secs = runStatsAddStage(&runStats, "stream", &timer, input->len, writer.bytesWritten, validBaseCount);
+	runStatsSetOutput(&runStats, output.path);
+	free(rowBases);
+	free(rowIndices);
+	free(row);
+	free(repeatRow);
+	if(!saved){
+		fprintf(stderr, "\nUnable to save the image, writing to %s failed.\n", output.path);
+		return false;
+	}
+	progress("Saved to %s (%f secs)\n\n", output.path, secs);
+	return true;
+}
+
+// Print how to use the program.
+void printUsage(FILE *stream){
+	fprintf(stream,
+		"Available usage modes:\n"
+		"./gene2pic <INPUT_FILE>\n"
+		"./gene2pic <INPUT_FILE> <SCALE>\n"
+		"./gene2pic <INPUT_FILE> <SERPENTINE>\n"
+		"./gene2pic <INPUT_FILE> <SERPENTINE> <SCALE>\n"
+		"./gene2pic --batch <LIST> [-o <OUTPUT_DIRECTORY>]\n"
+		"./gene2pic --serve <SOCKET>\n"
+		"./gene2pic --decode <IMAGE> [--region <START-END>] -o <FILE>\n"
+		"\nOptions:\n"
+		"  -s, --scale <SCALE>  Upscale the image by a positive integer.\n"
+		"      --serpentine     Flip every second row. (Same as --layout serpentine)\n"
+		"  -l, --layout <LAYOUT>  Order the bases are placed in the image: rows (default), serpentine, hilbert or morton.\n"
+		"      --stats-json <FILE>  Write the time, CPU time, sizes and throughput of each stage to FILE as JSON.\n"
+		"      --records <MODE>  How to draw files with several FASTA records: merge (one sequence, default), separate (one image each) or tiles (one tile each).\n"
+		"      --stream         Validate, colour and encode a row at a time so memory stays bounded. (For very large sequences.)\n"
+		"  -o, --output <FILE>  Write the image to FILE instead of a new GenePic<N>.png, \"-\" writes it to standard output.\n"
+		"      --batch <LIST>   Render every file listed in LIST (one per line, \"-\" for standard input) or in the directory LIST.\n"
+		"                       Each image is named after its input and saved in the -o directory. Small files are rendered at the same time.\n"
+		"      --colours <LIST>  Change the colours, for example A=ef476f,C=06c996,G=118ab2,T=ffd166,blank=000000.\n"
+		"      --serve <SOCKET>  Stay running and render the jobs sent to the Unix socket SOCKET. (See the README for the job format)\n"
+		"      --cache <DIR>    Keep every image in DIR, named by a hash of the input and options, and reuse it when the same image is asked for again.\n"
+		"      --tiles <NAME>   Write a Deep Zoom tile pyramid (NAME.dzi and NAME_files/) instead of one PNG, for viewing huge images.\n"
+		"      --downsample <MODE>  How the zoomed out tiles are shrunk: majority (most common base, default) or average (averaged colour).\n"
+		"      --width <BASES>  Put this many bases in each row instead of making a square image.\n"
+		"      --aspect <W:H>   Make the image this shape (for example 16:9) instead of a square.\n"
+		"      --png <PRESET>   How hard to compress the PNG: fastest, balanced (default) or smallest.\n"
+		"      --decode         Read the sequence back out of an image made by gene2pic and write it to the -o file (\"-\" for standard output).\n"
+		"      --region <START-END>  Only decode bases START to END (counting from 1, valid bases only), without inflating the rest of the image.\n"
+		"  -h, --help           Show this message.\n");
+}
+
+// Read a scale argument. Returns false if it is not a positive integer.
+bool parseScale(const char *arg, int *scale){
+	char *temp;
+	long value = strtol(arg, &temp, 10);
+	if(temp == arg || *temp != '\0' || value < 1 || value > INT_MAX){
+		return false;
+	}
+	*scale = (int)value;
+	return true;
+}
+
+// Read a --width argument. Returns false if it is not a positive integer.
+bool parseWidth(const char *arg, long long int *width){
+	char *temp;
+	long long int value = strtoll(arg, &temp, 10);
+	if(temp == arg || *temp != '\0' || value < 1){
+		return false;
+	}
+	*width = value;
+	return true;
+}
+
+// Read an --aspect argument, either WIDTH:HEIGHT or the width divided by the height. Returns false if it is not a positive ratio.
+bool parseAspect(const char *arg, double *aspect){
+	char *temp;
+	double value = strtod(arg, &temp);
+	if(*temp == ':'){
+		const char *heightArg = temp + 1;
+		double height = strtod(heightArg, &temp);
+		value = temp == heightArg || height <= 0 ? -1 : value / height;
+	}
+	if(temp == arg || *temp != '\0' || !(value > 0) || isinf(value)){
+		return false;
+	}
+	*aspect = value;
+	return true;
+}
+
+// Read a layout name. Returns false if it is not one we know.
+bool parseLayout(const char *arg, Layout *layout){
+	static const Layout layouts[] = {LAYOUT_ROWS, LAYOUT_SERPENTINE, LAYOUT_HILBERT, LAYOUT_MORTON};
+	for(int i = 0; i < (int)(sizeof(layouts) / sizeof(layouts[0])); i++){
+		if(strcasecmp(arg, layoutName(layouts[i])) == 0){
+			*layout = layouts[i];
+			return true;
+		}
+	}
+	return false;
+}
+
+// Name of a layout, as used on the commandline.
+const char *layoutName(Layout layout){
+	switch(layout){
+		case LAYOUT_SERPENTINE:
+			return "serpentine";
+		case LAYOUT_HILBERT:
+			return "hilbert";
+		case LAYOUT_MORTON:
+			return "morton";
+		default:
+			return "rows";
+	}
+}
+
+// Read a --region argument, START-END counting from 1 with both ends included (commas between the digits are allowed, like samtools).
+// Gives the region as bases start to end - 1 counting from 0. Returns false if it is not a valid region.
+bool parseRegion(const char *arg, long long int *start, long long int *end){
+	char digits[64];
+	size_t len = 0;
+	for(const char *c = arg; *c != '\0'; c++){
+		if(*c != ','){
+			if(len + 1 >= sizeof(digits)){
+				return false;
+			}
+			digits[len++] = *c;
+		}
+	}
+	digits[len] = '\0';
+
+	char *temp;
+	errno = 0;
+	long long int first = strtoll(digits, &temp, 10);
+	if(temp == digits || *temp != '-'){
+		return false;
+	}
+	const char *lastArg = temp + 1;
+	long long int last = strtoll(lastArg, &temp, 10);
+	if(temp == lastArg || *temp != '\0' || errno != 0 || first < 1 || last < first){
+		return false;
+	}
+	*start = first - 1;
+	*end = last;
+	return true;
+}
+
+// Read a list of colours such as "A=ef476f,T=ffd166" into the palette. The bases are A, C, G and T (or U), and "blank" is the colour
+// of the pixels after the last base. Colours are 6 hex digits, optionally starting with #. Colours which are not listed are left as
+// they are. Returns false if the list cannot be read.
+bool parseColours(const char *arg, u_char palette[PALETTE_SIZE][3]){
+	char list[256];
+	if(snprintf(list, sizeof(list), "%s", arg) >= (int)sizeof(list)){
+		return false;
+	}
+	char *savePtr = NULL;
+	for(char *entry = strtok_r(list, ",", &savePtr); NULL != entry; entry = strtok_r(NULL, ",", &savePtr)){
+		char *colour = strchr(entry, '=');
+		if(NULL == colour){
+			return false;
+		}
+		*colour++ = '\0';
+		colour += colour[0] == '#';
+
+		// The palette is in the order of the base codes, with Uracil drawn as Thymine like everywhere else.
+		int index;
+		if(strcasecmp(entry, "blank") == 0){
+			index = BLANK_INDEX;
+		}
+		else if(strlen(entry) == 1 && NULL != strchr("ACGTUacgtu", entry[0])){
+			char base = toupper(entry[0]) == 'U' ? 'T' : toupper(entry[0]);
+			index = BASE_CODE(base);
+		}
+		else{
+			return false;
+		}
+
+		if(strlen(colour) != 6 || strspn(colour, "0123456789abcdefABCDEF") != 6){
+			return false;
+		}
+		unsigned long rgb = strtoul(colour, NULL, 16);
+		palette[index][0] = (u_char)(rgb >> 16);
+		palette[index][1] = (u_char)(rgb >> 8);
+		palette[index][2] = (u_char)rgb;
+	}
+	return true;
+}
+
+// Read a records mode name. Returns false if it is not one we know.
+bool parseRecordMode(const char *arg, RecordMode *mode){
+	if(strcasecmp(arg, "merge") == 0){
+		*mode = RECORDS_MERGE;
+	}
+	else if(strcasecmp(arg, "separate") == 0){
+		*mode = RECORDS_SEPARATE;
+	}
+	else if(strcasecmp(arg, "tiles") == 0){
+		*mode = RECORDS_TILES;
+	}
+	else{
+		return false;
+	}
+	return true;
+}
+
+// Fill in the render options from the commandline. The original positional forms (<INPUT_FILE> [SERPENTINE] [SCALE]) still work
+// alongside the named options. Returns false (after telling the user what was wrong) if the arguments are not usable.
+bool parseArguments(int argc, char *argv[], RenderOptions *options){
+	options->inputFile = INPUT_FILE_HARDCODED;
+	options->scale = SCALE_HARDCODED;
+	options->layout = SERPENTINE_HARDCODED ? LAYOUT_SERPENTINE : LAYOUT_ROWS;
+	options->stream = false;
+	options->statsJsonFile = NULL;
+	options->records = RECORDS_MERGE;
+	options->outputFile = NULL;
+	options->batchList = NULL;
+	options->serveSocket = NULL;
+	options->cacheDir = NULL;
+	options->tilesName = NULL;
+	options->downsample = DOWNSAMPLE_MAJORITY;
+	options->width = 0;
+	options->aspect = 0;
+	options->png = PNG_PRESET_BALANCED;
+	options->decode = false;
+	options->regionStart = 0;
+	options->regionEnd = 0;
+	options->help = false;
+	u_char defaultPalette[PALETTE_SIZE][3] = PALETTE_COLOURS;
+	memcpy(options->palette, defaultPalette, sizeof(options->palette));
+
+	// See if we should check the commandline arguments or use hardcoded ones instead.
+	if(USE_HARDCODED_ARGS){
+		return true;
+	}
+
+	static const struct option longOptions[] = {
+		{"scale",		required_argument,	NULL, 's'},
+		{"serpentine",	no_argument,		NULL, OPTION_SERPENTINE},
+		{"stats-json",	required_argument,	NULL, OPTION_STATS_JSON},
+		{"records",		required_argument,	NULL, OPTION_RECORDS},
+		{"output",		required_argument,	NULL, 'o'},
+		{"layout",		required_argument,	NULL, 'l'},
+		{"stream",		no_argument,		NULL, OPTION_STREAM},
+		{"batch",		required_argument,	NULL, OPTION_BATCH},
+		{"colours",		required_argument,	NULL, OPTION_COLOURS},
+		{"serve",		required_argument,	NULL, OPTION_SERVE},
+		{"cache",		required_argument,	NULL, OPTION_CACHE},
+		{"tiles",		required_argument,	NULL, OPTION_TILES},
+		{"downsample",	required_argument,	NULL, OPTION_DOWNSAMPLE},
+		{"width",		required_argument,	NULL, OPTION_WIDTH},
+		{"aspect",		required_argument,	NULL, OPTION_ASPECT},
+		{"png",			required_argument,	NULL, OPTION_PNG},
+		{"decode",		no_argument,		NULL, OPTION_DECODE},
+		{"region",		required_argument,	NULL, OPTION_REGION},
+		{"help",		no_argument,		NULL, 'h'},
+		{NULL, 0, NULL, 0}
+	};
+	bool downsampleGiven = false;	// --downsample only applies to --tiles, so it is refused without it.
+	int opt;
+	while((opt = getopt_long(argc, argv, "s:l:o:h", longOptions, NULL)) != -1){
+		switch(opt){
+			case 's':
+				if(!parseScale(optarg, &options->scale)){
+					fprintf(stderr, "Invalid data in scale argument. Must be a non-zero integer.\n");
+					return false;
+				}
+				break;
+			case OPTION_SERPENTINE:
+				options->layout = LAYOUT_SERPENTINE;
+				break;
+			case 'o':
+				options->outputFile = optarg;
+				break;
+			case OPTION_STATS_JSON:
+				options->statsJsonFile = optarg;
+				break;
+			case OPTION_RECORDS:
+				if(!parseRecordMode(optarg, &options->records)){
+					fprintf(stderr, "Unknown records mode \"%s\". Must be merge, separate or tiles.\n", optarg);
+					return false;
+				}
+				break;
+			case 'l':
+				if(!parseLayout(optarg, &options->layout)){
+					fprintf(stderr, "Unknown layout \"%s\". Must be rows, serpentine, hilbert or morton.\n", optarg);
+					return false;
+				}
+				break;
+			case OPTION_STREAM:
+				options->stream = true;
+				break;
+			case OPTION_BATCH:
+				options->batchList = optarg;
+				break;
+			case OPTION_COLOURS:
+				if(!parseColours(optarg, options->palette)){
+					fprintf(stderr, "Invalid colours \"%s\". Must be a list like A=ef476f,C=06c996,G=118ab2,T=ffd166,blank=000000.\n", optarg);
+					return false;
+				}
+				break;
+			case OPTION_SERVE:
+				options->serveSocket = optarg;
+				break;
+			case OPTION_CACHE:
+				options->cacheDir = optarg;
+				break;
+			case OPTION_TILES:
+				options->tilesName = optarg;
+				break;
+			case OPTION_DOWNSAMPLE:
+				if(!parseDownsampleMode(optarg, &options->downsample)){
+					fprintf(stderr, "Unknown downsample mode \"%s\". Must be majority or average.\n", optarg);
+					return false;
+				}
+				downsampleGiven = true;
+				break;
+			case OPTION_WIDTH:
+				if(!parseWidth(optarg, &options->width)){
+					fprintf(stderr, "Invalid width \"%s\". Must be a positive number of bases.\n", optarg);
+					return false;
+				}
+				break;
+			case OPTION_ASPECT:
+				if(!parseAspect(optarg, &options->aspect)){
+					fprintf(stderr, "Invalid aspect ratio \"%s\". Must be a positive WIDTH:HEIGHT such as 16:9, or one number such as 1.5.\n", optarg);
+					return false;
+				}
+				break;
+			case OPTION_PNG:
+				if(!parsePngPreset(optarg, &options->png)){
+					fprintf(stderr, "Unknown PNG preset \"%s\". Must be fastest, balanced or smallest.\n", optarg);
+					return false;
+				}
+				break;
+			case OPTION_DECODE:
+				options->decode = true;
+				break;
+			case OPTION_REGION:
+				if(!parseRegion(optarg, &options->regionStart, &options->regionEnd)){
+					fprintf(stderr, "Invalid region \"%s\". Must be START-END counting from 1, such as 10,000,001-10,050,000.\n", optarg);
+					return false;
+				}
+				break;
+			case 'h':
+				options->help = true;
+				return true;
+			default:
+				printUsage(stderr);
+				return false;
+		}
+	}
+
+	// Positional arguments, the input file followed by the optional serpentine and scale arguments. A batch lists its own input files.
+	int positional = argc - optind;
+	if(options->regionEnd > 0 && !options->decode){
+		fprintf(stderr, "--region picks which bases --decode reads out of an image, it can only be used with --decode.\n");
+		return false;
+	}
+	if(downsampleGiven && NULL == options->tilesName){
+		fprintf(stderr, "--downsample picks how the zoomed out levels of a tile pyramid are made, it can only be used with --tiles.\n");
+		return false;
+	}
+	if(options->decode){
+		// Decoding takes one image and writes its sequence, none of the options about making images apply.
+		if(positional != 1 || NULL == options->outputFile){
+			fprintf(stderr, "--decode needs one image and -o FILE (or -o - for standard output) to write its sequence to.\n");
+			return false;
+		}
+		if(options->stream || NULL != options->batchList || NULL != options->serveSocket || NULL != options->tilesName || NULL != options->cacheDir
+			|| options->records != RECORDS_MERGE){
+			fprintf(stderr, "--decode cannot be used with --stream, --batch, --serve, --tiles, --cache or --records separate/tiles.\n");
+			return false;
+		}
+		options->inputFile = argv[optind];
+		return true;
+	}
+	if(NULL != options->serveSocket){
+		if(positional != 0 || NULL != options->batchList){
+			fprintf(stderr, "--serve takes its input files and options from the jobs sent to it, not from the commandline.\n");
+			return false;
+		}
+	}
+	else if(NULL != options->batchList){
+		if(positional != 0){
+			fprintf(stderr, "Input files for --batch go in the batch list, not on the commandline.\n");
+			return false;
+		}
+		if(options->records == RECORDS_SEPARATE || (NULL != options->outputFile && strcmp(options->outputFile, "-") == 0)){
+			fprintf(stderr, "--batch writes one image per input into the --output directory, so it cannot be used with --records separate or -o -.\n");
+			return false;
+		}
+	}
+	else if(positional < 1 || positional > 3){
+		fprintf(stderr, "Incorrect number of arguments!\n");
+		printUsage(stderr);
+		return false;
+	}
+	if(positional >= 1){
+		options->inputFile = argv[optind];
+	}
+	if(positional == 2){
+		// Only 2 arguments provided. Input file is first one and scale or serpentine is second. Find out which it is.
+		char *arg = argv[optind + 1];
+		if(strcmp(arg, "serpentine") == 0 || strcmp(arg, "SERPENTINE") == 0){
+			// Argument matches the serpentine string, so enable serpentine mode.
+			options->layout = LAYOUT_SERPENTINE;
+		}
+		else if(!parseScale(arg, &options->scale)){
+			// Argument matches neither scale or serpentine, inform user.
+			fprintf(stderr, "Invalid data in last argument.\nFor serpentine it must be \"serpentine\" or be blank, and for scale it must be a non-zero integer.\nUsage: ./gene2pic <INPUT_FILE> <SERPENTINE> <SCALE>\n");
+			return false;
+		}
+	}
+	else if(positional == 3){
+		// 3 arguments provided. Make sure they are in the right order and have acceptable values.
+		char *arg = argv[optind + 1];
+		if(strcmp(arg, "serpentine") == 0 || strcmp(arg, "SERPENTINE") == 0){
+			options->layout = LAYOUT_SERPENTINE;
+		}
+		else{
+			fprintf(stderr, "Invalid data for serpentine argument. Must be \"serpentine\" or left empty.\nUsage: ./gene2pic <INPUT_FILE> <SERPENTINE> <SCALE>\n");
+			return false;
+		}
+		if(!parseScale(argv[optind + 2], &options->scale)){
+			fprintf(stderr, "Invalid data in scale argument. Must be a non-zero integer.\nUsage: ./gene2pic <INPUT_FILE> <SERPENTINE> <SCALE>\n");
+			return false;
+		}
+	}
+
+	// Streaming works a row at a time, so it cannot follow a curve around the image.
+	if(NULL != options->serveSocket){
+		return true;
+	}
+	if(options->stream && options->layout != LAYOUT_ROWS && options->layout != LAYOUT_SERPENTINE){
+		fprintf(stderr, "The %s layout cannot be streamed, only the rows and serpentine layouts can.\n", layoutName(options->layout));
+		return false;
+	}
+	if(NULL != options->outputFile && options->records == RECORDS_SEPARATE && NULL == options->batchList){
+		fprintf(stderr, "--output cannot be used with --records separate, each record needs its own file.\n");
+		return false;
+	}
+	if(NULL != options->tilesName && (options->stream || NULL != options->outputFile || NULL != options->batchList || NULL != options->cacheDir
+		|| options->records != RECORDS_MERGE)){
+		fprintf(stderr, "--tiles writes a whole directory of tiles, so it cannot be used with --stream, --output, --batch, --cache or --records separate/tiles.\n");
+		return false;
+	}
+	if(options->stream && options->records != RECORDS_MERGE){
+		fprintf(stderr, "Records can only be merged when streaming.\n");
+		return false;
+	}
+	if(options->width > 0 && options->aspect > 0){
+		fprintf(stderr, "--width and --aspect both set the shape of the image, only one of them can be used.\n");
+		return false;
+	}
+	return true;
+}
+
+// Print how long the whole run took and write the --stats-json report if one was asked for. Returns the exit status for main().
+int finishRun(const RenderOptions *options){
+	progress("DONE. Took %f seconds.\n", stageTimerElapsed(&runStats.total));
+	if(saveFailed){
+		return EXIT_FAILURE;
+	}
+	runStatsFinish(&runStats);
+	if(NULL != options->statsJsonFile && !runStatsWriteJson(&runStats, 1, false, options->statsJsonFile)){
+		fprintf(stderr, "Unable to write stats to %s.\n", options->statsJsonFile);
+		return EXIT_FAILURE;
+	}
+	return EXIT_SUCCESS;
+}
+
+// Work out where the image for this input and these render options is kept in the --cache directory. The key is a hash of the raw
+// input rather than of the valid bases, so a repeat only costs the hash and not the validation. Returns false if there is no cache
+// (or the input cannot be hashed, then the image is just rendered without one).
+bool findCachedImage(const InputBuffer *input, const RenderOptions *options, char *path, size_t size){
+	if(NULL == options->cacheDir || options->records == RECORDS_SEPARATE){
+		return false;	// One image per record does not fit in one cache entry.
+	}
+	StageTimer timer;
+	stageTimerStart(&timer);
+	CacheKey key;
+	if(!hashContent((const u_char *)input->data, input->len, &key)){
+		return false;
+	}
+
+	// Everything which changes the image. Zeroed first so the padding between the fields is always the same.
+	struct{
+		int version;
+		int scale;
+		int layout;
+		int records;
+		int stream;
+		long long int width;
+		double aspect;
+		int png;
+		u_char palette[PALETTE_SIZE][3];
+	} params;
+	memset(&params, 0, sizeof(params));
+	params.version = RENDER_CACHE_VERSION;
+	params.scale = options->scale;
+	params.layout = options->layout;
+	params.records = options->records;
+	params.stream = options->stream;
+	params.width = options->width;
+	params.aspect = options->aspect;
+	params.png = options->png;
+	memcpy(params.palette, options->palette, sizeof(params.palette));
+	key = cacheKeyAdd(key, &params, sizeof(params));
+	runStatsAddStage(&runStats, "hash", &timer, input->len, 0, 0);
+	return renderCachePath(options->cacheDir, key, path, size);
+}
+
+/*
+	Check that an image in the cache is whole before it is used: the PNG signature, a header chunk first, every chunk inside the file and
+	an IEND chunk right at the end of it, and gene2pic metadata which can be read (required if needsMetadata, checked whenever there is
+	some). Only the chunk headers are read, skipping over the image data, so this stays quick however big the image is. Returns the
+	number of bases from the metadata, 0 if the image has none, or -1 if it is missing or damaged.
+*/
+long long int checkCachedImage(const char *cachePath, bool needsMetadata){
+	FILE *cached = fopen(cachePath, "rb");
+	if(NULL == cached){
+		return -1;
+	}
+	struct stat fileInfo;
+	u_char signature[8];
+	static const u_char pngSignature[8] = {137, 80, 78, 71, 13, 10, 26, 10};
+	if(fstat(fileno(cached), &fileInfo) != 0 || fread(signature, 1, sizeof(signature), cached) != sizeof(signature) || memcmp(signature, pngSignature, 8) != 0){
+		fclose(cached);
+		return -1;
+	}
+
+	long long int bases = -1;	// Until metadata is found.
+	bool whole = false;
+	u_int64_t pos = 8;
+	u_char header[8];
+	while(pos + 12 <= (u_int64_t)fileInfo.st_size && fseeko(cached, (off_t)pos, SEEK_SET) == 0 && fread(header, 1, sizeof(header), cached) == sizeof(header)){
+		u_int64_t chunkEnd = pos + 12 + lodepng_chunk_length(header);
+		if(chunkEnd > (u_int64_t)fileInfo.st_size || (pos == 8 && !lodepng_chunk_type_equals(header, "IHDR"))){
+			break;
+		}
+		if(lodepng_chunk_type_equals(header, "IEND")){
+			whole = chunkEnd == (u_int64_t)fileInfo.st_size;
+			break;
+		}
+		unsigned chunkLen = lodepng_chunk_length(header);
+		char text[IMAGE_METADATA_SIZE + sizeof(IMAGE_METADATA_KEYWORD)];
+		if(bases < 0 && lodepng_chunk_type_equals(header, "tEXt") && chunkLen < sizeof(text)){
+			if(fread(text, 1, chunkLen, cached) != chunkLen){
+				break;
+			}
+			text[chunkLen] = '\0';
+			ImageMetadata metadata;
+			if(strcmp(text, IMAGE_METADATA_KEYWORD) == 0){
+				if(!parseImageMetadata(text + sizeof(IMAGE_METADATA_KEYWORD), &metadata)){
+					break;	// Damaged metadata.
+				}
+				bases = metadata.len;
+			}
+		}
+		pos = chunkEnd;
+	}
+	fclose(cached);
+	if(!whole || (needsMetadata && bases < 0)){
+		return -1;
+	}
+	return bases < 0 ? 0 : bases;
+}
+
+// Copy an image from the cache to where the image should be saved. Returns false (after saying why) if it could not be copied.
+bool copyCachedImage(const char *cachePath){
+	StageTimer timer;
+	stageTimerStart(&timer);
+	FILE *cached = fopen(cachePath, "rb");
+	if(NULL == cached){
+		fprintf(stderr, "\nUnable to read the cached image %s.\n", cachePath);
+		return false;
+	}
+	OutputFile output;
+	if(!openOutputFile(&output)){
+		fclose(cached);
+		return false;
+	}
+
+	// The width and height are in the header chunk, which is always first.
+	u_char buffer[64 * 1024];
+	size_t len = fread(buffer, 1, sizeof(buffer), cached);
+	if(len >= 24){
+		runStats.width = ((u_int64_t)buffer[16] << 24) | (buffer[17] << 16) | (buffer[18] << 8) | buffer[19];
+		runStats.height = ((u_int64_t)buffer[20] << 24) | (buffer[21] << 16) | (buffer[22] << 8) | buffer[23];
+	}
+	bool written = true;
+	u_int64_t total = 0;
+	while(len > 0 && written){
+		written = fwrite(buffer, 1, len, output.file) == len;
+		total += len;
+		len = fread(buffer, 1, sizeof(buffer), cached);
+	}
+	written = written && !ferror(cached);
+	fclose(cached);
+
+	if(!closeOutputFile(&output, written)){
+		fprintf(stderr, "\nUnable to save the image, writing to %s failed.\n", output.path);
+		return false;
+	}
+	double secs = runStatsAddStage(&runStats, "cache_copy", &timer, total, total, 0);
+	runStatsSetOutput(&runStats, output.path);
+	progress("Copied the cached image to %s (%f secs)\n\n", output.path, secs);
+	return true;
+}
+
+// Render the image for an input which has been read. Takes care of releasing the input. Returns false if no image could be made.
+bool renderInput(InputBuffer *input, const RenderOptions *options){
+	// Compressed input (.gz or bgzip) is decompressed into memory first.
+	if(isGzip((const u_char *)input->data, input->len) && !decompressInput(input)){
+		releaseInput(input);
+		return false;
+	}
+
+	// In streaming mode the sequence and image are never held in memory, the input is validated, coloured and encoded a row at a time.
+	if(options->stream){
+		bool rendered = renderStreaming(input, options);
+		releaseInput(input);
+		return rendered;
+	}
+
+	// Place to hold the valid bases, packed 4 to a byte. Zeroed so any unused bits in the last byte are always the same.
+	u_char *packedSequence = (u_char *)calloc(PACKED_SEQUENCE_BYTES(input->len), sizeof(u_char));
+	if(NULL == packedSequence){
+		fprintf(stderr, "Unable to allocate packedSequence array... May have run out of RAM.\n");
+		releaseInput(input);
+		return false;
+	}
+
+	// Remove any invalid characters (and FASTA headers) from the input sequence and determine how many valid bases there are.
+	FastaParser parser;
+	fastaParserInit(&parser);
+	long long int validBaseCount = readAndValidateInput(packedSequence, input, &parser);
+	releaseInput(input);	// Done with the input file, the valid bases are in packedSequence now.
+	if(validBaseCount < 0){
+		fastaParserFree(&parser);
+		free(packedSequence);
+		return false;
+	}
+	if(validBaseCount < 1){
+		// No valid bases.
+		fprintf(stderr, "Input file has 0 valid characters... Exiting.\n");
+		fastaParserFree(&parser);
+		free(packedSequence);
+		return false;
+	}
+
+	// Give back the space at the end of the array which was reserved for the invalid characters.
+	u_char *trimmedSequence = (u_char *)realloc(packedSequence, PACKED_SEQUENCE_BYTES(validBaseCount) * sizeof(u_char));
+	if(NULL != trimmedSequence){
+		packedSequence = trimmedSequence;
+	}
+
+	runStats.bases = validBaseCount;
+	runStats.records = parser.numRecords;
+	if(parser.numRecords > 1){
+		progress("Input has %lld records.\n", parser.numRecords);
+	}
+
+	// Multi-record files can be drawn as one long sequence, one image per record or one tile per record.
+	if(options->records == RECORDS_SEPARATE && parser.numRecords > 1){
+		renderRecords(packedSequence, &parser, options);
+	}
+	else if(options->records == RECORDS_TILES && parser.numRecords > 1){
+		renderTiles(packedSequence, &parser, options);
+	}
+	else{
+		renderSequence(packedSequence, validBaseCount, options);
+	}
+
+	fastaParserFree(&parser);
+	free(packedSequence);	// Free the packed sequence.
+	return !saveFailed;
+}
+
+/*
+	Render one input file following the render options, writing the image to outputFile (NULL picks a new GenePic<N>.png). Everything
+	about the file is kept in this thread's copy of the per-file state, so several files can be rendered at once on different threads.
+	Returns false (after saying what went wrong) if no image could be made.
+*/
+bool renderFile(const char *inputFile, const char *outputFile, const RenderOptions *options){
+	// Start timer to see how long the whole file takes.
+	runStatsInit(&runStats);
+	snprintf(runStats.inputFile, sizeof(runStats.inputFile), "%s", inputFile);
+	runStats.scale = options->scale;
+	runStats.layout = layoutName(options->layout);
+	runStats.simd = simdLevelName(validationLevel);
+	runStats.threads = omp_in_parallel() ? 1 : omp_get_max_threads();
+	outputPath = outputFile;
+	saveFailed = false;
+	memcpy(paletteColours, options->palette, sizeof(paletteColours));
+	pngPresetEncoderSettings(options->png, options->scale == 1 && !(NULL != options->tilesName && options->downsample == DOWNSAMPLE_AVERAGE), &pngEncoder);
+	imageMetadata[0] = '\0';
+
+	// Memory map the input file if possible, otherwise read it into a heap buffer.
+	InputBuffer input;
+	StageTimer timer;
+	stageTimerStart(&timer);
+	bool fromStdin = strcmp(inputFile, "-") == 0;
+	if(options->stream && (fromStdin || !mapInputFile(inputFile, &input))){
+		// Streaming should not hold the whole input on the heap, so standard input and pipes are copied to a file first.
+		if(!spoolInputFile(inputFile, &input)){
+			return false;
+		}
+	}
+	else if((fromStdin || !mapInputFile(inputFile, &input)) && !readInputFile(inputFile, &input)){
+		// Error when opening the file, the file was not found or it is something like a directory.
+		return false;
+	}
+	runStatsAddStage(&runStats, "read", &timer, input.len, input.len, 0);
+	runStats.inputBytes = input.len;
+	progress("Input file is %lld characters.\n\n", input.len);
+
+	// With --cache the image is rendered into the cache, then copied from there to where it should be saved.
+	char cachePath[PATH_MAX];
+	if(!findCachedImage(&input, options, cachePath, sizeof(cachePath))){
+		return renderInput(&input, options);
+	}
+	// A cache hit never sees the bases, the count comes from the image's metadata instead. (--records tiles images have none, then
+	// the count is left out of the report.) A damaged entry is rendered again and replaced.
+	long long int cachedBases = checkCachedImage(cachePath, options->records != RECORDS_TILES);
+	if(cachedBases >= 0){
+		progress("Found the image in the cache.\n");
+		releaseInput(&input);
+		runStats.bases = cachedBases;
+		runStats.basesUnknown = cachedBases == 0;
+		saveFailed = !copyCachedImage(cachePath);
+		return !saveFailed;
+	}
+	if(access(cachePath, F_OK) == 0){
+		progress("The cached image %s is damaged, rendering it again.\n", cachePath);
+	}
+	FILE *stream = imageStream;
+	outputPath = cachePath;
+	imageStream = NULL;
+	bool rendered = renderInput(&input, options);
+	outputPath = outputFile;
+	imageStream = stream;
+	if(rendered){
+		saveFailed = !copyCachedImage(cachePath);
+	}
+	return rendered && !saveFailed;
+}
+
+// Read the list of inputs for a batch. A directory gives every regular file in it (in name order), anything else is read as a
+// list of files with one per line ("-" reads the list from standard input). Blank lines and lines starting with # are skipped.
+// Returns a malloc'd array of malloc'd paths and sets numInputs, or NULL (after saying why) if the list could not be read.
+char **listBatchInputs(const char *list, long long int *numInputs){
+	long long int capacity = 64;
+	char **inputs = (char **)malloc(capacity * sizeof(char *));
+	*numInputs = 0;
+	struct stat listInfo;
+	bool isDirectory = strcmp(list, "-") != 0 && stat(list, &listInfo) == 0 && S_ISDIR(listInfo.st_mode);
+	DIR *directory = isDirectory ? opendir(list) : NULL;
+	FILE *listFile = isDirectory ? NULL : strcmp(list, "-") == 0 ? stdin : fopen(list, "r");
+	if(NULL == directory && NULL == listFile){
+		fprintf(stderr, "Unable to read the batch list %s.\n", list);
+		free(inputs);
+		return NULL;
+	}
+
+	char line[PATH_MAX];
+	while(true){
+		char *path = NULL;
+		if(isDirectory){
+			struct dirent *entry = readdir(directory);
+			if(NULL == entry){
+				break;
+			}
+			if(entry->d_name[0] == '.'){
+				continue;	// Hidden files, and the directory itself and its parent.
+			}
+			path = path_join((char *)list, entry->d_name, strlen(entry->d_name));
+			struct stat info;
+			if(NULL != path && (stat(path, &info) != 0 || !S_ISREG(info.st_mode))){
+				free(path);
+				continue;
+			}
+		}
+		else{
+			if(NULL == fgets(line, sizeof(line), listFile)){
+				break;
+			}
+			line[strcspn(line, "\r\n")] = '\0';
+			if(line[0] == '\0' || line[0] == '#'){
+				continue;
+			}
+			path = strdup(line);
+		}
+
+		if(*numInputs == capacity){
+			capacity *= 2;
+			inputs = (char **)realloc(inputs, capacity * sizeof(char *));
+		}
+		if(NULL == path || NULL == inputs){
+			fprintf(stderr, "Unable to allocate batch list... May have run out of RAM.\n");
+			exit(EXIT_FAILURE);
+		}
+		inputs[(*numInputs)++] = path;
+	}
+
+	if(isDirectory){
+		closedir(directory);
+		qsort(inputs, *numInputs, sizeof(char *), compareStrings);
+	}
+	else if(listFile != stdin){
+		fclose(listFile);
+	}
+	return inputs;
+}
+
+// Compare two strings through pointers to them, for qsort().
+int compareStrings(const void *a, const void *b){
+	return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+// Name of the image for a batch input: its file name with the extension (and any .gz) swapped for .png, in outputDir.
+char *batchOutputName(const char *inputFile, const char *outputDir){
+	const char *slash = strrchr(inputFile, '/');
+	char name[FILENAME_BUFFER_SIZE];
+	snprintf(name, sizeof(name) - strlen(IMAGE_EXTENSION), "%s", NULL == slash ? inputFile : slash + 1);
+	for(int i = 0; i < 2; i++){
+		char *dot = strrchr(name, '.');
+		bool compressed = NULL != dot && (strcmp(dot, ".gz") == 0 || strcmp(dot, ".bgz") == 0);
+		if(NULL != dot && dot != name){
+			*dot = '\0';
+		}
+		if(!compressed){
+			break;	// Only look for a second extension under .gz, so "ebola.txt.gz" and "ebola.txt" both become "ebola".
+		}
+	}
+	strcat(name, IMAGE_EXTENSION);
+	return path_join((char *)outputDir, name, strlen(name));
+}
+
+// Compare two batch jobs by the name of their image, for qsort().
+int compareBatchOutputs(const void *a, const void *b){
+	return strcmp((*(BatchJob *const *)a)->outputFile, (*(BatchJob *const *)b)->outputFile);
+}
+
+// Make sure no two inputs of a batch would be saved to the same image, such as "a/x.txt" and "b/x.txt" or "y.txt" and "y.txt.gz".
+// Only one of them would be left afterwards (which one depends on the order the threads finish in), so the whole batch is refused.
+// Returns false (after naming every clash) if any image name is used more than once.
+bool checkBatchOutputNames(BatchJob *jobs, long long int numJobs){
+	BatchJob **sorted = (BatchJob **)malloc((numJobs > 0 ? numJobs : 1) * sizeof(BatchJob *));
+	if(NULL == sorted){
+		fprintf(stderr, "Unable to allocate batch jobs... May have run out of RAM.\n");
+		exit(EXIT_FAILURE);
+	}
+	for(long long int i = 0; i < numJobs; i++){
+		sorted[i] = &jobs[i];
+	}
+	qsort(sorted, numJobs, sizeof(BatchJob *), compareBatchOutputs);
+
+	bool unique = true;
+	for(long long int i = 1; i < numJobs; i++){
+		if(strcmp(sorted[i - 1]->outputFile, sorted[i]->outputFile) == 0){
+			fprintf(stderr, "Batch inputs %s and %s would both be saved to %s.\n", sorted[i - 1]->inputFile, sorted[i]->inputFile, sorted[i]->outputFile);
+			unique = false;
+		}
+	}
+	free(sorted);
+	if(!unique){
+		fprintf(stderr, "Rename the inputs or split them into separate batches so each image gets its own name.\n");
+	}
+	return unique;
+}
+
+// Render one file of a batch and report how it went in one line.
+void renderBatchJob(BatchJob *job, const RenderOptions *options){
+	job->rendered = renderFile(job->inputFile, job->outputFile, options);
+	runStatsFinish(&runStats);
+	job->stats = runStats;
+	#pragma omp critical(batchReport)
+	{
+		if(job->rendered){
+			if(job->stats.basesUnknown){
+				printf("Rendered %s -> %s (%f secs)\n", job->inputFile, job->outputFile, job->stats.wallSecs);
+			}
+			else{
+				printf("Rendered %s -> %s (%llu bases, %f secs)\n", job->inputFile, job->outputFile, (unsigned long long)job->stats.bases, job->stats.wallSecs);
+			}
+		}
+		else{
+			printf("FAILED   %s\n", job->inputFile);
+		}
+		fflush(stdout);
+	}
+}
+
+/*
+	Render every input of a batch in one process. Each image is named after its input and written to the -o directory (the current
+	directory by default). Files at least BATCH_LARGE_FILE_SIZE bytes are rendered one at a time with every thread working on each
+	stage, as they would be on their own. The small files are too small for that to help, so they are rendered at the same time,
+	one per thread, each running its stages on that one thread. Both share the one OpenMP thread pool.
+*/
+int runBatch(const RenderOptions *options){
+	long long int numInputs = 0;
+	char **inputs = listBatchInputs(options->batchList, &numInputs);
+	if(NULL == inputs){
+		return EXIT_FAILURE;
+	}
+	const char *outputDir = NULL == options->outputFile ? "." : options->outputFile;
+	struct stat dirInfo;
+	if(stat(outputDir, &dirInfo) != 0 || !S_ISDIR(dirInfo.st_mode)){
+		fprintf(stderr, "Batch output directory %s does not exist.\n", outputDir);
+		return EXIT_FAILURE;
+	}
+
+	BatchJob *jobs = (BatchJob *)calloc(numInputs > 0 ? numInputs : 1, sizeof(BatchJob));
+	if(NULL == jobs){
+		fprintf(stderr, "Unable to allocate batch jobs... May have run out of RAM.\n");
+		exit(EXIT_FAILURE);
+	}
+	for(long long int i = 0; i < numInputs; i++){
+		struct stat info;
+		jobs[i].inputFile = inputs[i];
+		jobs[i].outputFile = batchOutputName(inputs[i], outputDir);
+		jobs[i].large = stat(inputs[i], &info) == 0 && info.st_size >= BATCH_LARGE_FILE_SIZE;
+		if(NULL == jobs[i].outputFile){
+			fprintf(stderr, "Unable to allocate batch output name... May have run out of RAM.\n");
+			exit(EXIT_FAILURE);
+		}
+	}
+	if(!checkBatchOutputNames(jobs, numInputs)){
+		return EXIT_FAILURE;
+	}
+
+	printf("Rendering %lld files with %d threads...\n", numInputs, omp_get_max_threads());
+	StageTimer timer;
+	stageTimerStart(&timer);
+	showProgress = false;
+	omp_set_max_active_levels(1);	// Stages of the small files stay on the thread that is rendering them.
+
+	for(long long int i = 0; i < numInputs; i++){
+		if(jobs[i].large){
+			renderBatchJob(&jobs[i], options);
+		}
+	}
+	#pragma omp parallel
+	{
+		runStatsUseThreadCpuTime(true);	// CPU time of the whole process would include the other files being rendered.
+		#pragma omp for schedule(dynamic, 1)
+		for(long long int i = 0; i < numInputs; i++){
+			if(!jobs[i].large){
+				renderBatchJob(&jobs[i], options);
+			}
+		}
+		runStatsUseThreadCpuTime(false);
+	}
+
+	long long int failed = 0;
+	for(long long int i = 0; i < numInputs; i++){
+		failed += !jobs[i].rendered;
+	}
+	printf("\nDONE. Rendered %lld of %lld files in %f seconds.\n", numInputs - failed, numInputs, stageTimerElapsed(&timer));
+
+	// One report per file.
+	bool statsWritten = true;
+	if(NULL != options->statsJsonFile){
+		RunStats *stats = (RunStats *)malloc((numInputs > 0 ? numInputs : 1) * sizeof(RunStats));
+		if(NULL == stats){
+			fprintf(stderr, "Unable to allocate batch stats... May have run out of RAM.\n");
+			exit(EXIT_FAILURE);
+		}
+		for(long long int i = 0; i < numInputs; i++){
+			stats[i] = jobs[i].stats;
+		}
+		statsWritten = runStatsWriteJson(stats, numInputs, true, options->statsJsonFile);
+		if(!statsWritten){
+			fprintf(stderr, "Unable to write stats to %s.\n", options->statsJsonFile);
+		}
+		free(stats);
+	}
+
+	for(long long int i = 0; i < numInputs; i++){
+		free(jobs[i].inputFile);
+		free(jobs[i].outputFile);
+	}
+	free(jobs);
+	free(inputs);
+	return failed == 0 && statsWritten ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+// Set by SIGINT and SIGTERM to stop the daemon once the job it is working on is done.
+static volatile sig_atomic_t daemonStopping = 0;
+
+// Signal handler which asks the daemon to stop.
+void stopDaemon(int signal){
+	(void)signal;
+	daemonStopping = 1;
+}
+
+// Split a daemon job into arguments at spaces and tabs, the same way a shell would for simple commands. Double quotes group an argument
+// with spaces in it and a backslash keeps the next character as it is. The arguments are written over line and pointed to from argv,
+// after a first argument standing in for the program name. Returns the number of arguments, or -1 if there are more than maxArgs or a
+// quote is not closed.
+int splitJobArguments(char *line, char *argv[], int maxArgs){
+	static char programName[] = "gene2pic";
+	int argc = 0;
+	argv[argc++] = programName;
+	char *read = line;
+	char *write = line;	// Never ahead of read, since quotes and backslashes are dropped.
+	while(true){
+		while(*read == ' ' || *read == '\t'){
+			read++;
+		}
+		if(*read == '\0'){
+			break;
+		}
+		if(argc == maxArgs){
+			return -1;
+		}
+		argv[argc++] = write;
+		bool quoted = false;
+		while(*read != '\0' && (quoted || (*read != ' ' && *read != '\t'))){
+			if(*read == '"'){
+				quoted = !quoted;
+				read++;
+			}
+			else if(*read == '\\' && read[1] != '\0'){
+				*write++ = read[1];
+				read += 2;
+			}
+			else{
+				*write++ = *read++;
+			}
+		}
+		if(quoted){
+			return -1;
+		}
+		bool lastArgument = *read == '\0';
+		*write++ = '\0';
+		if(lastArgument){
+			break;
+		}
+		read++;
+	}
+	argv[argc] = NULL;
+	return argc;
+}
+
+// Send all len bytes to a daemon client. Returns false if the client went away.
+bool sendToClient(int client, const void *data, size_t len){
+	const char *next = (const char *)data;
+	while(len > 0){
+		ssize_t sent = send(client, next, len, MSG_NOSIGNAL);
+		if(sent < 0 && errno == EINTR){
+			continue;
+		}
+		if(sent <= 0){
+			return false;
+		}
+		next += sent;
+		len -= sent;
+	}
+	return true;
+}
+
+/*
+	Run one daemon job. The client sends one line with the arguments for the job, the same as they would be given on the commandline
+	(for example "ebola.txt --layout hilbert -s 2 --colours A=ff0000"). The image is rendered into memory and sent back after a line
+	"OK <BYTES>", or a line "ERROR <REASON>" is sent if it could not be made. Relative paths are relative to where the daemon was started.
+	Jobs use the daemon's --cache, if it has one.
+*/
+void runDaemonJob(int client, const RenderOptions *daemonOptions){
+	// Read up to the end of the first line, or until the client stops sending.
+	char request[DAEMON_MAX_REQUEST];
+	size_t len = 0;
+	while(len < sizeof(request) - 1){
+		ssize_t got = recv(client, request + len, sizeof(request) - 1 - len, 0);
+		if(got < 0 && errno == EINTR && !daemonStopping){
+			continue;
+		}
+		if(got <= 0){
+			break;
+		}
+		len += got;
+		if(NULL != memchr(request + len - got, '\n', got)){
+			break;
+		}
+	}
+	request[len] = '\0';
+	request[strcspn(request, "\r\n")] = '\0';
+	char job[DAEMON_MAX_REQUEST];
+	memcpy(job, request, sizeof(job));	// The arguments are split in place, keep the job as it was sent for the log.
+
+	// Parse the job like a commandline. Anything that would write somewhere other than back to the client is not allowed.
+	const char *error = NULL;
+	char *argv[DAEMON_MAX_ARGS + 1];
+	int argc = splitJobArguments(request, argv, DAEMON_MAX_ARGS);
+	RenderOptions options;
+	optind = 0;	// Start getopt over for every job.
+	if(argc < 2 || !parseArguments(argc, argv, &options)){
+		error = "invalid arguments";
+	}
+	else if(options.help || NULL != options.outputFile || NULL != options.statsJsonFile || NULL != options.batchList || NULL != options.serveSocket
+		|| NULL != options.cacheDir || NULL != options.tilesName || options.records == RECORDS_SEPARATE || strcmp(options.inputFile, "-") == 0){
+		error = "jobs cannot use -h, -o, --stats-json, --batch, --serve, --cache, --tiles, --records separate or - as the input";
+	}
+	options.cacheDir = daemonOptions->cacheDir;
+
+	char *png = NULL;
+	size_t pngLen = 0;
+	if(NULL == error){
+		imageStream = open_memstream(&png, &pngLen);
+		if(NULL == imageStream){
+			error = "out of memory";
+		}
+		else{
+			bool rendered = renderFile(options.inputFile, NULL, &options);
+			fclose(imageStream);
+			imageStream = NULL;
+			runStatsFinish(&runStats);
+			if(!rendered){
+				error = "unable to render the image, see the daemon's messages";
+			}
+		}
+	}
+
+	char reply[128];
+	if(NULL == error){
+		snprintf(reply, sizeof(reply), "OK %zu\n", pngLen);
+		bool sent = sendToClient(client, reply, strlen(reply)) && sendToClient(client, png, pngLen);
+		if(runStats.basesUnknown){
+			printf("%s %s (%zu bytes, %f secs)\n", sent ? "Rendered" : "Client left before", options.inputFile, pngLen, runStats.wallSecs);
+		}
+		else{
+			printf("%s %s (%llu bases, %zu bytes, %f secs)\n", sent ? "Rendered" : "Client left before", options.inputFile,
+				(unsigned long long)runStats.bases, pngLen, runStats.wallSecs);
+		}
+	}
+	else{
+		snprintf(reply, sizeof(reply), "ERROR %s\n", error);
+		sendToClient(client, reply, strlen(reply));
+		printf("FAILED   %s: %s\n", job, error);
+	}
+	fflush(stdout);
+	free(png);
+}
+
+/*
+	Stay running and render the jobs sent to a Unix domain socket, until SIGINT or SIGTERM. Skipping the start up for every image
+	keeps the SIMD kernel choice and the OpenMP thread pool warm. Jobs are run one at a time in the order they connect,
+	each using every thread, so clients sending jobs at the same time share the cores instead of fighting over them.
+*/
+int runDaemon(const RenderOptions *options){
+	struct sockaddr_un address;
+	memset(&address, 0, sizeof(address));
+	address.sun_family = AF_UNIX;
+	if(strlen(options->serveSocket) >= sizeof(address.sun_path)){
+		fprintf(stderr, "Socket path %s is too long.\n", options->serveSocket);
+		return EXIT_FAILURE;
+	}
+	strcpy(address.sun_path, options->serveSocket);
+
+	// A socket left behind by a daemon which did not shut down cleanly is replaced, anything else at the path is left alone.
+	struct stat info;
+	if(lstat(options->serveSocket, &info) == 0 && S_ISSOCK(info.st_mode)){
+		unlink(options->serveSocket);
+	}
+	int server = socket(AF_UNIX, SOCK_STREAM, 0);
+	if(server < 0 || bind(server, (struct sockaddr *)&address, sizeof(address)) != 0 || listen(server, DAEMON_BACKLOG) != 0){
+		fprintf(stderr, "Unable to listen on %s: %s\n", options->serveSocket, strerror(errno));
+		if(server >= 0){
+			close(server);
+		}
+		return EXIT_FAILURE;
+	}
+
+	// No SA_RESTART, so a signal interrupts accept() and the loop can see it is time to stop.
+	struct sigaction action;
+	memset(&action, 0, sizeof(action));
+	action.sa_handler = stopDaemon;
+	sigemptyset(&action.sa_mask);
+	sigaction(SIGINT, &action, NULL);
+	sigaction(SIGTERM, &action, NULL);
+
+	showProgress = false;
+	printf("Listening for jobs on %s with %d threads...\n", options->serveSocket, omp_get_max_threads());
+	fflush(stdout);
+	int status = EXIT_SUCCESS;
+	while(!daemonStopping){
+		int client = accept(server, NULL, NULL);
+		if(client < 0){
+			if(errno == EINTR || errno == ECONNABORTED){
+				continue;
+			}
+			fprintf(stderr, "Unable to accept jobs on %s: %s\n", options->serveSocket, strerror(errno));
+			status = EXIT_FAILURE;
+			break;
+		}
+
+		// Do not let a client which never finishes its request hold up the jobs behind it.
+		struct timeval timeout = {DAEMON_REQUEST_TIMEOUT, 0};
+		setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+		runDaemonJob(client, options);
+		close(client);
+	}
+
+	close(server);
+	unlink(options->serveSocket);
+	printf("Stopped listening on %s.\n", options->serveSocket);
+	return status;
+}
+
+// Main function, responsible for parsing the commandline arguments, opening the text file then coordinating other functions.
+int main(int argc, char *argv[]){
+	// Read the umask while there is still only one thread.
+	fileCreationMask = umask(0);
+	umask(fileCreationMask);
+
+	RenderOptions options;
+	if(!parseArguments(argc, argv, &options)){
+		return EXIT_FAILURE;
+	}
+
+	if(options.help){
+		printUsage(stdout);
+		return EXIT_SUCCESS;
+	}
+
+	if(NULL != options.cacheDir && !renderCacheOpen(options.cacheDir)){
+		return EXIT_FAILURE;
+	}
+
+	// Pick the fastest validation kernel this CPU supports.
+	validationLevel = detectSIMDLevel();
+	if(NULL != options.serveSocket){
+		return runDaemon(&options);
+	}
+	if(NULL != options.batchList){
+		return runBatch(&options);
+	}
+
+	// Writing the image to standard output moves the progress messages over to standard error.
+	if(NULL != options.outputFile && strcmp(options.outputFile, "-") == 0 && !useStdoutForImage(options.decode)){
+		return EXIT_FAILURE;
+	}
+	if(options.decode){
+		if(!decodeFile(options.inputFile, options.outputFile, options.regionStart, options.regionEnd)){
+			return EXIT_FAILURE;
+		}
+		return finishRun(&options);
+	}
+	if(!renderFile(options.inputFile, options.outputFile, &options) && !saveFailed){
+		return EXIT_FAILURE;
+	}
+	return finishRun(&options);
+}
@@ -12,27 +12,249 @@
 #include <stdlib.h>
 #include <unistd.h>
 #include <stdbool.h>
+#include <string.h>
+#include <limits.h>
+#include <getopt.h>
+#include <stdarg.h>
+#include <omp.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <ctype.h>
+#include <errno.h>
+#include <dirent.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/un.h>
 #include "LODEPNG/lodepng.h"
 #include "NearestNeighbourUpscale.h"
+#include "SIMDValidation.h"
+#include "PngWriter.h"
+#include "ParallelDeflate.h"
+#include "SpaceFillingCurve.h"
+#include "RunStats.h"
+#include "Fasta.h"
+#include "Gzip.h"
+#include "RenderCache.h"
+#include "RestartIndex.h"
+#include "TilePyramid.h"
 
 #define DEFAULT_FILENAME "GenePic"
 #define FILENAME_BUFFER_SIZE 255
+#define IMAGE_EXTENSION ".png"
+#define OUTPUT_CREATE_ATTEMPTS 1000	// Give up on finding an unused image number after this many are taken by other runs in a row.
 #define PATH_SEPERATOR "/"
 #define CHANNELS_PER_PIXEL_RGB 3
 
+// Validation works through memory mapped input in blocks of this many characters so it can release the pages it has
+// finished with. Must be a multiple of the page size.
+#define VALIDATION_BLOCK_SIZE (64LL * 1024LL * 1024LL)
+
+// Input which cannot be memory mapped (such as a pipe) is read into a buffer which starts this big and doubles whenever it fills.
+#define INPUT_READ_CHUNK_SIZE (64LL * 1024LL * 1024LL)
+
+// --stream copies standard input and pipes to a temporary file this many characters at a time.
+#define INPUT_SPOOL_BUFFER_SIZE (1024 * 1024)
+
+// Streaming mode validates this many input characters at a time. Must be a multiple of the page size.
+#define STREAM_BLOCK_SIZE (4LL * 1024LL * 1024LL)
+
+// Size of the pieces the input is split into when counting valid bases on every thread.
+#define COUNT_CHUNK_SIZE (1024LL * 1024LL)
+
+// Stretches of sequence shorter than this (such as short FASTA records) are validated on one thread, starting the others costs more.
+#define PARALLEL_VALIDATION_MIN_LEN (64LL * 1024LL)
+
+// Record tiles are rounded up to a multiple of this many pixels so every tile starts on a byte at any palette bit depth.
+#define TILE_ALIGNMENT 4
+
+// In batch mode, input files at least this big are rendered one at a time using every thread. Smaller ones are rendered at the same time, one per thread.
+#define BATCH_LARGE_FILE_SIZE (16LL * 1024LL * 1024LL)
+
+// Daemon jobs are one line of at most this many characters, split into at most DAEMON_MAX_ARGS arguments.
+#define DAEMON_MAX_REQUEST (PATH_MAX + 1024)
+#define DAEMON_MAX_ARGS 64
+#define DAEMON_BACKLOG 64	// Clients which can be waiting for their job to start.
+#define DAEMON_REQUEST_TIMEOUT 10	// Seconds a client gets to send its job before it is dropped.
+
+// PNG stores the width and height as 31 bit integers.
+#define PNG_MAX_DIMENSION 2147483647
+
+// lodepng works out the bits in a row and the size of the filtered image (one filter byte plus the pixels of every row) with 32 bit
+// unsigned integers, so images bigger than this are written a row at a time with PngWriter instead.
+#define LODEPNG_MAX_RAW_SIZE 4294967295LL
+
 // Corresponding pixel values for each base colour. If you want, change these to the RGB values you want to use
 #define CYTOSINE_COLOUR {6,   201, 150}
 #define GUANINE_COLOUR  {17,  138, 178}
 #define ADENINE_COLOUR  {239, 71,  111}
 #define THYMINE_COLOUR  {255, 209, 102}
 
+// After validation each base is stored as a 2 bit code, 4 to a byte with the first base in the most significant bits.
+// The codes are picked so that bits 1-2 of the uppercase letter are the code, which means no lookup table is needed. (A = 0x41, C = 0x43, T = 0x54, G = 0x47)
+#define BASE_CODE(letter) (((letter) >> 1) & 3)
+#define BASE_A 0
+#define BASE_C 1
+#define BASE_T 2
+#define BASE_G 3
+#define BASE_LETTERS "ACTG"	// Letter for each 2 bit code, in code order.
+#define BASES_PER_BYTE 4
+#define PACKED_SEQUENCE_BYTES(len) (((len) + BASES_PER_BYTE - 1) / BASES_PER_BYTE)	// Bytes needed to pack len bases.
+#define PACKED_BASE_SHIFT(i) (6 - 2 * ((i) % BASES_PER_BYTE))	// Where base i sits in its byte.
+
+// Colour used for the blank pixels after the last base.
+#define BLANK_COLOUR {0, 0, 0}
+
+// Images are written as palette images. The first 4 entries are the base colours in the order of their 2 bit codes, so a base's code is
+// also its palette index. Blank pixels use the last entry, which is why images with blank pixels need 4 bits per pixel instead of 2.
+#define PALETTE_COLOURS {ADENINE_COLOUR, CYTOSINE_COLOUR, THYMINE_COLOUR, GUANINE_COLOUR, BLANK_COLOUR}
+#define PALETTE_SIZE 5
+#define BLANK_INDEX 4
+#define PALETTE_ROW_BYTES(width, bitDepth) (((width) * (long long int)(bitDepth) + 7) / 8)	// Bytes in one row of a palette image.
+
+// Images record the number of bases, their size, scale, layout and colours in a tEXt chunk with this keyword, which is what lets --decode
+// turn them back into the sequence. For example "bases=1000 width=32 height=32 scale=1 layout=rows colours=A=ef476f,C=06c996,...".
+#define IMAGE_METADATA_KEYWORD "gene2pic"
+#define IMAGE_METADATA_SIZE 256
+
 // Hard coded arguments. If you don't want to pass command line arguments for some reason.
 // Cannot just specify one and collect the other from the commandline, must indicate all of them here.
 #define USE_HARDCODED_ARGS false
 #define INPUT_FILE_HARDCODED "inputSequence.txt"
-#define SERPENTINE_HARDCODED false;
+#define SERPENTINE_HARDCODED false
 #define SCALE_HARDCODED 1
 
+// Holds the raw contents of the input file. Either a read-only memory mapping of the file or a heap buffer it was read into.
+typedef struct{
+	char *data;			// Raw characters from the input file.
+	long long int len;	// Number of characters in data.
+	bool mapped;		// True if data is a memory mapping of the file, false if it is a heap buffer.
+} InputBuffer;
+
+// Long commandline options which have no single letter version.
+enum{
+	OPTION_SERPENTINE = 256,
+	OPTION_STREAM,
+	OPTION_STATS_JSON,
+	OPTION_RECORDS,
+	OPTION_BATCH,
+	OPTION_COLOURS,
+	OPTION_SERVE,
+	OPTION_CACHE,
+	OPTION_TILES,
+	OPTION_DOWNSAMPLE,
+	OPTION_WIDTH,
+	OPTION_ASPECT,
+	OPTION_PNG,
+	OPTION_DECODE,
+	OPTION_REGION
+};
+
+// Order the bases are placed in the image.
+typedef enum{
+	LAYOUT_ROWS,		// Left to right, top to bottom.
+	LAYOUT_SERPENTINE,	// Like rows, but every second row goes right to left.
+	LAYOUT_HILBERT,		// Along a Hilbert curve.
+	LAYOUT_MORTON		// Along a Z-order (Morton) curve.
+} Layout;
+
+// What to do with files that hold several FASTA records.
+typedef enum{
+	RECORDS_MERGE,		// Draw them as one long sequence.
+	RECORDS_SEPARATE,	// One image per record.
+	RECORDS_TILES		// One image with a tile per record.
+} RecordMode;
+
+// Everything the commandline can change about how an image is rendered.
+typedef struct{
+	char *inputFile;	// Sequence file to read, "-" for standard input.
+	int scale;			// Each base becomes a scale x scale block of pixels.
+	Layout layout;		// Order the bases are placed in the image.
+	bool stream;		// Render a row at a time instead of holding the whole sequence and image in memory.
+	char *statsJsonFile;	// Where to write the --stats-json report, NULL if it was not asked for.
+	RecordMode records;	// How to draw multi-record FASTA files.
+	char *outputFile;	// Where to write the image, "-" for standard output. NULL picks a new GenePic<N>.png. The output directory in batch mode.
+	char *batchList;	// File or directory listing the inputs of a batch, NULL if this is not a batch.
+	char *serveSocket;	// Unix socket to take jobs from, NULL unless running as a daemon.
+	char *cacheDir;		// Directory of finished images to reuse, NULL if there is no cache.
+	char *tilesName;	// Write a tile pyramid with this name instead of a PNG, NULL for a normal image.
+	DownsampleMode downsample;	// How the zoomed out levels of the tile pyramid are made.
+	long long int width;	// Bases in each row, 0 to work it out from the aspect ratio.
+	double aspect;		// Width of the image divided by its height when the width is not fixed. 0 if --aspect was not given.
+	PngPreset png;		// How hard the PNGs are compressed.
+	u_char palette[PALETTE_SIZE][3];	// Colours of the bases and blank pixels, in palette order.
+	bool decode;		// Turn an image back into its sequence instead of making one.
+	long long int regionStart;	// Only decode bases regionStart to regionEnd - 1 (counting from 0). regionEnd is 0 to decode them all.
+	long long int regionEnd;
+	bool help;			// Only show how to use the program.
+} RenderOptions;
+
+// What an image made by gene2pic says about itself in its metadata, all --decode needs to find its bases.
+typedef struct{
+	long long int len;	// Number of bases.
+	long long int width;	// Size of the image in bases, before it was upscaled.
+	long long int height;
+	int scale;
+	Layout layout;
+} ImageMetadata;
+
+// One input file of a batch.
+typedef struct{
+	char *inputFile;
+	char *outputFile;
+	bool large;			// Rendered on its own with every thread instead of alongside the other small files.
+	bool rendered;		// Set once the image has been saved.
+	RunStats stats;
+} BatchJob;
+
+// Where the bases of a curve layout go. The image is covered by curve squares as wide as its shorter side (rounded up to a power of two),
+// one after another along its longer side, so the curve never wanders far outside the image however long and thin it is.
+typedef struct{
+	CurveTable curve;			// The curve of one square. Transposed when the squares go down the image.
+	long long int width;		// Size of the image.
+	long long int height;
+	long long int squareSide;
+	long long int numSquares;
+	bool vertical;				// The squares go down the image instead of across it.
+	long long int squareBases;	// Bases in each square but the last one.
+	long long int *tileStarts;	// Bases before each curve tile of a square (plus the total), for every square but the last one.
+	long long int *lastTileStarts;	// The same for the last square, which may be cut short by the end of the image.
+	u_int64_t numTiles;			// Curve tiles in all the squares.
+} CurveLayout;
+
+// What is needed to draw any part of an image on its own, straight from the packed sequence. Used for tile pyramids.
+typedef struct{
+	const u_char *packedSequence;
+	long long int width;		// Bases in each row of the image.
+	long long int height;		// Rows of bases in the image.
+	long long int len;			// Number of bases.
+	int scale;
+	Layout layout;
+	CurveLayout curve;			// Only set up for the curve layouts.
+	u_int64_t *tileAt;			// Curve tile of a square at each tile position of the square, row by row.
+	long long int tilesPerSide;	// Tiles on each side of a square.
+} ImageSource;
+
+// An image file being written.
+typedef struct{
+	FILE *file;
+	char path[PATH_MAX];	// Name the image ends up with.
+	char tempPath[PATH_MAX];	// Where it is written until it is finished, empty if it is written straight to path.
+} OutputFile;
+
+// Hands out the valid bases of an input file a few at a time, validating one block of the input whenever it runs out.
+typedef struct{
+	const InputBuffer *input;
+	long long int inputPos;		// First input character which has not been validated yet.
+	char *buffer;				// Valid bases from the most recently validated block.
+	long long int bufferLen;	// Number of valid bases in buffer.
+	long long int bufferPos;	// Next base in buffer to hand out.
+	FastaParser parser;			// Skips the FASTA headers.
+} BaseReader;
+
+// printf() for progress messages, which are left out when showProgress is off.
+void progress(const char *format, ...);
+
 // Quickly find the length of the input file. This may not actually be the gene sequence length since
 // characters like newlines or letters that are not a,t,c,g,u (upper and lower case) will be ignored.
 long long int getFileLen(FILE *f);
@@ -41,8 +263,10 @@ long long int getFileLen(FILE *f);
 // Image will have a section with black pixels at end if length is not a perfect square.
 long long int findSquareSize(long long int len);
 
-// Calculate the amount of time in seconds between the provided start and finish timespec structs.
-double getElapsedTime(struct timespec start, struct timespec finish);
+// Work out the width and height (in bases) of the image for len bases. A fixed --width is used as it is and the image is as tall as it
+// needs to be. Otherwise the image is as close to the --aspect ratio as it can be with less than one row of blank pixels, or the square
+// from findSquareSize() if no aspect ratio (or 1:1) was asked for.
+void findImageSize(long long int len, const RenderOptions *options, long long int *width, long long int *height);
 
 // Functions to determine whether or not a string starts with or ends with a particular string.
 bool endsWith(char* str, char* toCheck);
@@ -51,18 +275,146 @@ bool startsWith(char* str, char* toCheck);
 // Construct a filepath from two strings. sizeFile is the number of valid characters in the file string.
 char *path_join(char* dir, char* file, int sizeFile);
 
-// Determine how many digits are in a base 10 integer.
-int getIntDigits(int num);
+// Find the highest N of the GenePic<N>.png images already in dir (GenePic.png counts as 1). Returns 0 if there are none.
+// Done in one pass over the directory instead of checking every possible name in turn.
+long long int findHighestImageNumber(const char *dir);
+
+// Create a new GenePic<N>.png in the current working directory without overwriting any previous images. The number carries on from
+// the highest one in use, and the file is created with O_EXCL so runs at the same time never pick the same name.
+bool createNumberedOutput(OutputFile *output);
+
+// Open the file the next image should be written to. An image given with -o is written to a temporary file next to it and renamed
+// over it once it is finished. Without -o a new numbered image is created. Returns false (after saying so) if the file could not be opened.
+bool openOutputFile(OutputFile *output);
+
+// Finish writing an image opened with openOutputFile(). Written says whether everything before this went fine. If it did the image is
+// moved into place, otherwise the partial file is removed. Returns true if the image was saved.
+bool closeOutputFile(OutputFile *output, bool written);
+
+// Keep standard output for the PNG (or the sequence with --decode), and send the progress messages that would normally go there to standard
+// error instead. Only text may go to a terminal. Returns false (after saying why) if standard output cannot be used.
+bool useStdoutForImage(bool text);
 
-// Save the image, do not overwrite any previous images.
-void saveImg(u_char* colours, long long int dim);
+// Make sure an image of width x height bases is no more than maxDimension pixels on either side once it is upscaled by scale. The sizes
+// are compared before they are multiplied, so huge images cannot overflow. Returns false (after saying so) if it is too big.
+bool checkImageSize(long long int width, long long int height, int scale, long long int maxDimension);
 
-// Performs nearest neighbor upscaling of the original image where each pixel in the original image is expanded into an expanded pixel of size scale^2 in the upscaled image.
-// Used for 24bit RBG images.
-void upscaleNN_RGB(u_char *originalImg, u_char *upscaledImg, int dimX, int dimY, int scale);
+// Save the palette image, do not overwrite any previous images.
+void saveImg(u_char *img, long long int width, long long int height, int bitDepth);
 
-// Assign each base in the sequence a coloured pixel in the image.
-void base2colour(const char* gene, long long int dim, long long int len, int scale, bool serpentineLastRowFlip);
+// Save the palette image upscaled by scale, do not overwrite any previous images. The upscaled image is never held in memory, its rows are
+// made from the 1:1 image as they are written. Repeated rows use pngRepeatRowFilter(), None (one long match against the row above) when
+// the row fits in the deflate window and Up (all zeros) when it does not, so they compress to almost nothing.
+void saveUpscaledImg(const u_char *img, long long int width, long long int height, int scale, int bitDepth);
+
+// Set up a lodepng colour mode for our palette (the 4 base colours followed by black for blank pixels) at the given bit depth.
+void setPaletteColourMode(LodePNGColorMode *mode, int bitDepth);
+
+// Pick the smallest palette bit depth for the image. The 4 bases fit in 2 bits, but if there are any blank pixels black needs a 5th entry.
+int paletteBitDepth(long long int len, long long int pixels);
+
+// Pack count palette indices (one per byte) into a row of the image at the given bit depth, first pixel in the most significant bits.
+void packIndexRow(const u_int8_t *indices, long long int count, int bitDepth, u_char *row);
+
+// Set pixel x of a palette image row to the given palette index.
+void setPalettePixel(u_char *row, long long int x, int bitDepth, u_int8_t index);
+
+// Number of bases before each tile of a curve covering a width x height image, plus one more entry at the end with the total. Cells
+// outside the image do not use up a base. The caller frees the array. Returns NULL (after saying so) if memory cannot be allocated.
+long long int *curveTileStarts(const CurveTable *table, long long int width, long long int height);
+
+// Set up the curve squares covering a width x height image. Returns false (after saying so) if memory cannot be allocated.
+bool curveLayoutInit(CurveLayout *layout, CurveType type, long long int width, long long int height);
+
+// Free the curve squares.
+void curveLayoutFree(CurveLayout *layout);
+
+// Find curve tile number tile over all the squares. Gives its top left corner in the image, the positions of its cells (relative to that
+// corner) in curve order and the number of bases before it. Returns the number of its cells which are inside the image.
+long long int curveLayoutTile(const CurveLayout *layout, u_int64_t tile, long long int *originX, long long int *originY, const u_int16_t **cells, long long int *base);
+
+// Find the curve tiles firstTile to endTile - 1 of the squares holding bases start to end - 1, so a region does not have to look at every tile.
+void curveLayoutTileRange(const CurveLayout *layout, long long int start, long long int end, u_int64_t *firstTile, u_int64_t *endTile);
+
+// Lay the bases out along a Hilbert or Morton curve instead of row by row, one curve square after another. Cells of the curve which fall
+// outside the image are skipped. The curve is split into tiles which are filled in on every thread. Returns false (after saying so) if memory cannot be allocated.
+bool layoutAlongCurve(const u_char *packedSequence, long long int width, long long int height, long long int len, CurveType type, u_char *img, long long int rowBytes, int bitDepth);
+
+// Slide the rows of a palette image together (in place) so there are no unused bits at the end of each row. This is the layout lodepng expects.
+void removeRowPadding(u_char *img, long long int width, long long int height, int bitDepth);
+
+// Upscale a single row of a palette image horizontally, each pixel is repeated scale times.
+void upscaleNN_IndexedRow(const u_char *originalRow, u_char *scaledRow, long long int dimX, int scale, int bitDepth);
+
+// Write the palette index of every base into a width x height rectangle of a palette image, in the order given by layout, with blank pixels
+// after the last base. img points at the top left byte of the rectangle and rowBytes is the length of a row of the whole image.
+// Returns false (after saying so) if memory cannot be allocated.
+bool layoutBases(const u_char *packedSequence, long long int width, long long int height, long long int len, Layout layout, bool serpentineLastRowFlip, u_char *img, long long int rowBytes, int bitDepth);
+
+// Save a finished palette image, upscaling it on the way out if scale is more than 1. Images too big for lodepng are written a row at a time. Frees the image.
+void savePaletteImage(u_char *img, long long int width, long long int height, int scale, int bitDepth);
+
+// Assign each base in the sequence a colour from the palette, giving a palette image with one pixel per base.
+void base2colour(const u_char *packedSequence, long long int width, long long int height, long long int len, int scale, Layout layout, bool serpentineLastRowFlip);
+
+// Lay every record of a multi-record file out in its own tile of one image. Tiles are all the size of the longest record's image and fill a square grid.
+void renderTiles(const u_char *packedSequence, const FastaParser *parser, const RenderOptions *options);
+
+/*
+	Draw part of the image as palette indices, straight from the packed sequence (TileDrawFunction for the tile pyramid). Every pixel
+	works out which base it shows the same way the whole image would be laid out, so the tiles match the full size image exactly.
+	Rows and serpentine rows are a formula. Curves go through each curve tile touching the region in curve order, which takes about as
+	long as filling the region since both are tiled. Returns false (after saying so) if memory cannot be allocated.
+*/
+bool drawImageRegion(const void *source, long long int x, long long int y, long long int width, long long int height, u_char *indices, long long int stride);
+
+// Write the image as a Deep Zoom tile pyramid (--tiles) instead of one PNG. The full size image is never built, the most detailed
+// tiles are drawn straight from the packed sequence.
+void renderTilePyramid(const u_char *packedSequence, long long int len, const RenderOptions *options);
+
+// Render a sequence on its own as one image, following the render options.
+void renderSequence(u_char *packedSequence, long long int len, const RenderOptions *options);
+
+// Render every record of a multi-record file to its own image. Records without any bases are skipped.
+void renderRecords(const u_char *packedSequence, const FastaParser *parser, const RenderOptions *options);
+
+// Describe the image about to be saved in the metadata written into it (see IMAGE_METADATA_KEYWORD).
+void setImageMetadata(long long int len, long long int width, long long int height, int scale, Layout layout);
+
+// Read the metadata of an image back. Returns false if anything is missing or does not make sense.
+bool parseImageMetadata(const char *text, ImageMetadata *metadata);
+
+/*
+	Read the header and metadata of a PNG made by gene2pic into state and metadata, without decoding the image data. The chunks are
+	walked through one at a time and only the text chunks are read, so this stays quick however big the image is. Returns false (after
+	saying why) if the image is not one gene2pic made, or does not match its metadata.
+*/
+bool readImageMetadata(const char *inputFile, const u_char *png, size_t pngSize, LodePNGState *state, ImageMetadata *metadata);
+
+// Palette index of pixel (x, y) of decoded palette image rows which are rowBits long. (lodepng gives a whole image as one long run of bits
+// with no padding between rows, pngReadRows() gives rows which start on a byte.)
+u_int8_t getDecodedPixel(const u_char *pixels, long long int rowBits, int bitDepth, long long int x, long long int y);
+
+// Find the rows (before scaling) of an image holding bases start to end - 1. With a curve layout the bases are spread over the rows of
+// every curve tile they are in. Returns false (after saying so) if memory cannot be allocated.
+bool findRegionRows(const ImageMetadata *metadata, long long int start, long long int end, long long int *firstRow, long long int *lastRow);
+
+/*
+	Read bases start to end - 1 back out of a decoded image, the reverse of layoutBases(). Pixels holds the image's rows of rowBits each,
+	starting from row firstRow (after scaling). Each base is read from the top left pixel of its scale x scale block, and its letter is
+	written to bases[base - start]. Returns false (after saying why) if a pixel where a base should be is not one of the 4 base colours,
+	or if memory cannot be allocated. InputFile is only used in the messages.
+*/
+bool readImageBases(const char *inputFile, const u_char *pixels, long long int rowBits, int bitDepth, long long int firstRow, const ImageMetadata *metadata, long long int start, long long int end, char *bases);
+
+/*
+	Turn an image made by gene2pic back into its sequence (--decode), following the layout in its metadata. The bases are written to
+	outputFile ("-" for standard output) as one line. With a --region (regionEnd more than 0) only bases regionStart to regionEnd - 1 are
+	written, and only the rows of the image they are in are inflated, starting from the image's restart index (see RestartIndex.h), so
+	the time it takes depends on the size of the region rather than of the image. Returns false (after saying why) if the image could
+	not be decoded.
+*/
+bool decodeFile(const char *inputFile, const char *outputFile, long long int regionStart, long long int regionEnd);
 
 /* Flips every other row so that instead of:
 	1->2->3
@@ -78,10 +430,191 @@ void base2colour(const char* gene, long long int dim, long long int len, int sca
 	|
 	7->8->9
 */
-bool applySerpentine(char *geneSequence, long long int dim, long long int len);
+bool applySerpentine(u_char *packedSequence, long long int width, long long int len);
+
+// Map an open file into memory so validation can read directly from the page cache instead of copying the whole file onto the heap.
+// The file descriptor is left open. Returns false if the file cannot be mapped (for example if it is empty or not a regular file).
+bool mapInputDescriptor(int fd, InputBuffer *input);
+
+// Map the input file into memory, see mapInputDescriptor(). Returns false if the file cannot be mapped.
+bool mapInputFile(const char *inputFile, InputBuffer *input);
+
+// Used instead of readInputFile() by --stream. Standard input ("-") or a pipe is copied to a deleted temporary file which is mapped instead,
+// so it does not have to fit in memory. Returns false (after saying why) if the input could not be read or copied.
+bool spoolInputFile(const char *inputFile, InputBuffer *input);
+
+// Fallback for when the input cannot be memory mapped. Reads the whole file ("-" for standard input) into a heap buffer.
+// The buffer grows as the input is read, so pipes and other files whose length is not known up front work too. Anything that is not a
+// regular file, a pipe or standard input is refused. Returns false (after saying why) if the input could not be read.
+bool readInputFile(const char *inputFile, InputBuffer *input);
+
+// Release the memory mapping or heap buffer holding the input file.
+void releaseInput(InputBuffer *input);
+
+// Replace gzip or BGZF compressed input with its decompressed contents. Returns false (after saying what was wrong) if it could not be decompressed.
+bool decompressInput(InputBuffer *input);
+
+// Copy the valid bases from input to output, skipping any characters that are not ATCGU (upper or lowercase) and converting lowercase to uppercase.
+// Output may be the same array as input. Never writes past output + outputCapacity. Returns the number of valid bases written to output.
+long long int validateBases(const char *input, char *output, long long int len, long long int outputCapacity);
+
+// Count how many valid bases (ATCGU, upper or lowercase) are in the input without copying them anywhere.
+long long int countValidBases(const char *input, long long int len);
+
+// Same as validateBases() but uses every thread in the OpenMP team. Each thread counts the valid bases in its own chunk of the input,
+// then a prefix sum over those counts tells each thread where to write its compacted bases so no locking is needed. Output must not overlap the input.
+long long int validateBasesParallel(const char *input, char *output, long long int len);
+
+// Read the 2 bit code of base i in a packed sequence.
+u_int8_t getPackedBase(const u_char *packedSequence, long long int i);
+
+// Overwrite the 2 bit code of base i in a packed sequence.
+void setPackedBase(u_char *packedSequence, long long int i, u_int8_t code);
+
+// Copy count packed bases starting at base start of src to the start of dst, so they begin on a byte. Unused bits of the last byte are zeroed.
+void copyPackedBases(const u_char *src, long long int start, long long int count, u_char *dst);
+
+// Copy the 2 bit codes of count bases starting at base number start out of a packed sequence, one code per byte.
+void unpackBases(const u_char *packedSequence, long long int start, long long int count, u_int8_t *codes);
+
+// Pack len validated bases (uppercase ACGT letters) into packedSequence starting at base number offset.
+void packBases(const char *bases, long long int len, u_char *packedSequence, long long int offset);
+
+// Read in the data from the sequence file and ignore any characters that are not ATCGU (upper or lowercase), as well as any FASTA header lines.
+// The valid bases are stored 2 bits each in packedSequence, which must have room for PACKED_SEQUENCE_BYTES(input->len) bytes and be zeroed.
+// The records found in the file are added to parser. Returns the number of valid bases, or -1 (after saying so) if memory cannot be allocated.
+long long int readAndValidateInput(u_char *packedSequence, const InputBuffer *input, FastaParser *parser);
+
+// Count the valid bases in input using every thread. Nothing is written anywhere, so this can run over a read-only mapping.
+long long int countValidBasesParallel(const char *input, long long int len);
+
+// Set up a reader which hands out the valid bases of the input a few at a time. Returns false (after saying so) if memory cannot be allocated,
+// the reader must still be freed with baseReaderFree().
+bool baseReaderInit(BaseReader *reader, const InputBuffer *input);
+
+// Copy up to count valid bases into output. Returns how many were copied, which is only less than count once the input runs out.
+long long int baseReaderRead(BaseReader *reader, char *output, long long int count);
+
+// Free the reader's buffer. Does not release the input.
+void baseReaderFree(BaseReader *reader);
+
+// Render the image without ever holding the whole sequence or image in memory. The valid bases are counted first to find the image size,
+// then the input is validated a block at a time and each row is coloured, upscaled and fed straight into a streaming PNG encoder.
+// Returns false (after saying why) if the image could not be made.
+bool renderStreaming(const InputBuffer *input, const RenderOptions *options);
+
+// Print how to use the program.
+void printUsage(FILE *stream);
+
+// Read a scale argument. Returns false if it is not a positive integer.
+bool parseScale(const char *arg, int *scale);
+
+// Read a --width argument. Returns false if it is not a positive integer.
+bool parseWidth(const char *arg, long long int *width);
+
+// Read an --aspect argument, either WIDTH:HEIGHT or the width divided by the height. Returns false if it is not a positive ratio.
+bool parseAspect(const char *arg, double *aspect);
+
+// Read a layout name. Returns false if it is not one we know.
+bool parseLayout(const char *arg, Layout *layout);
+
+// Name of a layout, as used on the commandline.
+const char *layoutName(Layout layout);
+
+// Read a --region argument, START-END counting from 1 with both ends included (commas between the digits are allowed, like samtools).
+// Gives the region as bases start to end - 1 counting from 0. Returns false if it is not a valid region.
+bool parseRegion(const char *arg, long long int *start, long long int *end);
+
+// Read a list of colours such as "A=ef476f,T=ffd166" into the palette. The bases are A, C, G and T (or U), and "blank" is the colour
+// of the pixels after the last base. Colours are 6 hex digits, optionally starting with #. Colours which are not listed are left as
+// they are. Returns false if the list cannot be read.
+bool parseColours(const char *arg, u_char palette[PALETTE_SIZE][3]);
+
+// Read a records mode name. Returns false if it is not one we know.
+bool parseRecordMode(const char *arg, RecordMode *mode);
+
+// Fill in the render options from the commandline. The original positional forms (<INPUT_FILE> [SERPENTINE] [SCALE]) still work
+// alongside the named options. Returns false (after telling the user what was wrong) if the arguments are not usable.
+bool parseArguments(int argc, char *argv[], RenderOptions *options);
+
+// Print how long the whole run took and write the --stats-json report if one was asked for. Returns the exit status for main().
+int finishRun(const RenderOptions *options);
+
+// Work out where the image for this input and these render options is kept in the --cache directory. The key is a hash of the raw
+// input rather than of the valid bases, so a repeat only costs the hash and not the validation. Returns false if there is no cache.
+bool findCachedImage(const InputBuffer *input, const RenderOptions *options, char *path, size_t size);
+
+// Check that an image in the cache is a whole PNG with readable gene2pic metadata (which it must have if needsMetadata). Returns the number
+// of bases from the metadata, 0 if the image has none, or -1 if it is missing or damaged.
+long long int checkCachedImage(const char *cachePath, bool needsMetadata);
+
+// Copy an image from the cache to where the image should be saved. Returns false (after saying why) if it could not be copied.
+bool copyCachedImage(const char *cachePath);
+
+// Render the image for an input which has been read. Takes care of releasing the input. Returns false if no image could be made.
+bool renderInput(InputBuffer *input, const RenderOptions *options);
+
+/*
+	Render one input file following the render options, writing the image to outputFile (NULL picks a new GenePic<N>.png). Everything
+	about the file is kept in this thread's copy of the per-file state, so several files can be rendered at once on different threads.
+	Returns false (after saying what went wrong) if no image could be made.
+*/
+bool renderFile(const char *inputFile, const char *outputFile, const RenderOptions *options);
+
+// Read the list of inputs for a batch. A directory gives every regular file in it (in name order), anything else is read as a
+// list of files with one per line ("-" reads the list from standard input). Blank lines and lines starting with # are skipped.
+// Returns a malloc'd array of malloc'd paths and sets numInputs, or NULL (after saying why) if the list could not be read.
+char **listBatchInputs(const char *list, long long int *numInputs);
+
+// Compare two strings through pointers to them, for qsort().
+int compareStrings(const void *a, const void *b);
+
+// Name of the image for a batch input: its file name with the extension (and any .gz) swapped for .png, in outputDir.
+char *batchOutputName(const char *inputFile, const char *outputDir);
+
+// Compare two batch jobs by the name of their image, for qsort().
+int compareBatchOutputs(const void *a, const void *b);
+
+// Make sure no two inputs of a batch would be saved to the same image. Returns false (after naming every clash) if any image name is used more than once.
+bool checkBatchOutputNames(BatchJob *jobs, long long int numJobs);
+
+// Render one file of a batch and report how it went in one line.
+void renderBatchJob(BatchJob *job, const RenderOptions *options);
+
+/*
+	Render every input of a batch in one process. Each image is named after its input and written to the -o directory (the current
+	directory by default). Files at least BATCH_LARGE_FILE_SIZE bytes are rendered one at a time with every thread working on each
+	stage, as they would be on their own. The small files are too small for that to help, so they are rendered at the same time,
+	one per thread, each running its stages on that one thread. Both share the one OpenMP thread pool.
+*/
+int runBatch(const RenderOptions *options);
+
+// Signal handler which asks the daemon to stop.
+void stopDaemon(int signal);
 
-// Read in the data from the sequence file and ignore any characters that are not ATCGU (upper or lowercase). Also convert lowercase to uppercase.
-long long int readAndValidateInput(char *geneSequence, FILE *geneFile, long long int len);
+// Split a daemon job into arguments at spaces and tabs, the same way a shell would for simple commands. Double quotes group an argument
+// with spaces in it and a backslash keeps the next character as it is. The arguments are written over line and pointed to from argv,
+// after a first argument standing in for the program name. Returns the number of arguments, or -1 if there are more than maxArgs or a
+// quote is not closed.
+int splitJobArguments(char *line, char *argv[], int maxArgs);
+
+// Send all len bytes to a daemon client. Returns false if the client went away.
+bool sendToClient(int client, const void *data, size_t len);
+
+/*
+	Run one daemon job. The client sends one line with the arguments for the job, the same as they would be given on the commandline
+	(for example "ebola.txt --layout hilbert -s 2 --colours A=ff0000"). The image is rendered into memory and sent back after a line
+	"OK <BYTES>", or a line "ERROR <REASON>" is sent if it could not be made. Relative paths are relative to where the daemon was started.
+	Jobs use the daemon's --cache, if it has one.
+*/
+void runDaemonJob(int client, const RenderOptions *daemonOptions);
+
+/*
+	Stay running and render the jobs sent to a Unix domain socket, until SIGINT or SIGTERM. Skipping the start up for every image
+	keeps the SIMD kernel choice and the OpenMP thread pool warm. Jobs are run one at a time in the order they connect,
+	each using every thread, so clients sending jobs at the same time share the cores instead of fighting over them.
+*/
+int runDaemon(const RenderOptions *options);
 
 // Main function, responsible for parsing the commandline arguments, opening the text file then coordinating other functions.
 int main(int argc, char* argv[]);